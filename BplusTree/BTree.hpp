@@ -1,16 +1,70 @@
 # include "utility.hpp"
 # include <fstream>
+# include <iostream>
+# include <cstdio>
+# include <cstring>
 # include <functional>
 # include <cstddef>
+# include <atomic>
+# include <limits>
+# include <mutex>
+# include <shared_mutex>
+# include <thread>
+# include <chrono>
+# include <condition_variable>
+# include <fcntl.h>
+# include <sys/ioctl.h>
+# include <sys/stat.h>
+# include <linux/fs.h>
+# include <unistd.h>
 # include "exception.hpp"
+# include "cache.hpp"
+# include "aggregate.hpp"
+# include "skiplist.hpp"
+# include "filter.hpp"
+# include "latch.hpp"
+# include "parallel.hpp"
+# include "versions.hpp"
+# include "shadow.hpp"
+# include "async.hpp"
+# include "database.hpp"
+# include "storage.hpp"
 
 namespace sjtu {
 
 	int ID = 0;
-	template <class KeyType, class ValueType, class Compare = std::less<KeyType> >
+
+	/**
+	 * zero bytes that take an object of used bytes up to whole pages; nothing if it already is.
+	 */
+	template <size_t used, size_t page, size_t n = (used + page - 1) / page * page - used>
+	struct pagePad {
+		char pad[n];
+		pagePad() { memset(pad, 0, n); }
+	};
+	template <size_t used, size_t page>
+	struct pagePad <used, page, 0> {};
+
+	/**
+	 * room for a node that readFile() fills before it is looked at, left unconstructed: constructing
+	 * a node value-initialises every pair in it, a page of zeros thrown away on each lookup.
+	 */
+	template <class Node>
+	struct nodeRoom {
+		alignas(Node) char bytes[sizeof(Node)];
+		Node *get() { return reinterpret_cast <Node *> (bytes); }
+	};
+
+	/**
+	 * Storage says where the nodes are kept (see storage.hpp): FileStorage in a file, MmapStorage in
+	 * a file mapped into memory, MemoryStorage in memory only, with no file at all.
+	 */
+	template <class KeyType, class ValueType, class Compare = std::less<KeyType>, class Aggregate = noAggregate,
+	          class Storage = FileStorage>
 	class BTree {
 		public:
 			typedef pair <KeyType, ValueType> value_type;
+			typedef typename Aggregate::value_type aggregate_type;
 			typedef ssize_t node_t;
 			typedef ssize_t offset_t;
 
@@ -18,39 +72,62 @@ namespace sjtu {
 
 			class const_iterator;
 
+			class view;
+
 		private:
-			static const int M = (4079 / (sizeof(node_t) + sizeof(KeyType))) < 5 ? 4 : (4079 / (sizeof(node_t) + sizeof(KeyType)) - 1);                // need modify
-			static const int L = (4076 / (sizeof(value_type))) < 5 ? 4 : (4076 / (sizeof(value_type)) - 1);                 // need modify
+			// a node is a page of the file at an offset that is a multiple of PAGE (whole pages if the
+			// keys are too big for 5 in a page), so O_DIRECT reads and writes it as one aligned block.
+			// M and L are as big as fits, with PAD_ROOM spare for the padding between the fields.
+			static const size_t PAGE = 4096;
+			static const size_t PAD_ROOM = 4 * alignof(std::max_align_t);
+			static const size_t M_HEAD = 2 * sizeof(node_t) + sizeof(int) + sizeof(bool) + PAD_ROOM;
+			static const size_t L_HEAD = 4 * sizeof(node_t) + sizeof(int) + sizeof(KeyType) + sizeof(bool) + PAD_ROOM;
+			static const size_t M_FIT = M_HEAD < PAGE ? (PAGE - M_HEAD) / (sizeof(node_t) + sizeof(KeyType) + sizeof(size_t) + sizeof(aggregate_type)) : 0;
+			static const size_t L_FIT = L_HEAD < PAGE ? (PAGE - L_HEAD) / sizeof(value_type) : 0;
+			static const int M = M_FIT < 5 ? 4 : M_FIT - 1;
+			static const int L = L_FIT < 5 ? 4 : L_FIT - 1;
 //			static const int M = 1000;
 //			static const int L = 200;
 			static const int MMIN = (M+1) / 2;            // M / 2
 			static const int LMIN = (L+1) / 2;            // L / 2
 			static const int info_offset = 0;
+			static const offset_t node_offset = PAGE;     // the first node, past the page of basicInfo
+
+			/**
+			 * function: size rounded up to whole pages, what every region of the file takes, so the
+			 * nodes after it stay on page boundaries.
+			 */
+			static inline offset_t page_up(size_t size) {
+				return static_cast <offset_t> ((size + PAGE - 1) / PAGE * PAGE);
+			}
 
 			struct nameString {
 				char *str;
 
-				nameString() { str = new char[10]; }
+				nameString() { str = nullptr; }
 
-				~nameString() { if (str != nullptr) delete str; }
+				~nameString() { delete [] str; }
 
-				void setName(int id) {
-					if (id < 0 || id > 9) throw "no more B plus Tree!";
-					str[0] = 'd';
-					str[1] = 'a';
-					str[2] = 't';
-					str[3] = static_cast <char> (id + '0');
-					str[4] = '.';
-					str[5] = 'd';
-					str[6] = 'a';
-					str[7] = 't';
-					str[8] = '\0';
+				/**
+				 * function: datN.ext, N = id.
+				 */
+				void setName(int id, const char *ext = "dat") {
+					if (id < 0) throw "no such B plus Tree!";
+					char buf[32];
+					snprintf(buf, sizeof(buf), "dat%d.%s", id, ext);
+					setName(buf);
 				}
 
-				void setName(char *_str) {
-					int i = 0;
-					for (; _str[i]; ++i) str[i] = _str[i];
-					str[i] = 0;
+				/**
+				 * function: the path _str followed by suffix.
+				 */
+				void setName(const char *_str, const char *suffix = "") {
+					size_t n = strlen(_str), m = strlen(suffix);
+					char *tmp = new char[n + m + 1];
+					memcpy(tmp, _str, n);
+					memcpy(tmp + n, suffix, m + 1);
+					delete [] str;
+					str = tmp;
 				}
 			};
 
@@ -60,45 +137,155 @@ namespace sjtu {
 				node_t root;          // root of Btree
 				size_t size;          // size of Btree
 				offset_t eof;         // end of file
+				bool augmented;       // subtree sizes and aggregates in internal nodes are maintained
+				offset_t buffer;      // messages of the write buffer
+				int buffer_size;      // messages that fit in the space at buffer
+				int buffer_cap;       // flush when there are so many messages, 0 if there is no buffer
+				int buffer_cnt;       // messages in the buffer
+				size_t memtable_cap;  // merge the memtable when it has so many keys, 0 if there is no memtable
+				offset_t shadow;      // the two commit headers of shadow paging, 0 if it is off
 				basicInfo() {
 					head = 0;
 					tail = 0;
 					root = 0;
 					size = 0;
 					eof = 0;
+					augmented = 0;
+					buffer = 0;
+					buffer_size = buffer_cap = buffer_cnt = 0;
+					memtable_cap = 0;
+					shadow = 0;
 				}
 			};
 
-			struct leafNode {
+			struct shadowHeader {
+				uint64_t seq;         // number of the commit, the valid header with the biggest one is current
+				basicInfo info;
+				offset_t map;         // newest piece of the page map of the commit
+				size_t map_cnt;       // pages in the piece
+				uint64_t check;       // checksum of everything above
+			};
+
+			// in front of every piece of the page map; a commit writes the pages moved since the one
+			// before as a new piece, and now and then the whole map as a piece with no prev.
+			struct mapLink {
+				offset_t prev;        // the piece before, 0 if there is none
+				size_t prev_cnt;      // pages in it
+			};
+			struct mapPiece {
+				offset_t offset;
+				size_t cnt;
+			};
+
+			/**
+			 * the fields of a leaf; leafNode pads it to whole pages, and internalNode the same.
+			 */
+			struct leafBody {
 				offset_t offset;          // offset
 				node_t par;               // parent
 				node_t pre, nxt;          // previous and next leaf
 				int cnt;                  // number of pairs in leaf
 				value_type data[L + 1];   // data
-				leafNode() {
+				KeyType high;             // smallest key of the next leaf, every key here is smaller
+				bool bounded;             // there is a next leaf (high is set)
+				leafBody() {
 					offset = 0, par = 0, pre = 0, nxt = 0, cnt = 0;
+					bounded = 0;
 				}
 			};
-			struct internalNode {
+			struct leafNode : leafBody, pagePad <sizeof(leafBody), PAGE> {};
+			struct message {
+				KeyType key;
+				ValueType value;
+				bool erased;              // erase the key, otherwise upsert (key, value)
+			};
+			// num[] and agg[] are in every internal node, augmented or not, so augment() only fills them
+			// in and the file is laid out the same either way; they take room from the keys, and a
+			// file written before they were added (or before nodes were pages) cannot be opened.
+			struct internalBody {
 				offset_t offset;      	// offset
 				node_t par;           	// parent
 				node_t ch[M + 1];     	// children
 				KeyType key[M + 1];   	// key
+				size_t num[M + 1];    	// number of pairs in the subtree of each child
+				aggregate_type agg[M + 1];	// aggregate of the subtree of each child
 				int cnt;              	// number in internal node
 				bool type;            	// child is leaf or not
-				internalNode() {
+				internalBody() {
 					offset = 0, par = 0;
-					for (int i = 0; i <= M; ++i) ch[i] = 0;
+					for (int i = 0; i <= M; ++i) ch[i] = 0, num[i] = 0;
 					cnt = 0;
 					type = 0;
 				}
 			};
+			struct internalNode : internalBody, pagePad <sizeof(internalBody), PAGE> {};
+			static_assert(sizeof(leafNode) % PAGE == 0 && sizeof(internalNode) % PAGE == 0, "a node is not whole pages");
 
 
-			FILE *fp;
+			mutable Storage store;
 			bool fp_open;
 			nameString fp_name;
 			basicInfo info;
+			mutable hotCache <KeyType, ValueType> cache;
+			Aggregate combine;
+			message *pending;
+			int pending_cnt;
+			skipList <KeyType, message> memtable;
+			keyFilter <KeyType> filter;   // the keys that may be in the tree, while the memtable is on
+			mutable std::mutex memtable_latch;
+			FILE *log_fp;
+			nameString log_name;
+
+			typedef std::shared_lock <std::shared_timed_mutex> shared_latch;
+			static const int RETRY = 8;           // optimistic reads before falling back to the latches
+			static const int MAP_PIECES = 64;     // pieces of the page map before it is written whole again
+			mutable versionLatch tree_latch;
+			mutable latchTable node_latch;
+			mutable std::mutex info_latch;
+			offset_t *unposted;       // leaves split under the shared latch, not yet in their fathers
+			int unposted_cnt, unposted_cap;
+			offset_t *deferred;       // leaves left underfull under the shared latch, not merged yet
+			int deferred_cnt, deferred_cap;
+			nameString ver_name;
+			mutable versionStore versions;       // old pages read by the open snapshots
+			mutable pageTable pages;             // where the pages are, with shadow paging on
+			size_t shadow_batch;      // commit when so many pages have moved, 0 for commit() only
+			uint64_t shadow_seq;
+			mapPiece *shadow_piece;   // the page map of the last commit, oldest piece first
+			int shadow_pieces, shadow_piece_cap;
+			size_t shadow_map_cnt;    // pages in all the pieces, some of them there more than once
+			const BTree *copy_source;
+			openOptions options;
+			Database *space;          // the database holding the tree, nullptr if it has a file of its own
+			Database::segment *seg;
+			std::thread service;      // the background service, if running
+			std::mutex service_latch;
+			std::condition_variable service_cv;
+			bool service_stop;
+			bool service_on;          // changed under the exclusive tree latch
+			int service_period;       // milliseconds between two rounds
+			int service_age;          // milliseconds a buffered change may wait
+			size_t service_extent;    // bytes preallocated ahead of the end of the file
+			std::chrono::steady_clock::time_point dirty_since;
+			bool dirty;               // the service saw buffered changes since dirty_since
+			int readahead_leaves;     // leaves a scan asks for ahead, 0 for none
+			bool compact_on;          // a compaction is running, changed under the exclusive tree latch
+			std::mutex compact_latch; // held by the thread carrying the compaction on, guards the rest
+			int compact_fill;         // pairs per leaf in the new file
+			bool compact_started;     // compact_cursor is set
+			bool compact_copied;      // every pair is in the new file, and the internal nodes too
+			KeyType compact_cursor;   // the last pair copied
+			skipList <KeyType, bool> compact_dirty;   // keys written since the start
+			nameString compact_name;  // the new file, or the segment of the new tree in a Database
+			Storage compact_store;
+			Database::segment *compact_seg;
+			leafNode *compact_batch;  // leaves not written yet, the last one being filled
+			int compact_batch_cnt;
+			size_t compact_leaves, compact_cap, compact_size;
+			KeyType *compact_low;     // smallest key, size and aggregate of every leaf
+			size_t *compact_num;
+			aggregate_type *compact_agg;
+			offset_t compact_root, compact_eof;
 
 			// ================================= file operation ===================================== //
 			/**
@@ -109,7 +296,17 @@ namespace sjtu {
 			 *                                         file, then put it in *place. return successful operations.
 			 *    writeFile(*place, offset, num, size): write size * num bytes to the offset position of the
 			 *                                         file from *place, return successful operations.
-			 *    copy_readFile(*place, offset, num, size): the same function as readFile, just different filename.
+			 *    readFile() and writeFile() use pread / pwrite, so threads do not share a file position.
+			 *    they and everything else that touches the file go through raw_read() / raw_write() /
+			 *    raw_sync(), which send a tree kept in a Database to its segment instead, and the others
+			 *    to store, the Storage.
+			 *    advise(offset, size): tell the kernel the bytes [offset, offset + size) are read soon.
+			 *    the storage may be longer than the tree (it grows in extents); file_end() is where the
+			 *    tree ends, and closeFile() gives the rest back.
+			 *    while a snapshot is open, writeFile() first lets versions keep the node it overwrites.
+			 *    with shadow paging on, nodes are read from and written to where pages puts them,
+			 *    and basicInfo is only written by a commit.
+			 *    clone_file(eof): copy the first eof bytes of the source file as they are.
 			 *    copy_leaf(offset, from_offset, par_offset): copy the leaf from from_offset to offset.
 			 *    copy_node(offset, from_offset, par_offset): copy the internal node from from_offset to offset.
 			 *    copy_File(name1, name2): copy file from name1 to name2.
@@ -118,71 +315,113 @@ namespace sjtu {
 
 			inline void openFile() {
 				file_already_exists = 1;
+				if (fp_open == 0 && space != nullptr) {
+					file_already_exists = !space -> empty(seg);
+					if (file_already_exists) readFile(&info, info_offset, 1, sizeof(basicInfo));
+					fp_open = 1;
+				}
 				if (fp_open == 0) {
-					fp = fopen(fp_name.str, "rb+");
-					if (fp == nullptr) {
-						file_already_exists = 0;
-						fp = fopen(fp_name.str, "w");
-						fclose(fp);
-						fp = fopen(fp_name.str, "rb+");
-					} else readFile(&info, info_offset, 1, sizeof(basicInfo));
+					file_already_exists = store.open(fp_name.str, options);
+					if (file_already_exists) readFile(&info, info_offset, 1, sizeof(basicInfo));
 					fp_open = 1;
 				}
 			}
 
+			inline void check_writable() const {
+				if (options.mode == openOptions::READ_ONLY) throw "the tree is read-only";
+			}
+
 			inline void closeFile() {
 				if (fp_open == 1) {
-					fclose(fp);
+					if (space == nullptr) store.close(file_end());
 					fp_open = 0;
 				}
 			}
 
-			inline void readFile(void *place, offset_t offset, size_t num, size_t size) const {
-				if (fseek(fp, offset, SEEK_SET)); // throw "open file failed!";
-				fread(place, size, num, fp);
+			inline void raw_read(void *place, size_t size, offset_t offset) const {
+				if (space != nullptr) space -> read(seg, place, size, offset);
+				else store.read(place, size, offset);
 			}
 
-			inline void writeFile(void *place, offset_t offset, size_t num, size_t size) const {
-				if (fseek(fp, offset, SEEK_SET)); // throw "open file failed!";
-				fwrite(place, size, num, fp);
+			inline void raw_write(const void *place, size_t size, offset_t offset) const {
+				if (space != nullptr) space -> write(seg, place, size, offset);
+				else store.write(place, size, offset);
+			}
+
+			/**
+			 * function: the end of what the tree uses of the file.
+			 */
+			inline offset_t file_end() const {
+				return info.shadow != 0 ? pages.limit() : info.eof;
+			}
+
+			inline void raw_sync() const {
+				if (space != nullptr) space -> sync();
+				else store.sync();
 			}
 
-			nameString fp_from_name;
-			FILE *fp_from;
+			inline void advise(offset_t offset, size_t size) const {
+				if (space != nullptr) space -> advise(seg, offset, size);
+				else if (info.shadow != 0) {
+					for (offset_t end = offset + size; offset < end; offset += sizeof(leafNode))
+						store.advise(pages.where(offset), sizeof(leafNode));
+				} else store.advise(offset, size);
+			}
+
+			inline void readFile(void *place, offset_t offset, size_t num, size_t size) const {
+				if (info.shadow != 0) {
+					if (offset == info_offset) {
+						memcpy(place, &info, size * num);
+						return;
+					}
+					offset = pages.where(offset);
+				}
+				raw_read(place, size * num, offset);
+			}
 
-			inline void copy_readFile(void *place, offset_t offset, size_t num, size_t size) const{
-				if (fseek(fp_from, offset, SEEK_SET)) throw "open file failed";
-				size_t ret = fread(place, num, size, fp_from);
+			inline void writeFile(void *place, offset_t offset, size_t num, size_t size) const {
+				if (versions.active() && offset != info_offset &&
+				    !(offset >= info.buffer && offset < info.buffer + static_cast <offset_t> (info.buffer_size * sizeof(message))))
+					versions.preserve(offset, size * num, [&](void *buf) { readFile(buf, offset, num, size); });
+				if (info.shadow != 0) {
+					if (offset != info_offset) shadow_write(place, offset, num, size);
+					return;
+				}
+				raw_write(place, size * num, offset);
 			}
 
 			offset_t leaf_offset_temp;
+			leafNode *copy_pre;        // the last leaf copied, written when the next one is known
 
 			inline void copy_leaf(offset_t offset, offset_t from_offset, offset_t par_offset) {
-				leafNode leaf, leaf_from, pre_leaf;
-				copy_readFile(&leaf_from, from_offset, 1, sizeof(leafNode));
-				leaf.offset = offset, leaf.par = par_offset;
-				leaf.cnt = leaf_from.cnt; leaf.pre = leaf_offset_temp; leaf.nxt = 0;
-				if(leaf_offset_temp != 0) {
-					readFile(&pre_leaf, leaf_offset_temp, 1, sizeof(leafNode));
-					pre_leaf.nxt = offset;
-					writeFile(&pre_leaf, leaf_offset_temp, 1, sizeof(leafNode));
+				leafNode *leaf = new leafNode, leaf_from;
+				copy_source -> readFile(&leaf_from, from_offset, 1, sizeof(leafNode));
+				leaf -> offset = offset, leaf -> par = par_offset;
+				leaf -> cnt = leaf_from.cnt; leaf -> pre = leaf_offset_temp; leaf -> nxt = 0;
+				leaf -> high = leaf_from.high; leaf -> bounded = leaf_from.bounded;
+				if (copy_pre != nullptr) {
+					copy_pre -> nxt = offset;
+					writeFile(copy_pre, leaf_offset_temp, 1, sizeof(leafNode));
+					delete copy_pre;
 					info.tail = offset;
-				} else info.head = offset;
-				for (int i=0; i<leaf.cnt; ++i) leaf.data[i].first = leaf_from.data[i].first, leaf.data[i].second = leaf_from.data[i].second;
-				writeFile(&leaf, offset, 1, sizeof(leafNode));
+				} else info.head = info.tail = offset;
+				for (int i=0; i<leaf -> cnt; ++i) leaf -> data[i].first = leaf_from.data[i].first, leaf -> data[i].second = leaf_from.data[i].second;
 				info.eof += sizeof(leafNode);
 				leaf_offset_temp = offset;
+				copy_pre = leaf;
 			}
 
 			inline void copy_node(offset_t offset, offset_t from_offset, offset_t par_offset) {
 				internalNode node, node_from;
-				copy_readFile(&node_from, from_offset, 1, sizeof(internalNode));
-				writeFile(&node, offset, 1, sizeof(internalNode));
+				copy_source -> readFile(&node_from, from_offset, 1, sizeof(internalNode));
 				info.eof += sizeof(internalNode);
 				node.offset = offset; node.par = par_offset;
 				node.cnt = node_from.cnt; node.type = node_from.type;
 				for (int i=0; i<node.cnt; ++i) {
 					node.key[i] = node_from.key[i];
+					node.num[i] = node_from.num[i];
+					node.agg[i] = node_from.agg[i];
+					node.ch[i] = info.eof;
 					if(node.type == 1) {  					// leaf
 						copy_leaf(info.eof, node_from.ch[i], offset);
 					} else {                        // node
@@ -192,28 +431,139 @@ namespace sjtu {
 				writeFile(&node, offset, 1, sizeof(internalNode));
 			}
 
-			inline void copyFile(char *to, char *from) {
-				fp_from_name.setName(from);
-				fp_from = fopen(fp_from_name.str, "rb+");
-				if (fp_from == nullptr) throw "no such file";
-				basicInfo infoo;
-				copy_readFile(&infoo, info_offset, 1, sizeof(basicInfo));
-				leaf_offset_temp = 0; info.size = infoo.size;
-				info.root = info.eof = sizeof(basicInfo);
+			/**
+			 * function: copy the bytes [0, eof) of the source file to the (empty) file of this tree.
+			 * a reflink shares the extents of the source (copy-on-write in the file system), copy_file_range
+			 * copies in the kernel; where neither works, or either tree has no plain file to read with
+			 * pread (a Database, O_DIRECT, memory only), it is a sequential copy in big chunks.
+			 */
+			void clone_file(offset_t eof) {
+				offset_t done = 0;
+				int from = copy_source -> space == nullptr ? copy_source -> store.fd() : -1;
+				int to = space == nullptr ? store.fd() : -1;
+				if (from >= 0 && to >= 0) {
+# ifdef FICLONE
+					if (ioctl(to, FICLONE, from) == 0) done = eof;
+# endif
+					loff_t in = done, out = done;
+					while (done < eof) {
+						ssize_t n = copy_file_range(from, &in, to, &out, eof - done, 0);
+						if (n <= 0) break;
+						done += n;
+					}
+				}
+				const size_t CHUNK = 1 << 20;
+				char *buf = done < eof ? new char[CHUNK] : nullptr;
+				while (done < eof) {
+					size_t len = static_cast <size_t> (eof - done) < CHUNK ? eof - done : CHUNK;
+					copy_source -> raw_read(buf, len, done);
+					raw_write(buf, len, done);
+					done += len;
+				}
+				delete [] buf;
+			}
+
+			/**
+			 * function: make this tree a copy of copy_source, which is synced and not changed meanwhile.
+			 * the file is cloned as it is; only a source under shadow paging, whose pages are not where
+			 * the tree thinks they are, is copied node by node.
+			 */
+			inline void copyFile() {
+				if (space != nullptr) space -> truncate(seg);
+				else store.truncate();
+				if (copy_source -> info.shadow == 0) {
+					clone_file(copy_source -> info.eof);
+					info = copy_source -> info;
+					info.buffer_cap = info.buffer_cnt = 0; info.memtable_cap = 0;
+					writeFile(&info, info_offset, 1, sizeof(basicInfo));
+					return;
+				}
+				basicInfo infoo = copy_source -> info;
+				leaf_offset_temp = 0; copy_pre = nullptr;
+				info.size = infoo.size; info.augmented = infoo.augmented;
+				info.buffer = 0; info.buffer_size = info.buffer_cap = info.buffer_cnt = 0; info.memtable_cap = 0;
+				info.shadow = 0;
+				info.root = info.eof = node_offset;
 				writeFile(&info, info_offset, 1, sizeof(basicInfo));
-				copy_node(info.root, infoo.root, 0);
+				try {
+					copy_node(info.root, infoo.root, 0);
+				} catch (...) {
+					delete copy_pre;
+					throw;
+				}
+				if (copy_pre != nullptr) writeFile(copy_pre, leaf_offset_temp, 1, sizeof(leafNode));
+				delete copy_pre;
 				writeFile(&info, info_offset, 1, sizeof(basicInfo));
-				fclose(fp_from);
+			}
+
+			/**
+			 * function: empty the file, the memtable, the buffer and the cache; the tree is not built.
+			 */
+			void reset_file() {
+				if (versions.active()) throw "a snapshot is open";
+				info.shadow = 0;
+				pages.reset(0);
+				deferred_cnt = 0;
+				compact_on = 0;
+				if (space != nullptr) space -> truncate(seg);
+				else store.truncate();
+				cache.clear();
+				log_clear();
+				pending_cnt = 0;
+				delete [] pending;
+				pending = nullptr;
+				info.buffer = 0;
+				info.buffer_size = info.buffer_cap = info.buffer_cnt = 0;
 			}
 
 			// ============================= end of file operation =================================== //
 
+			// ===================================== readahead ======================================== //
+			/**
+			 * Instructions:
+			 *    a scan reads the leaves one by one along nxt (or pre). it calls ahead() with every leaf
+			 *    it reads, which asks the kernel for the leaves it reads next, so the disk works while
+			 *    the scan looks at the pairs. after READAHEAD_RUN leaves in a row it counts as a scan:
+			 *    if the next leaf comes right after this one in the file (after compact() or bulk_load()
+			 *    they all do), readahead_leaves leaves from there are asked for at once, and again when
+			 *    the scan is half way through them. leaves scattered over the file are left to the kernel:
+			 *    asking for them one by one costs more system calls than it saves.
+			 */
+			struct readAhead {
+				offset_t lo, hi;      // the leaves in [lo, hi) were asked for
+				int run;              // leaves read in a row
+				readAhead() : lo(0), hi(0), run(0) {}
+			};
+
+			static const int READAHEAD_RUN = 2;
+
+			void ahead(readAhead &ra, const leafNode &leaf, bool forward) const {
+				offset_t next = forward ? leaf.nxt : leaf.pre;
+				if (readahead_leaves == 0 || next == 0 || ++ra.run < READAHEAD_RUN) return;
+				offset_t step = sizeof(leafNode), window = readahead_leaves * step;
+				if (next != (forward ? leaf.offset + step : leaf.offset - step)) return;
+				bool inside = next >= ra.lo && next < ra.hi;
+				if (forward) {
+					if (inside && next + window / 2 < ra.hi) return;
+					offset_t from = inside ? ra.hi : next;
+					ra.lo = next, ra.hi = next + window;
+					advise(from, ra.hi - from);
+				} else {
+					if (inside && next - window / 2 >= ra.lo) return;
+					offset_t to = inside ? ra.lo : next + step;
+					ra.hi = next + step, ra.lo = ra.hi > window ? ra.hi - window : 0;
+					if (to > ra.lo) advise(ra.lo, to - ra.lo);
+				}
+			}
+
+			// ================================= end of readahead ===================================== //
+
 			/**
 			 * function: build an tree with no elements.
 			 */
 			inline void build_tree() {
 				info.size = 0;
-				info.eof = sizeof(basicInfo);
+				info.eof = node_offset;
 				internalNode root;
 				leafNode leaf;
 				info.root = root.offset = info.eof;
@@ -230,26 +580,104 @@ namespace sjtu {
 				writeFile(&leaf, leaf.offset, 1, sizeof(leafNode));
 			}
 
+			/**
+			 * function: the number of keys of the node not bigger than key (binary search);
+			 * key belongs to the child before that. cnt is clamped, an optimistic reader may see any.
+			 */
+			static int upper_key(const internalNode &p, const KeyType &key) {
+				int lo = 0, hi = p.cnt < 0 ? 0 : (p.cnt > M + 1 ? M + 1 : p.cnt);
+				while (lo < hi) {
+					int mid = (lo + hi) / 2;
+					if (key < p.key[mid]) hi = mid;
+					else lo = mid + 1;
+				}
+				return lo;
+			}
+
+			/**
+			 * function: the place of the first pair of the leaf whose key is not smaller than key.
+			 */
+			static int lower_pair(const leafNode &leaf, const KeyType &key) {
+				int lo = 0, hi = leaf.cnt < 0 ? 0 : (leaf.cnt > L + 1 ? L + 1 : leaf.cnt);
+				while (lo < hi) {
+					int mid = (lo + hi) / 2;
+					if (leaf.data[mid].first < key) lo = mid + 1;
+					else hi = mid;
+				}
+				return lo;
+			}
+
+			/**
+			 * function: the internal node at offset where it is in memory (MmapStorage, MemoryStorage),
+			 * to be read without a copy; nullptr if it has to be read (a file, a Database, shadow paging).
+			 * a writer may change it meanwhile, so it is checked like a copy read without the latches.
+			 */
+			inline const internalNode *peek_node(offset_t offset) const {
+				if (space != nullptr || info.shadow != 0 || offset % alignof(internalNode) != 0) return nullptr;
+				return reinterpret_cast <const internalNode *> (store.peek(offset, sizeof(internalNode)));
+			}
+
+			/**
+			 * function: the leaf at offset where it is in memory, to be read in place like peek_node().
+			 */
+			inline const leafNode *peek_leaf(offset_t offset) const {
+				if (space != nullptr || info.shadow != 0 || offset % alignof(leafNode) != 0) return nullptr;
+				return reinterpret_cast <const leafNode *> (store.peek(offset, sizeof(leafNode)));
+			}
+
+			/**
+			 * function: the leaf at offset where it is in memory and may be changed there (MemoryStorage),
+			 * so a write copies no node; nullptr if it goes through writeFile() (a file, a mapping,
+			 * shadow paging, an open snapshot, which must see the node before). the caller holds the
+			 * leaf latch exclusively, so an optimistic reader in the middle sees the version move.
+			 */
+			inline leafNode *poke_leaf(offset_t offset) const {
+				if (space != nullptr || info.shadow != 0 || versions.active() || offset % alignof(leafNode) != 0) return nullptr;
+				return reinterpret_cast <leafNode *> (store.poke(offset, sizeof(leafNode)));
+			}
+
 			/**
 			 * function: given a key and find the leaf it should be in.
 			 * return the offset of the leaf.
+			 * a father may take a split leaf under the shared latch (post_shared()), so every node
+			 * is read again until its latch version is even and the same before and after.
 			 */
 			node_t locate_leaf(const KeyType &key, offset_t offset) const {
-				internalNode p;
-				readFile(&p, offset, 1, sizeof(internalNode));
-				if(p.type == 1) {
-					// child -> leaf
-					int pos = 0;
-					for (; pos < p.cnt; ++pos)
-						if (key < p.key[pos]) break;
-					if (pos == 0) return 0;
-					return p.ch[pos - 1];
-				} else {
-					int pos = 0;
-					for (; pos < p.cnt; ++pos)
-						if (key < p.key[pos]) break;
+				internalNode copy;
+				while (1) {
+					versionLatch &latch = node_latch[offset];
+					uint64_t v = latch.version.load();
+					if (v & 1) {
+						std::this_thread::yield();
+						continue;
+					}
+					const internalNode *p = peek_node(offset);
+					if (p == nullptr) {
+						readFile(&copy, offset, 1, sizeof(internalNode));
+						p = &copy;
+					}
+					int pos = upper_key(*p, key);
+					bool type = p -> type;
+					node_t ch = pos == 0 ? 0 : p -> ch[pos - 1];
+					if (latch.version.load() != v) continue;
 					if (pos == 0) return 0;
-					return locate_leaf(key, p.ch[pos - 1]);
+					if (type == 1) return ch;               // child -> leaf
+					offset = ch;
+				}
+			}
+
+			/**
+			 * function: read the internal node at offset under the shared latch, the same way.
+			 */
+			void read_node(internalNode *node, offset_t offset) const {
+				versionLatch &latch = node_latch[offset];
+				while (1) {
+					uint64_t v = latch.version.load();
+					if (!(v & 1)) {
+						readFile(node, offset, 1, sizeof(internalNode));
+						if (latch.version.load() == v) return;
+					}
+					std::this_thread::yield();
 				}
 			}
 
@@ -258,21 +686,20 @@ namespace sjtu {
 			 * return Fail and operate nothing if there are elements with same key.
 			 * return Success if inserted.
 			 * if leaf count is bigger than L then call split_leaf().
+			 * in_place: leaf is the node itself (poke_leaf()) and does not split, nothing is written.
 			 */
-			pair <iterator, OperationResult> insert_leaf(leafNode &leaf, const KeyType &key, const ValueType &value) {
+			pair <iterator, OperationResult> insert_leaf(leafNode &leaf, const KeyType &key, const ValueType &value, bool in_place = 0) {
 				iterator ret;
-				int pos = 0;
-				for (; pos < leaf.cnt; ++pos) {
-					if (key == leaf.data[pos].first) return pair <iterator, OperationResult> (iterator(nullptr), Fail);			// there are elements with the same key
-					if (key < leaf.data[pos].first) break;
-				}
+				int pos = lower_pair(leaf, key);
+				if (pos < leaf.cnt && key == leaf.data[pos].first) return pair <iterator, OperationResult> (iterator(nullptr), Fail);			// there are elements with the same key
 				for (int i = leaf.cnt - 1; i >= pos; --i)
 					leaf.data[i+1].first = leaf.data[i].first, leaf.data[i+1].second = leaf.data[i].second;
 				leaf.data[pos].first = key; leaf.data[pos].second = value;
 				++leaf.cnt;
-				++info.size;
 				ret.from = this; ret.place = pos; ret.offset = leaf.offset;
-				writeFile(&info, info_offset, 1, sizeof(basicInfo));
+				update_size(1);
+				if (info.augmented) update_path(leaf.par, leaf.offset, 1, fold(leaf));
+				if (in_place) return pair <iterator, OperationResult> (ret, Success);
 				if(leaf.cnt <= L) writeFile(&leaf, leaf.offset, 1, sizeof(leafNode));
 				else split_leaf(leaf, ret, key);
 				return pair <iterator, OperationResult> (ret, Success);
@@ -282,9 +709,12 @@ namespace sjtu {
 			 * function: insert an key elements (only key) to the given internal node.
 			 *           insert an child to the given internal node.
 			 * notice: elements in child is bigger than key.
+			 *         the child is split from its left brother, so its num pairs are moved from there,
+			 *         agg and left_agg are the new aggregates of the child and the left brother.
 			 * if node count is bigger than M then call split_node().
 			 */
-			void insert_node(internalNode &node, const KeyType &key, node_t ch) {
+			void insert_node(internalNode &node, const KeyType &key, node_t ch, size_t num,
+			                 const aggregate_type &agg, const aggregate_type &left_agg) {
 				int pos = 0;
 				for (; pos < node.cnt; ++pos)
 					if (key < node.key[pos]) break;
@@ -292,8 +722,15 @@ namespace sjtu {
 					node.key[i+1] = node.key[i];
 				for (int i = node.cnt - 1; i >= pos; --i)
 					node.ch[i+1] = node.ch[i];
+				for (int i = node.cnt - 1; i >= pos; --i)
+					node.num[i+1] = node.num[i];
+				for (int i = node.cnt - 1; i >= pos; --i)
+					node.agg[i+1] = node.agg[i];
 				node.key[pos] = key;
 				node.ch[pos] = ch;
+				node.num[pos] = num;
+				node.agg[pos] = agg;
+				if (pos > 0) node.num[pos - 1] -= num, node.agg[pos - 1] = left_agg;
 				++node.cnt;
 				if(node.cnt <= M) writeFile(&node, node.offset, 1, sizeof(internalNode));
 				else split_node(node);
@@ -320,7 +757,11 @@ namespace sjtu {
 				// link operation begin
 				newleaf.nxt = leaf.nxt;
 				newleaf.pre = leaf.offset;
+				newleaf.high = leaf.high;
+				newleaf.bounded = leaf.bounded;
 				leaf.nxt = newleaf.offset;
+				leaf.high = newleaf.data[0].first;
+				leaf.bounded = 1;
 				leafNode nxtleaf;
 				if(newleaf.nxt == 0) info.tail = newleaf.offset;
 				else {
@@ -337,7 +778,7 @@ namespace sjtu {
 				// update father
 				internalNode par;
 				readFile(&par, leaf.par, 1, sizeof(internalNode));
-				insert_node(par, newleaf.data[0].first, newleaf.offset);
+				insert_node(par, newleaf.data[0].first, newleaf.offset, newleaf.cnt, fold(newleaf), fold(leaf));
 			}
 
 			/**
@@ -356,6 +797,10 @@ namespace sjtu {
 					newnode.key[i] = node.key[i + node.cnt];
 				for (int i = 0; i < newnode.cnt; ++i)
 					newnode.ch[i] = node.ch[i + node.cnt];
+				for (int i = 0; i < newnode.cnt; ++i)
+					newnode.num[i] = node.num[i + node.cnt];
+				for (int i = 0; i < newnode.cnt; ++i)
+					newnode.agg[i] = node.agg[i + node.cnt];
 
 				// updating children's parents
 				leafNode leaf;
@@ -384,6 +829,10 @@ namespace sjtu {
 					newroot.ch[0] = node.offset;
 					newroot.key[1] = newnode.key[0];
 					newroot.ch[1] = newnode.offset;
+					newroot.num[0] = total(node);
+					newroot.num[1] = total(newnode);
+					newroot.agg[0] = fold(node);
+					newroot.agg[1] = fold(newnode);
 					node.par = newroot.offset;
 					newnode.par = newroot.offset;
 					info.root = newroot.offset;
@@ -399,7 +848,7 @@ namespace sjtu {
 
 					internalNode par;
 					readFile(&par, node.par, 1, sizeof(internalNode));
-					insert_node(par, newnode.key[0], newnode.offset);
+					insert_node(par, newnode.key[0], newnode.offset, total(newnode), fold(newnode), fold(node));
 				}
 			}
 
@@ -423,12 +872,17 @@ namespace sjtu {
 				leaf.cnt++;
 				right.cnt--;
 				for (int i = 0; i < right.cnt; ++i) right.data[i].first = right.data[i + 1].first, right.data[i].second = right.data[i + 1].second;
+				leaf.high = newkey;
 
 				internalNode node;
 				readFile(&node, leaf.par, 1, sizeof(internalNode));
 				for (int i = 0; i < node.cnt; ++i) {
 					if (node.key[i] == oldkey) {
 						node.key[i] = newkey;
+						++node.num[i - 1];
+						--node.num[i];
+						node.agg[i - 1] = fold(leaf);
+						node.agg[i] = fold(right);
 						break;
 					}
 				}
@@ -460,12 +914,17 @@ namespace sjtu {
 				leaf.data[0].second = left.data[left.cnt - 1].second;
 				++leaf.cnt;
 				--left.cnt;
+				left.high = newkey;
 
 				internalNode node;
 				readFile(&node, leaf.par, 1, sizeof(internalNode));
 				for (int i = 0; i < node.cnt; ++i) {
 					if (node.key[i] == oldkey) {
 						node.key[i] = newkey;
+						++node.num[i];
+						--node.num[i - 1];
+						node.agg[i] = fold(leaf);
+						node.agg[i - 1] = fold(left);
 						break;
 					}
 				}
@@ -487,6 +946,8 @@ namespace sjtu {
 				if(right.par != leaf.par) return Fail;
 				for (int i = 0; i < right.cnt; ++i) leaf.data[leaf.cnt].first = right.data[i].first, leaf.data[leaf.cnt].second = right.data[i].second, ++leaf.cnt;
 				leaf.nxt = right.nxt;
+				leaf.high = right.high;
+				leaf.bounded = right.bounded;
 				if(right.offset == info.tail) {
 					info.tail = leaf.offset;
 					writeFile(&info, info_offset, 1, sizeof(basicInfo));
@@ -504,8 +965,10 @@ namespace sjtu {
 				int pos = 0;
 				for (; pos < node.cnt; ++pos)
 					if(node.key[pos] == right.data[0].first) break;
+				node.num[pos - 1] += node.num[pos];
+				node.agg[pos - 1] = fold(leaf);
 				for (int i = pos; i < node.cnt - 1; ++ i)
-					node.key[i] = node.key[i + 1], node.ch[i] = node.ch[i + 1];
+					node.key[i] = node.key[i + 1], node.ch[i] = node.ch[i + 1], node.num[i] = node.num[i + 1], node.agg[i] = node.agg[i + 1];
 				node.cnt --;
 
 				writeFile(&leaf, leaf.offset, 1, sizeof(leafNode));
@@ -526,6 +989,8 @@ namespace sjtu {
 				if (left.par != leaf.par) return Fail;
 				for (int i = 0; i < leaf.cnt; ++i) left.data[left.cnt].first = leaf.data[i].first, left.data[left.cnt].second = leaf.data[i].second, ++left.cnt;
 				left.nxt = leaf.nxt;
+				left.high = leaf.high;
+				left.bounded = leaf.bounded;
 				if(info.tail == leaf.offset) {
 					info.tail = left.offset;
 					writeFile(&info, info_offset, 1, sizeof(basicInfo));
@@ -541,8 +1006,10 @@ namespace sjtu {
 				int pos = 0;
 				for (; pos < node.cnt; ++pos)
 					if (node.key[pos] == leaf.data[0].first) break;
+				node.num[pos - 1] += node.num[pos];
+				node.agg[pos - 1] = fold(left);
 				for (int i = pos; i < node.cnt - 1; ++i)
-					node.key[i] = node.key[i + 1], node.ch[i] = node.ch[i + 1];
+					node.key[i] = node.key[i + 1], node.ch[i] = node.ch[i + 1], node.num[i] = node.num[i + 1], node.agg[i] = node.agg[i + 1];
 				node.cnt--;
 
 				writeFile(&left, left.offset, 1, sizeof(leafNode));
@@ -621,10 +1088,18 @@ namespace sjtu {
 
 				node.key[node.cnt] = right.key[0];
 				node.ch[node.cnt] = right.ch[0];
+				node.num[node.cnt] = right.num[0];
+				node.agg[node.cnt] = right.agg[0];
+				par.num[pos] += right.num[0];
+				par.num[pos + 1] -= right.num[0];
 				++ node.cnt;
 				for (int i = 0; i < right.cnt - 1; ++i) right.key[i] = right.key[i + 1];
 				for (int i = 0; i < right.cnt - 1; ++i) right.ch[i] = right.ch[i + 1];
+				for (int i = 0; i < right.cnt - 1; ++i) right.num[i] = right.num[i + 1];
+				for (int i = 0; i < right.cnt - 1; ++i) right.agg[i] = right.agg[i + 1];
 				-- right.cnt;
+				par.agg[pos] = fold(node);
+				par.agg[pos + 1] = fold(right);
 
 				par.key[pos + 1] = right.key[0];
 
@@ -666,10 +1141,18 @@ namespace sjtu {
 
 				for (int i = node.cnt - 1; i >= 0; -- i) node.key[i + 1] = node.key[i];
 				for (int i = node.cnt - 1; i >= 0; -- i) node.ch[i + 1] = node.ch[i];
+				for (int i = node.cnt - 1; i >= 0; -- i) node.num[i + 1] = node.num[i];
+				for (int i = node.cnt - 1; i >= 0; -- i) node.agg[i + 1] = node.agg[i];
 				node.key[0] = left.key[left.cnt - 1];
 				node.ch[0] = left.ch[left.cnt - 1];
+				node.num[0] = left.num[left.cnt - 1];
+				node.agg[0] = left.agg[left.cnt - 1];
+				par.num[pos] += left.num[left.cnt - 1];
+				par.num[pos - 1] -= left.num[left.cnt - 1];
 				++ node.cnt;
 				-- left.cnt;
+				par.agg[pos] = fold(node);
+				par.agg[pos - 1] = fold(left);
 
 				par.key[pos] = node.key[0];
 
@@ -710,6 +1193,8 @@ namespace sjtu {
 				for (int i = 0; i < right.cnt; ++ i) {
 					node.key[node.cnt] = right.key[i];
 					node.ch[node.cnt] = right.ch[i];
+					node.num[node.cnt] = right.num[i];
+					node.agg[node.cnt] = right.agg[i];
 					if (node.type == 1) {
 						leafNode son;
 						readFile(&son, node.ch[node.cnt], 1, sizeof(leafNode));
@@ -724,8 +1209,10 @@ namespace sjtu {
 					++ node.cnt;
 				}
 
+				par.num[pos] += par.num[pos + 1];
+				par.agg[pos] = fold(node);
 				for (int i = pos + 1; i < par.cnt - 1; ++i)
-					par.key[i] = par.key[i+1], par.ch[i] = par.ch[i+1];
+					par.key[i] = par.key[i+1], par.ch[i] = par.ch[i+1], par.num[i] = par.num[i+1], par.agg[i] = par.agg[i+1];
 				-- par.cnt;
 				writeFile(&node, node.offset, 1, sizeof(internalNode));
 				if(check_node(par) == Success) writeFile(&par, par.offset, 1, sizeof(internalNode));
@@ -751,6 +1238,8 @@ namespace sjtu {
 				for (int i = 0; i < node.cnt; ++ i) {
 					left.key[left.cnt] = node.key[i];
 					left.ch[left.cnt] = node.ch[i];
+					left.num[left.cnt] = node.num[i];
+					left.agg[left.cnt] = node.agg[i];
 					if (left.type == 1) {
 						leafNode son;
 						readFile(&son, left.ch[left.cnt], 1, sizeof(leafNode));
@@ -765,8 +1254,10 @@ namespace sjtu {
 					++ left.cnt;
 				}
 
+				par.num[pos - 1] += par.num[pos];
+				par.agg[pos - 1] = fold(left);
 				for (int i = pos; i < par.cnt - 1; ++i)
-					par.key[i] = par.key[i+1], par.ch[i] = par.ch[i+1];
+					par.key[i] = par.key[i+1], par.ch[i] = par.ch[i+1], par.num[i] = par.num[i+1], par.agg[i] = par.agg[i+1];
 				-- par.cnt;
 				writeFile(&left, left.offset, 1, sizeof(internalNode));
 				if(check_node(par) == Success) writeFile(&par, par.offset, 1, sizeof(internalNode));
@@ -774,133 +1265,2150 @@ namespace sjtu {
 				return Success;
 			}
 
+			// ========================== order statistic and aggregate ============================== //
+			/**
+			 * Instructions:
+			 *    num[i] of an internal node is the number of pairs in the subtree of ch[i],
+			 *    agg[i] is the Aggregate of the values in it.
+			 *    split, borrow and merge move num and agg together with ch, which costs no extra I/O.
+			 *    insert, erase and iterator::modify change every subtree on the path, so they only
+			 *    update_path() the ancestors when info.augmented is set (see augment()).
+			 */
 
-		public:
-			class iterator {
-					friend class BTree;
-				private:
-					offset_t offset;        // offset of the leaf node
-					int place;							// place of the element in the leaf node
-					BTree *from;
-				public:
-					iterator() {
-						from = nullptr;
-						place = 0, offset = 0;
-					}
-					iterator(BTree *_from, offset_t _offset = 0, int _place = 0) {
-						from = _from;
-						offset = _offset; place = _place;
-					}
-					iterator(const iterator& other) {
-						from = other.from;
-						offset = other.offset;
-						place = other.place;
-					}
-					iterator(const const_iterator& other) {
-						from = other.from;
-						offset = other.offset;
-						place = other.place;
-					}
-
-					// to get the value type pointed by iterator.
-					ValueType getValue() {
-						leafNode p;
-						from -> readFile(&p, offset, 1, sizeof(leafNode));
-						return p.data[place].second;
-					}
+			/**
+			 * function: return the number of pairs in the subtree of the given internal node.
+			 */
+			inline size_t total(const internalNode &node) const {
+				size_t ret = 0;
+				for (int i = 0; i < node.cnt; ++i) ret += node.num[i];
+				return ret;
+			}
 
-					OperationResult modify(const ValueType& value) {
-						leafNode p;
-						from -> readFile(&p, offset, 1, sizeof(leafNode));
-						p.data[place].second = value;
-						from -> writeFile(&p, offset, 1, sizeof(leafNode));
-						return Success;
-					}
+			/**
+			 * function: return the aggregate of the given leaf / the subtree of the given internal node.
+			 */
+			inline aggregate_type fold(const leafNode &leaf) const {
+				aggregate_type ret = combine.identity();
+				for (int i = 0; i < leaf.cnt; ++i) ret = combine(ret, aggregate_type(leaf.data[i].second));
+				return ret;
+			}
+			inline aggregate_type fold(const internalNode &node) const {
+				aggregate_type ret = combine.identity();
+				for (int i = 0; i < node.cnt; ++i) ret = combine(ret, node.agg[i]);
+				return ret;
+			}
 
-					// Return a new iterator which points to the n-next elements
-					iterator operator++(int) {
-						iterator ret = *this;
-						// end of bptree
-						if(*this == from -> end()) {
-							from = nullptr; place = 0; offset = 0;
-							return ret;
-						}
-						leafNode p;
-						from -> readFile(&p, offset, 1, sizeof(leafNode));
-						if(place == p.cnt - 1) {
-							if(p.nxt == 0) ++ place;
-							else {
-								offset = p.nxt;
-								place = 0;
-							}
-						} else ++ place;
-						return ret;
-					}
-					iterator& operator++() {
-						if(*this == from -> end()) {
-							from = nullptr; place = 0; offset = 0;
-							return *this;
-						}
-						leafNode p;
-						from -> readFile(&p, offset, 1, sizeof(leafNode));
-						if(place == p.cnt - 1) {
-							if(p.nxt == 0) ++ place;
-							else {
-								offset = p.nxt;
-								place = 0;
-							}
-						} else ++ place;
-						return *this;
-					}
-					iterator operator--(int) {
-						iterator ret = *this;
-						if(*this == from -> begin()) {
-							from = nullptr; place = 0; offset = 0;
-							return ret;
-						}
-						leafNode p, q;
-						from -> readFile(&p, offset, 1, sizeof(leafNode));
-						if(place == 0) {
-							offset = p.pre;
-							from -> readFile(&q, p.pre, 1, sizeof(leafNode));
-							place = q.cnt - 1;
-						} else -- place;
-						return ret;
-					}
-					iterator& operator--() {
-						if(*this == from -> begin()) {
-							from = nullptr; place = 0; offset = 0;
-							return *this;
+			/**
+			 * function: update child in all the ancestors, par is the father of child.
+			 * the subtree size of child changes by delta and its new aggregate is agg.
+			 */
+			void update_path(node_t par, node_t child, int delta, aggregate_type agg) {
+				internalNode node;
+				while (par != 0) {
+					readFile(&node, par, 1, sizeof(internalNode));
+					for (int i = 0; i < node.cnt; ++i)
+						if (node.ch[i] == child) {
+							node.num[i] += delta;
+							node.agg[i] = agg;
+							break;
 						}
-						leafNode p, q;
-						from -> readFile(&p, offset, 1, sizeof(leafNode));
-						if(place == 0) {
-							offset = p.pre;
-							from -> readFile(&q, p.pre, 1, sizeof(leafNode));
-							place = q.cnt - 1;
-						} else -- place;
-						return *this;
-					}
-					bool operator==(const iterator& rhs) const {
-						return offset == rhs.offset && place == rhs.place && from == rhs.from;
-					}
-					bool operator==(const const_iterator& rhs) const {
-						return offset == rhs.offset && place == rhs.place && from == rhs.from;
-					}
-					bool operator!=(const iterator& rhs) const {
-						return offset != rhs.offset || place != rhs.place || from != rhs.from;
-					}
-					bool operator!=(const const_iterator& rhs) const {
-						return offset != rhs.offset || place != rhs.place || from != rhs.from;
+					writeFile(&node, node.offset, 1, sizeof(internalNode));
+					agg = fold(node);
+					child = node.offset;
+					par = node.par;
+				}
+			}
+
+			/**
+			 * function: recount all the subtree sizes and aggregates under the given internal node.
+			 * return the number of pairs in it.
+			 */
+			size_t recount(offset_t offset) {
+				internalNode node, son;
+				leafNode leaf;
+				readFile(&node, offset, 1, sizeof(internalNode));
+				for (int i = 0; i < node.cnt; ++i) {
+					if (node.type == 1) {
+						readFile(&leaf, node.ch[i], 1, sizeof(leafNode));
+						node.num[i] = leaf.cnt;
+						node.agg[i] = fold(leaf);
+					} else {
+						node.num[i] = recount(node.ch[i]);
+						readFile(&son, node.ch[i], 1, sizeof(internalNode));
+						node.agg[i] = fold(son);
 					}
-			};
+				}
+				writeFile(&node, offset, 1, sizeof(internalNode));
+				return total(node);
+			}
 
-			class const_iterator {
-					friend class BTree;
-				private:
-					offset_t offset;        // offset of the leaf node
-					int place;							// place of the element in the leaf node
+			/**
+			 * function: return the number of keys smaller than key in the subtree of the given internal node.
+			 */
+			size_t rank_node(const KeyType &key, offset_t offset) const {
+				internalNode p;
+				size_t ret = 0;
+				while (1) {
+					readFile(&p, offset, 1, sizeof(internalNode));
+					int pos = 0;
+					for (; pos < p.cnt; ++pos)
+						if (key < p.key[pos]) break;
+					if (pos == 0) return ret;
+					for (int i = 0; i < pos - 1; ++i) ret += p.num[i];
+					if (p.type == 1) return ret + rank_leaf(key, p.ch[pos - 1]);
+					offset = p.ch[pos - 1];
+				}
+			}
+
+			/**
+			 * function: return the number of keys smaller than key in the given leaf.
+			 */
+			size_t rank_leaf(const KeyType &key, offset_t offset) const {
+				leafNode leaf;
+				readFile(&leaf, offset, 1, sizeof(leafNode));
+				int pos = 0;
+				for (; pos < leaf.cnt; ++pos)
+					if (!(leaf.data[pos].first < key)) break;
+				return pos;
+			}
+
+			/**
+			 * function: return the aggregate of the keys smaller than key (prefix) or not smaller
+			 *           than key (suffix), in the subtree of the given internal node or the given leaf.
+			 */
+			aggregate_type prefix_node(const KeyType &key, offset_t offset) const {
+				internalNode p;
+				aggregate_type ret = combine.identity();
+				while (1) {
+					readFile(&p, offset, 1, sizeof(internalNode));
+					int pos = 0;
+					for (; pos < p.cnt; ++pos)
+						if (key < p.key[pos]) break;
+					if (pos == 0) return ret;
+					for (int i = 0; i < pos - 1; ++i) ret = combine(ret, p.agg[i]);
+					if (p.type == 1) return combine(ret, prefix_leaf(key, p.ch[pos - 1]));
+					offset = p.ch[pos - 1];
+				}
+			}
+			aggregate_type suffix_node(const KeyType &key, offset_t offset) const {
+				internalNode p;
+				aggregate_type ret = combine.identity();
+				while (1) {
+					readFile(&p, offset, 1, sizeof(internalNode));
+					int pos = 0;
+					for (; pos < p.cnt; ++pos)
+						if (key < p.key[pos]) break;
+					aggregate_type right = combine.identity();
+					for (int i = pos; i < p.cnt; ++i) right = combine(right, p.agg[i]);
+					ret = combine(right, ret);
+					if (pos == 0) return ret;
+					if (p.type == 1) return combine(suffix_leaf(key, p.ch[pos - 1]), ret);
+					offset = p.ch[pos - 1];
+				}
+			}
+			aggregate_type prefix_leaf(const KeyType &key, offset_t offset) const {
+				leafNode leaf;
+				readFile(&leaf, offset, 1, sizeof(leafNode));
+				aggregate_type ret = combine.identity();
+				for (int i = 0; i < leaf.cnt && leaf.data[i].first < key; ++i)
+					ret = combine(ret, aggregate_type(leaf.data[i].second));
+				return ret;
+			}
+			aggregate_type suffix_leaf(const KeyType &key, offset_t offset) const {
+				leafNode leaf;
+				readFile(&leaf, offset, 1, sizeof(leafNode));
+				aggregate_type ret = combine.identity();
+				for (int i = 0; i < leaf.cnt; ++i)
+					if (!(leaf.data[i].first < key)) ret = combine(ret, aggregate_type(leaf.data[i].second));
+				return ret;
+			}
+
+			// ======================= end of order statistic and aggregate =========================== //
+
+			// ==================================== write buffer ====================================== //
+			/**
+			 * Instructions:
+			 *    pending[0 .. pending_cnt) holds the newest message of each key, sorted by key; the
+			 *    messages are kept only there until a flush, which writes them to the file at info.buffer
+			 *    (info.buffer_cnt of them) before it applies them, so an open replays a flush cut short.
+			 *    push_message(key, value, erased): add a message, flush() if the buffer is full.
+			 *    pending_bound(key): return the first place in pending whose key is not smaller than key.
+			 *    pending_find(key): return the place of key in pending, -1 if there is none.
+			 *    apply_batch(msg, n): apply n messages sorted by key to the tree.
+			 */
+			void load_buffer() {
+				pending = nullptr;
+				pending_cnt = 0;
+				if (info.buffer_cap == 0) return;
+				pending = new message[info.buffer_cap];
+				message m;
+				for (int i = 0; i < info.buffer_cnt; ++i) {
+					readFile(&m, info.buffer + i * sizeof(message), 1, sizeof(message));
+					put_pending(m);
+				}
+			}
+
+			int pending_bound(const KeyType &key) const {
+				int l = 0, r = pending_cnt;
+				while (l < r) {
+					int mid = (l + r) >> 1;
+					if (pending[mid].key < key) l = mid + 1;
+					else r = mid;
+				}
+				return l;
+			}
+
+			int pending_find(const KeyType &key) const {
+				int pos = pending_bound(key);
+				if (pos < pending_cnt && pending[pos].key == key) return pos;
+				return -1;
+			}
+
+			/**
+			 * function: reserve room for capacity messages at the end of the file (after reset_file()).
+			 */
+			void reserve_buffer(int capacity) {
+				if (capacity == 0) return;
+				info.buffer = info.eof;
+				info.buffer_size = info.buffer_cap = capacity;
+				info.eof += page_up(capacity * sizeof(message));
+				writeFile(&info, info_offset, 1, sizeof(basicInfo));
+				pending = new message[capacity];
+			}
+
+			void put_pending(const message &m) {
+				int pos = pending_bound(m.key);
+				if (pos < pending_cnt && pending[pos].key == m.key) {
+					pending[pos] = m;
+					return;
+				}
+				for (int i = pending_cnt - 1; i >= pos; --i) pending[i + 1] = pending[i];
+				pending[pos] = m;
+				++pending_cnt;
+			}
+
+			void push_message(const KeyType &key, const ValueType &value, bool erased) {
+				message m;
+				m.key = key; m.value = value; m.erased = erased;
+				put_pending(m);
+				if (pending_cnt == info.buffer_cap) flush_buffer();
+			}
+
+
+			/**
+			 * function: find key in the tree (not in the buffer).
+			 * return true and put its place in *offset, *place if found.
+			 */
+			bool find_direct(const KeyType &key, offset_t *offset, int *place, leafNode *leaf) const {
+				offset_t leaf_offset = locate_leaf(key, info.root);
+				if (leaf_offset == 0) return false;
+				readFile(leaf, leaf_offset, 1, sizeof(leafNode));
+				for (int i = 0; i < leaf -> cnt; ++i)
+					if (leaf -> data[i].first == key) {
+						*offset = leaf_offset, *place = i;
+						return true;
+					}
+				return false;
+			}
+
+			/**
+			 * function: check if key is in the tree, taking the memtable and pending messages into account.
+			 */
+			bool exists(const KeyType &key) const {
+				const message *m = newest(key);
+				if (m != nullptr) return !m -> erased;
+				leafNode leaf;
+				offset_t offset;
+				int place;
+				return find_direct(key, &offset, &place, &leaf);
+			}
+
+			void upsert_direct(const KeyType &key, const ValueType &value) {
+				leafNode leaf;
+				offset_t offset;
+				int place;
+				if (find_direct(key, &offset, &place, &leaf)) modify_leaf(offset, place, value);
+				else insert_direct(key, value);
+			}
+
+			/**
+			 * function: given a key and find the leaf it should be in, like locate_leaf().
+			 * *bound is set to the smallest separator bigger than key, *bounded is false if there is none.
+			 */
+			node_t locate_bound(const KeyType &key, KeyType *bound, bool *bounded) const {
+				internalNode p;
+				offset_t offset = info.root;
+				*bounded = 0;
+				while (1) {
+					readFile(&p, offset, 1, sizeof(internalNode));
+					int pos = 0;
+					for (; pos < p.cnt; ++pos)
+						if (key < p.key[pos]) break;
+					if (pos == 0) return 0;
+					if (pos < p.cnt) *bound = p.key[pos], *bounded = 1;
+					if (p.type == 1) return p.ch[pos - 1];
+					offset = p.ch[pos - 1];
+				}
+			}
+
+			/**
+			 * function: merge n messages sorted by key into the given leaf with one read and one write.
+			 * return Fail and change nothing if the leaf would need a split or a merge,
+			 * or if its smallest key would change (the ancestors would need an update).
+			 */
+			OperationResult merge_leaf(offset_t offset, const message *msg, int n) {
+				leafNode leaf, ret;
+				readFile(&leaf, offset, 1, sizeof(leafNode));
+				if (leaf.cnt == 0) return Fail;
+				int i = 0, j = 0;
+				ret.cnt = 0;
+				while (i < leaf.cnt || j < n) {
+					if (ret.cnt > L) return Fail;
+					if (j == n || (i < leaf.cnt && leaf.data[i].first < msg[j].key)) {
+						ret.data[ret.cnt].first = leaf.data[i].first;
+						ret.data[ret.cnt++].second = leaf.data[i++].second;
+						continue;
+					}
+					if (i < leaf.cnt && leaf.data[i].first == msg[j].key) ++i;
+					if (!msg[j].erased) {
+						ret.data[ret.cnt].first = msg[j].key;
+						ret.data[ret.cnt++].second = msg[j].value;
+					}
+					++j;
+				}
+				if (ret.cnt > L || ret.cnt == 0) return Fail;
+				if (ret.cnt < LMIN && (leaf.pre != 0 || leaf.nxt != 0)) return Fail;
+				if (!(ret.data[0].first == leaf.data[0].first)) return Fail;
+				int delta = ret.cnt - leaf.cnt;
+				for (int k = 0; k < ret.cnt; ++k)
+					leaf.data[k].first = ret.data[k].first, leaf.data[k].second = ret.data[k].second;
+				leaf.cnt = ret.cnt;
+				writeFile(&leaf, leaf.offset, 1, sizeof(leafNode));
+				update_size(delta);
+				if (info.augmented) update_path(leaf.par, leaf.offset, delta, fold(leaf));
+				return Success;
+			}
+
+			void apply_batch(const message *msg, int n) {
+				int i = 0;
+				while (i < n) {
+					KeyType bound;
+					bool bounded;
+					offset_t leaf_offset = locate_bound(msg[i].key, &bound, &bounded);
+					int j = i + 1;
+					if (leaf_offset != 0)
+						while (j < n && (!bounded || msg[j].key < bound)) ++j;
+					if (leaf_offset == 0 || merge_leaf(leaf_offset, msg + i, j - i) == Fail) {
+						for (int k = i; k < j; ++k) {
+							if (msg[k].erased) erase_direct(msg[k].key);
+							else upsert_direct(msg[k].key, msg[k].value);
+						}
+					}
+					i = j;
+				}
+			}
+
+			/**
+			 * function: insert / erase in the tree itself, ignoring the buffer.
+			 */
+			pair <iterator, OperationResult> insert_direct(const KeyType& key, const ValueType& value) {
+				offset_t leaf_offset = locate_leaf(key, info.root);
+				leafNode leaf;
+				if(info.size == 0 || leaf_offset == 0) {					// smallest elements
+					readFile(&leaf, info.head, 1, sizeof(leafNode));
+					pair <iterator, OperationResult> ret = insert_leaf(leaf, key, value);
+					if(ret.second == Fail) return ret;
+					offset_t offset = leaf.par;
+					internalNode node;
+					while(offset != 0) {
+						readFile(&node, offset, 1, sizeof(internalNode));
+						node.key[0] = key;
+						writeFile(&node, offset, 1, sizeof(internalNode));
+						offset = node.par;
+					}
+					return ret;
+				}
+				readFile(&leaf, leaf_offset, 1, sizeof(leafNode));
+				pair <iterator, OperationResult> ret = insert_leaf(leaf, key, value);
+				return ret;
+			}
+
+			OperationResult erase_direct(const KeyType& key) {
+				offset_t leaf_offset = locate_leaf(key, info.root);
+				if(leaf_offset == 0) return Fail;
+				leafNode leaf;
+				readFile(&leaf, leaf_offset, 1, sizeof(leafNode));
+				int pos = 0;
+				for (; pos < leaf.cnt; ++pos)
+					if (leaf.data[pos].first == key) break;
+				if (pos == leaf.cnt) return Fail;          // not found.
+				cache.erase(key);
+				// erase in leaf...
+				for (int i = pos + 1; i < leaf.cnt; ++i)
+					leaf.data[i - 1].first = leaf.data[i].first, leaf.data[i - 1].second = leaf.data[i].second;
+				leaf.cnt --;
+				if (info.augmented) update_path(leaf.par, leaf.offset, -1, fold(leaf));
+				// if is the head of the leaf, then update ancestors, and the high key of the previous leaf.
+				if (pos == 0 && leaf.pre != 0 && leaf.cnt > 0) {
+					leafNode pre;
+					readFile(&pre, leaf.pre, 1, sizeof(leafNode));
+					pre.high = leaf.data[0].first;
+					writeFile(&pre, pre.offset, 1, sizeof(leafNode));
+				}
+				offset_t internal_offset = leaf.par;
+				internalNode node;
+				while(pos == 0) {
+					if(internal_offset == 0) break;
+					readFile(&node, internal_offset, 1, sizeof(internalNode));
+					pos = 0;
+					for (; pos < node.cnt; ++pos)
+						if (node.key[pos] == key) break;
+					node.key[pos] = leaf.data[0].first;
+					writeFile(&node, node.offset, 1, sizeof(internalNode));
+					internal_offset = node.par;
+				}
+				update_size(-1);
+				if(leaf.cnt < LMIN) {
+					operate_leaf(leaf);
+					return Success;
+				}
+				writeFile(&leaf, leaf_offset, 1, sizeof(leafNode));
+				return Success;
+			}
+
+			// ================================ end of write buffer =================================== //
+
+			// ===================================== bulk load ======================================== //
+			/**
+			 * Instructions:
+			 *    n pairs go to leaves = ceil(n / L) leaves, leaf j holding pairs [j * n / leaves, (j + 1) * n / leaves).
+			 *    level h above has cnt[h] = ceil(cnt[h - 1] / M) internal nodes, split the same way,
+			 *    up to the root; so every node is at least half full and its place is known in advance:
+			 *    level h is a run of cnt[h] nodes from base[h], the leaves first and the root last.
+			 *    group(i, c, k): the first of c items in group i of k, part(j, c, k): the group of item j.
+			 */
+			static inline size_t group(size_t i, size_t c, size_t k) { return i * c / k; }
+			static inline size_t part(size_t j, size_t c, size_t k) { return ((j + 1) * k - 1) / c; }
+
+			static const int LOAD_BATCH = 64;     // nodes formatted in memory before one write
+
+			static const int MAXH = 64;           // levels a plan may have
+
+			/**
+			 * function: plan the levels over leaves leaves laid out from start into cnt / base;
+			 * return h, the level of the root.
+			 */
+			static int plan_levels(size_t leaves, offset_t start, size_t *cnt, offset_t *base) {
+				int h = 0;
+				cnt[0] = leaves;
+				base[0] = start;
+				do {
+					base[h + 1] = base[h] + cnt[h] * (h == 0 ? sizeof(leafNode) : sizeof(internalNode));
+					cnt[h + 1] = (cnt[h] + M - 1) / M;
+					++h;
+				} while (cnt[h] > 1);
+				return h;
+			}
+
+			/**
+			 * function: format the internal levels 1 .. h of a plan, given the smallest key, the size
+			 * and the aggregate of every leaf (the arrays are freed); write(batch, offset, count) puts
+			 * count nodes at offset.
+			 */
+			template <class Write>
+			void build_levels(int h, const size_t *cnt, const offset_t *base, KeyType *low, size_t *num,
+			                  aggregate_type *agg, int nthreads, Write write) {
+				for (int level = 1; level <= h; ++level) {
+					size_t c = cnt[level - 1], k = cnt[level];
+					KeyType *up_low = new KeyType[k];
+					size_t *up_num = new size_t[k];
+					aggregate_type *up_agg = new aggregate_type[k];
+					parallel_for(nthreads, k, [&](size_t lo, size_t hi) {
+						internalNode *batch = new internalNode[LOAD_BATCH];
+						size_t child_size = level == 1 ? sizeof(leafNode) : sizeof(internalNode);
+						for (size_t b = lo; b < hi; b += LOAD_BATCH) {
+							size_t e = b + LOAD_BATCH < hi ? b + LOAD_BATCH : hi;
+							for (size_t g = b; g < e; ++g) {
+								internalNode &node = batch[g - b];
+								size_t from = group(g, c, k), to = group(g + 1, c, k);
+								node.offset = base[level] + g * sizeof(internalNode);
+								node.par = level == h ? 0 : base[level + 1] + part(g, k, cnt[level + 1]) * sizeof(internalNode);
+								node.type = level == 1;
+								node.cnt = to - from;
+								for (size_t j = from; j < to; ++j) {
+									node.ch[j - from] = base[level - 1] + j * child_size;
+									node.key[j - from] = low[j];
+									node.num[j - from] = num[j];
+									node.agg[j - from] = agg[j];
+								}
+								up_low[g] = low[from], up_num[g] = total(node), up_agg[g] = fold(node);
+							}
+							write(batch, base[level] + b * sizeof(internalNode), e - b);
+						}
+						delete [] batch;
+					});
+					delete [] low;
+					delete [] num;
+					delete [] agg;
+					low = up_low, num = up_num, agg = up_agg;
+				}
+				delete [] low;
+				delete [] num;
+				delete [] agg;
+			}
+
+			/**
+			 * function: the leaves n pairs take at about fill pairs each (LMIN <= fill <= L): as few
+			 * as keep each of them within fill, but never so many that one goes below LMIN.
+			 */
+			static size_t leaves_for(size_t n, int fill) {
+				size_t leaves = (n + fill - 1) / fill;
+				while (leaves > 1 && n / leaves < static_cast <size_t> (LMIN)) --leaves;
+				return leaves;
+			}
+
+			template <class RandomIt>
+			void load_levels(RandomIt first, size_t n, int fill, int nthreads) {
+				size_t cnt[MAXH];
+				offset_t base[MAXH];
+				int h = plan_levels(leaves_for(n, fill), info.eof, cnt, base);
+				offset_t eof = base[h] + sizeof(internalNode);
+				if (space == nullptr) store.reserve(eof);      // the whole region at once
+
+				// the smallest key, the size and the aggregate of every subtree of the level below
+				size_t leaves = cnt[0];
+				KeyType *low = new KeyType[leaves];
+				size_t *num = new size_t[leaves];
+				aggregate_type *agg = new aggregate_type[leaves];
+				parallel_for(nthreads, leaves, [&](size_t lo, size_t hi) {
+					leafNode *batch = new leafNode[LOAD_BATCH];
+					for (size_t b = lo; b < hi; b += LOAD_BATCH) {
+						size_t e = b + LOAD_BATCH < hi ? b + LOAD_BATCH : hi;
+						for (size_t j = b; j < e; ++j) {
+							leafNode &leaf = batch[j - b];
+							size_t from = group(j, n, leaves), to = group(j + 1, n, leaves);
+							leaf.offset = base[0] + j * sizeof(leafNode);
+							leaf.par = base[1] + part(j, leaves, cnt[1]) * sizeof(internalNode);
+							leaf.pre = j == 0 ? 0 : leaf.offset - sizeof(leafNode);
+							leaf.nxt = j + 1 == leaves ? 0 : leaf.offset + sizeof(leafNode);
+							leaf.cnt = to - from;
+							for (size_t i = from; i < to; ++i)
+								leaf.data[i - from].first = first[i].first, leaf.data[i - from].second = first[i].second;
+							leaf.bounded = j + 1 < leaves;
+							if (leaf.bounded) leaf.high = first[to].first;
+							low[j] = first[from].first, num[j] = leaf.cnt, agg[j] = fold(leaf);
+						}
+						writeFile(batch, base[0] + b * sizeof(leafNode), e - b, sizeof(leafNode));
+					}
+					delete [] batch;
+				});
+				build_levels(h, cnt, base, low, num, agg, nthreads, [this](internalNode *batch, offset_t offset, size_t k) {
+					writeFile(batch, offset, k, sizeof(internalNode));
+				});
+
+				info.head = base[0];
+				info.tail = base[0] + (leaves - 1) * sizeof(leafNode);
+				info.root = base[h];
+				info.size = n;
+				info.eof = eof;
+				writeFile(&info, info_offset, 1, sizeof(basicInfo));
+			}
+
+			// ================================== end of bulk load ===================================== //
+
+			// ==================================== parallel scan ===================================== //
+			/**
+			 * function: cut [lo, hi) into at most parts subranges at child boundaries.
+			 * it goes down the internal nodes level by level, keeping the children that overlap [lo, hi),
+			 * until there are 8 of them per part or they are leaves, then gives each part the same number.
+			 * the bounds are put in bound[0 .. ret], bound[0] = lo, bound[ret] = hi; return ret.
+			 */
+			int scan_bounds(const KeyType &lo, const KeyType &hi, int parts, KeyType *bound) const {
+				size_t cnt = 1, want = 8 * static_cast <size_t> (parts);
+				offset_t *node = new offset_t[1];
+				KeyType *key = new KeyType[1];
+				node[0] = info.root;
+				internalNode p;
+				while (1) {
+					offset_t *child = new offset_t[cnt * M];
+					KeyType *child_key = new KeyType[cnt * M];
+					size_t n = 0;
+					bool leaf_level = 0;
+					for (size_t i = 0; i < cnt; ++i) {
+						read_node(&p, node[i]);
+						leaf_level = p.type == 1;
+						for (int j = 0; j < p.cnt; ++j) {
+							if (!(p.key[j] < hi)) break;
+							if (j + 1 < p.cnt && !(lo < p.key[j + 1])) continue;     // all below lo
+							child[n] = p.ch[j], child_key[n++] = p.key[j];
+						}
+					}
+					delete [] node;
+					delete [] key;
+					node = child, key = child_key, cnt = n;
+					if (leaf_level || cnt == 0 || cnt >= want) break;
+				}
+				int ret = cnt < static_cast <size_t> (parts) ? static_cast <int> (cnt) : parts;
+				if (ret < 1) ret = 1;
+				bound[0] = lo;
+				for (int g = 1; g < ret; ++g) {
+					const KeyType &k = key[g * cnt / ret];
+					bound[g] = k < lo ? lo : k;
+				}
+				bound[ret] = hi;
+				delete [] node;
+				delete [] key;
+				return ret;
+			}
+
+			/**
+			 * function: call visitor(key, value) for the keys in [from, to), walking the leaf chain.
+			 * the caller holds the tree latch shared.
+			 */
+			template <class Visitor>
+			void scan_part(const KeyType &from, const KeyType &to, Visitor &visitor) const {
+				if (!(from < to)) return;
+				offset_t offset = locate_leaf(from, info.root);
+				if (offset == 0) offset = info.head;
+				leafNode leaf;
+				readAhead ra;
+				while (offset != 0) {
+					{
+						shared_latch leaf_lock(node_latch[offset].mutex);
+						readFile(&leaf, offset, 1, sizeof(leafNode));
+					}
+					ahead(ra, leaf, 1);
+					for (int i = 0; i < leaf.cnt; ++i) {
+						if (leaf.data[i].first < from) continue;
+						if (!(leaf.data[i].first < to)) return;
+						visitor(leaf.data[i].first, leaf.data[i].second);
+					}
+					offset = leaf.nxt;
+				}
+			}
+
+			// ================================ end of parallel scan =================================== //
+
+			// ====================================== snapshot ======================================== //
+			/**
+			 * Instructions:
+			 *    a view reads the nodes through versions with its epoch, so it sees them as they were
+			 *    when it was opened; it takes no latch, and writers do not wait for it either.
+			 *    view_node(place, offset, size, e): read a node as the snapshot of epoch e saw it.
+			 *    view_leaf(key, root, e): the leaf key should be in, 0 if key is smaller than every key.
+			 */
+			inline void view_node(void *place, offset_t offset, size_t size, uint64_t e) const {
+				readFile(place, offset, 1, size);
+				versions.read(place, offset, size, e);
+			}
+
+			offset_t view_leaf(const KeyType &key, offset_t offset, uint64_t e) const {
+				internalNode p;
+				while (1) {
+					view_node(&p, offset, sizeof(internalNode), e);
+					int pos = 0;
+					for (; pos < p.cnt; ++pos)
+						if (key < p.key[pos]) break;
+					if (pos == 0) return 0;
+					if (p.type == 1) return p.ch[pos - 1];
+					offset = p.ch[pos - 1];
+				}
+			}
+
+			// ================================== end of snapshot ===================================== //
+
+			// =================================== shadow paging ====================================== //
+			/**
+			 * Instructions:
+			 *    with shadow paging on, no committed node is ever overwritten: pages sends the first
+			 *    write of a node after a commit to a fresh place. a commit writes the pages moved since
+			 *    the last one to fresh space, as a piece of the page map linked to the piece before, then
+			 *    basicInfo with the newest piece into the older one of the two headers at info.shadow,
+			 *    each step made durable before the next; opening the file takes the valid header with
+			 *    the biggest number and reads the pieces back to the first, so a crash at any moment
+			 *    leaves the last commit. once the pieces hold twice the pages of the map, or there are
+			 *    MAP_PIECES of them, a commit writes the whole map instead and the old pieces are freed.
+			 *    the basicInfo at info_offset is only written when shadow paging starts, to point there.
+			 *    shadow_write(place, offset, num, size): write num nodes, moving them if not moved yet.
+			 *    shadow_start(): turn shadow paging on for the tree in the file.
+			 *    shadow_commit(): make the tree as it is now the state a crash goes back to.
+			 *    shadow_open(): recover the last commit when the file is opened.
+			 */
+			void shadow_write(void *place, offset_t offset, size_t num, size_t size) const {
+				for (size_t i = 0; i < num; ++i) {
+					offset_t logical = offset + i * size;
+					bool fresh;
+					offset_t physical = pages.place(logical, size, &fresh);
+					raw_write(static_cast <char *> (place) + i * size, size, physical);
+					if (fresh) pages.publish(logical, physical, size);
+				}
+			}
+
+			void shadow_start() {
+				info.shadow = info.eof;
+				info.eof += page_up(2 * sizeof(shadowHeader));
+				pages.reset(info.eof);
+				shadow_seq = 0;
+				shadow_pieces = 0, shadow_map_cnt = 0;
+				shadow_commit();
+				raw_write(&info, sizeof(basicInfo), info_offset);
+				raw_sync();
+			}
+
+			static inline size_t piece_size(size_t cnt) {
+				return page_up(sizeof(mapLink) + cnt * sizeof(pageTable::image));
+			}
+
+			void shadow_commit() {
+				if (info.shadow == 0 || options.mode == openOptions::READ_ONLY) return;
+				size_t total = pages.size(), n = pages.pending();
+				bool whole = shadow_pieces == 0 || shadow_pieces == MAP_PIECES || shadow_map_cnt + n > 2 * total;
+				mapPiece piece;
+				if (whole || n > 0) {
+					if (whole) n = total;
+					char *buf = new char[sizeof(mapLink) + n * sizeof(pageTable::image)];
+					mapLink *link = reinterpret_cast <mapLink *> (buf);
+					pageTable::image *img = reinterpret_cast <pageTable::image *> (buf + sizeof(mapLink));
+					link -> prev = whole ? 0 : shadow_piece[shadow_pieces - 1].offset;
+					link -> prev_cnt = whole ? 0 : shadow_piece[shadow_pieces - 1].cnt;
+					if (whole) pages.dump(img);
+					else pages.dump_moved(img);
+					piece.offset = pages.allocate(piece_size(n)), piece.cnt = n;
+					raw_write(buf, sizeof(mapLink) + n * sizeof(pageTable::image), piece.offset);
+					delete [] buf;
+					raw_sync();
+				} else {
+					piece = shadow_piece[shadow_pieces - 1];       // nothing moved, the map is the same
+				}
+				shadowHeader header;
+				header.seq = ++shadow_seq;
+				header.info = info;
+				header.map = piece.offset, header.map_cnt = piece.cnt;
+				header.check = checksum(&header, offsetof(shadowHeader, check));
+				raw_write(&header, sizeof(shadowHeader), info.shadow + (header.seq & 1) * sizeof(shadowHeader));
+				raw_sync();
+				pages.committed();
+				if (whole) {
+					for (int i = 0; i < shadow_pieces; ++i) pages.release(shadow_piece[i].offset, piece_size(shadow_piece[i].cnt));
+					shadow_pieces = 0, shadow_map_cnt = 0;
+				}
+				if (whole || n > 0) {
+					push_piece(piece);
+					shadow_map_cnt += piece.cnt;
+				}
+			}
+
+			void push_piece(const mapPiece &piece) {
+				if (shadow_pieces == shadow_piece_cap) {
+					shadow_piece_cap = shadow_piece_cap == 0 ? 8 : shadow_piece_cap * 2;
+					mapPiece *tmp = new mapPiece[shadow_piece_cap];
+					for (int i = 0; i < shadow_pieces; ++i) tmp[i] = shadow_piece[i];
+					delete [] shadow_piece;
+					shadow_piece = tmp;
+				}
+				shadow_piece[shadow_pieces++] = piece;
+			}
+
+			void shadow_open() {
+				if (info.shadow == 0) return;
+				shadowHeader header[2];
+				raw_read(header, sizeof(header), info.shadow);
+				int cur = -1;
+				for (int i = 0; i < 2; ++i)
+					if (header[i].check == checksum(header + i, offsetof(shadowHeader, check)) &&
+					    (cur == -1 || header[i].seq > header[cur].seq)) cur = i;
+				if (cur == -1) throw "no valid shadow header";
+				info = header[cur].info;
+				shadow_seq = header[cur].seq;
+				shadow_pieces = 0, shadow_map_cnt = 0;
+				mapPiece piece;
+				piece.offset = header[cur].map, piece.cnt = header[cur].map_cnt;
+				while (1) {
+					push_piece(piece);
+					shadow_map_cnt += piece.cnt;
+					mapLink link;
+					raw_read(&link, sizeof(mapLink), piece.offset);
+					if (link.prev == 0) break;
+					if (shadow_pieces > MAP_PIECES) throw "the page map is broken";
+					piece.offset = link.prev, piece.cnt = link.prev_cnt;
+				}
+				for (int i = 0, j = shadow_pieces - 1; i < j; ++i, --j) {
+					mapPiece tmp = shadow_piece[i];
+					shadow_piece[i] = shadow_piece[j], shadow_piece[j] = tmp;
+				}
+				pageTable::image *img = new pageTable::image[shadow_map_cnt + 1];
+				ssize_t *map = new ssize_t[shadow_pieces];
+				size_t *map_size = new size_t[shadow_pieces], n = 0;
+				for (int i = 0; i < shadow_pieces; ++i) {
+					raw_read(img + n, shadow_piece[i].cnt * sizeof(pageTable::image), shadow_piece[i].offset + sizeof(mapLink));
+					n += shadow_piece[i].cnt;
+					map[i] = shadow_piece[i].offset, map_size[i] = piece_size(shadow_piece[i].cnt);
+				}
+				pages.load(img, n, info.shadow + page_up(2 * sizeof(shadowHeader)), map, map_size, shadow_pieces);
+				delete [] img;
+				delete [] map;
+				delete [] map_size;
+			}
+
+			inline bool shadow_full() const {
+				return info.shadow != 0 && shadow_batch != 0 && pages.pending() >= shadow_batch;
+			}
+
+			// =============================== end of shadow paging =================================== //
+
+			// ====================================== memtable ======================================== //
+			/**
+			 * Instructions:
+			 *    with info.memtable_cap set, mutations are kept in memtable (the newest message of each key)
+			 *    and appended to the log file datN.log, until merge() applies them to the tree.
+			 *    log_open(): open the log, replay it into memtable if the tree was closed without a merge.
+			 *    log_clear(): empty memtable and the log.
+			 *    put(key, value, erased): record a mutation in the memtable, or else in the write buffer.
+			 *    insert(), erase() and upsert() put into the memtable under the shared latch (put_shared());
+			 *    memtable_latch guards the memtable and the log then. filter has every key that may be in
+			 *    the tree, so an insert of a new key reads no leaf; it is built when the log is opened and
+			 *    again when a merge finds it full.
+			 *    newest(key): the message of key in the memtable or the write buffer, nullptr if none.
+			 *    sync(): merge() before a query that does not look at the memtable and the buffer.
+			 */
+			void log_open() {
+				log_fp = nullptr;
+				filter.reset(0);
+				if (info.memtable_cap == 0) return;
+				bool read_only = options.mode == openOptions::READ_ONLY;
+				log_fp = fopen(log_name.str, read_only ? "rb" : "ab+");
+				if (log_fp == nullptr && read_only) return;
+				if (log_fp == nullptr) throw "open log failed";
+				message m;
+				fseek(log_fp, 0, SEEK_SET);
+				while (fread(&m, sizeof(message), 1, log_fp) == 1) memtable.insert(m.key, m);
+				fill_filter();
+			}
+
+			/**
+			 * function: build the key filter again from the keys of the leaves, the memtable and the
+			 * write buffer, with room for twice as many so it lasts a while.
+			 */
+			void fill_filter() {
+				size_t keys = info.size + memtable.size() + pending_cnt;
+				filter.reset(keys * 2 < 1024 ? 1024 : keys * 2);
+				leafNode leaf;
+				for (offset_t offset = info.head; offset != 0; offset = leaf.nxt) {
+					readFile(&leaf, offset, 1, sizeof(leafNode));
+					for (int i = 0; i < leaf.cnt; ++i) filter.add(leaf.data[i].first);
+				}
+				memtable.traverse([&](const KeyType &key, const message &m) { if (!m.erased) filter.add(key); });
+				for (int i = 0; i < pending_cnt; ++i)
+					if (!pending[i].erased) filter.add(pending[i].key);
+			}
+
+			void log_close() {
+				if (log_fp != nullptr) fclose(log_fp);
+				log_fp = nullptr;
+			}
+
+			void log_clear() {
+				memtable.clear();
+				if (log_fp == nullptr) return;
+				fclose(log_fp);
+				log_fp = fopen(log_name.str, "w");
+				fclose(log_fp);
+				log_fp = fopen(log_name.str, "ab+");
+			}
+
+			void put(const KeyType &key, const ValueType &value, bool erased) {
+				if (info.memtable_cap == 0) {
+					if (erased) cache.erase(key);
+					else cache.update(key, value);
+					push_message(key, value, erased);
+					return;
+				}
+				log_put(key, value, erased);
+				if (memtable.size() >= info.memtable_cap) merge_memtable();
+			}
+
+			/**
+			 * function: append the message to the log and put it in the memtable (and the filter);
+			 * under the shared latch memtable_latch must be held.
+			 */
+			void log_put(const KeyType &key, const ValueType &value, bool erased) {
+				if (erased) cache.erase(key);
+				else cache.update(key, value), filter.add(key);
+				message m;
+				m.key = key; m.value = value; m.erased = erased;
+				fwrite(&m, sizeof(message), 1, log_fp);
+				fflush(log_fp);
+				memtable.insert(key, m);
+			}
+
+			enum putKind { PUT_INSERT, PUT_ERASE, PUT_UPSERT };
+
+			/**
+			 * function: insert, erase or upsert into the memtable under the shared latch, the result in *ret.
+			 * whether key is in the tree comes from the memtable, else from the key filter, and only if the
+			 * filter cannot rule it out from its leaf; the leaves only change under the exclusive latch while
+			 * the memtable is on, so it is read without latching it. the memtable is merged if it is full.
+			 * return false if it has to be done under the exclusive latch.
+			 */
+			bool put_shared(const KeyType &key, const ValueType &value, putKind kind, OperationResult *ret) {
+				bool full;
+				{
+					shared_latch lock(tree_latch.mutex);
+					if (info.memtable_cap == 0 || info.buffer_cap != 0 || compact_on || !filter.ready()) return false;
+					bool found = 0;
+					if (kind != PUT_UPSERT) {
+						bool known;
+						{
+							std::lock_guard <std::mutex> memtable_lock(memtable_latch);
+							const message *m = memtable.find(key);
+							known = m != nullptr;
+							if (known) found = !m -> erased;
+						}
+						if (!known && filter.may_contain(key)) {
+							leafNode leaf;
+							offset_t offset;
+							int place;
+							found = find_direct(key, &offset, &place, &leaf);
+						}
+					}
+					std::lock_guard <std::mutex> memtable_lock(memtable_latch);
+					if (kind != PUT_UPSERT) {
+						// another writer may have put key meanwhile
+						const message *m = memtable.find(key);
+						if (m != nullptr) found = !m -> erased;
+						if (found == (kind == PUT_INSERT)) {
+							*ret = Fail;
+							return true;
+						}
+					}
+					log_put(key, value, kind == PUT_ERASE);
+					full = memtable.size() >= info.memtable_cap;
+				}
+				*ret = Success;
+				if (full) {
+					writeLatch lock(tree_latch);
+					post_splits();
+					merge_memtable();
+				}
+				return true;
+			}
+
+			const message *newest(const KeyType &key) const {
+				const message *m = memtable.find(key);
+				if (m != nullptr) return m;
+				int pos = pending_find(key);
+				if (pos != -1) return pending + pos;
+				return nullptr;
+			}
+
+			/**
+			 * the pairs in the tree do not change, so it is allowed in const functions.
+			 */
+			inline void sync() const {
+				{
+					shared_latch lock(tree_latch.mutex);
+					std::lock_guard <std::mutex> memtable_lock(memtable_latch);
+					std::lock_guard <std::mutex> info_lock(info_latch);
+					if (pending_cnt == 0 && memtable.empty() && unposted_cnt == 0 && !shadow_full()) return;
+				}
+				writeLatch lock(tree_latch);
+				const_cast <BTree *> (this) -> post_splits();
+				const_cast <BTree *> (this) -> merge_memtable();
+			}
+
+			/**
+			 * function: after a write under the shared latch, commit if shadow_batch pages have moved,
+			 * as the exclusive writes do. the half splits it left stay queued for the next exclusive
+			 * holder or the background service; the returned iterator follows the leaf links, so it
+			 * does not need them posted.
+			 */
+			void commit_if_full() {
+				if (!shadow_full()) return;
+				writeLatch lock(tree_latch);
+				post_splits();
+				if (shadow_full()) shadow_commit();
+			}
+
+			void flush_buffer() {
+				if (pending_cnt == 0) return;
+				message *batch = pending;
+				int n = pending_cnt;
+				writeFile(batch, info.buffer, n, sizeof(message));
+				info.buffer_cnt = n;
+				writeFile(&info, info_offset, 1, sizeof(basicInfo));
+				pending = new message[info.buffer_cap];
+				pending_cnt = 0;
+				apply_batch(batch, n);
+				delete [] batch;
+				info.buffer_cnt = 0;
+				writeFile(&info, info_offset, 1, sizeof(basicInfo));
+			}
+
+			void merge_memtable() {
+				flush_buffer();
+				if (memtable.empty()) return;
+				message *batch = new message[memtable.size()];
+				int n = 0;
+				memtable.traverse([&](const KeyType &, const message &m) { batch[n++] = m; });
+				memtable.clear();
+				apply_batch(batch, n);
+				delete [] batch;
+				if (filter.full()) fill_filter();
+				shadow_commit();          // the log may only go once the merge survives a crash
+				log_clear();
+			}
+
+			// ================================== end of memtable ===================================== //
+
+			// ==================================== concurrency ======================================= //
+			/**
+			 * Instructions:
+			 *    tree_latch is shared by the readers, by the writes to leaves and by the writes into the
+			 *    memtable, and held exclusively by everything else: splitting or merging internal nodes,
+			 *    a change of the smallest key of a leaf, the write buffer, merging the memtable, the
+			 *    augmented tree, and clear() / set_*().
+			 *    under the shared latch a writer latches the nodes it changes in node_latch and nothing
+			 *    more (latch crabbing): the leaf to change a pair; the father, then the leaves, to put a
+			 *    split leaf in the father (post_shared()) or merge two leaves (erase_merge()). a shared
+			 *    holder walks down the internal nodes without latching them, reading each one again
+			 *    until its latch version is even and unchanged.
+			 *    info_latch guards the header fields changed under the shared latch (size, head, tail).
+			 *    a write first tries under the shared latch, and if a father would split or merge it
+			 *    restarts under the exclusive latch.
+			 *    order: tree_latch, then node_latch (father first), then memtable_latch, then info_latch
+			 *    or the cache.
+			 *    lookups and iterators do not latch at all at first (optimistic lock coupling): every
+			 *    latch has a version, odd while it is held exclusively, and a reader checks that the
+			 *    tree version and the leaf version did not change while it read. it retries RETRY
+			 *    times, then takes the shared latches like before.
+			 *    leaves form a B-link level (Lehman and Yao): nxt is the right-link and high the high key.
+			 *    a full leaf is split under the shared latch with half_split(): the new leaf is only
+			 *    reachable through the right-link, and a reader whose key is not below the high key of
+			 *    a leaf moves right. the writer drops the leaf latch, then post_shared() puts the new
+			 *    leaf in its father; if the father is full, post_splits() does it under the exclusive
+			 *    latch, which every exclusive holder does first.
+			 *    a writer under the shared latch gives up if its key is past the high key, so it never
+			 *    writes to a leaf that is not in its father yet.
+			 */
+
+			/**
+			 * function: a write may stay in a leaf under the shared latch, nothing above has to change.
+			 */
+			inline bool optimistic() const {
+				return info.buffer_cap == 0 && info.memtable_cap == 0 && !info.augmented && !compact_on;
+			}
+
+			/**
+			 * function: split a leaf holding L + 1 pairs under the shared latch and its own latch.
+			 * the new leaf is written first, then linked from the leaf by nxt and high (the half split);
+			 * it is put in *newleaf, for post_shared() once the leaf latch is let go. it is set to the place of key.
+			 * return false and write nothing if the next leaf is latched by someone else.
+			 */
+			bool half_split(leafNode &leaf, leafNode &newleaf, iterator &it, const KeyType &key) {
+				versionLatch *nxt_latch = nullptr;
+				if (leaf.nxt != 0 && &node_latch[leaf.nxt] != &node_latch[leaf.offset]) {
+					nxt_latch = &node_latch[leaf.nxt];
+					if (!nxt_latch -> mutex.try_lock()) return false;
+					++nxt_latch -> version;
+				}
+				newleaf.cnt = leaf.cnt - (leaf.cnt >> 1);
+				leaf.cnt = leaf.cnt >> 1;
+				{
+					std::lock_guard <std::mutex> lock(info_latch);
+					newleaf.offset = info.eof;
+					info.eof += sizeof(leafNode);
+				}
+				newleaf.par = leaf.par;
+				for (int i = 0; i < newleaf.cnt; ++i) {
+					newleaf.data[i].first = leaf.data[i + leaf.cnt].first, newleaf.data[i].second = leaf.data[i + leaf.cnt].second;
+					if (newleaf.data[i].first == key) {
+						it.offset = newleaf.offset;
+						it.place = i;
+					}
+				}
+				newleaf.nxt = leaf.nxt;
+				newleaf.pre = leaf.offset;
+				newleaf.high = leaf.high;
+				newleaf.bounded = leaf.bounded;
+				writeFile(&newleaf, newleaf.offset, 1, sizeof(leafNode));
+				if (newleaf.nxt != 0) {
+					leafNode nxtleaf;
+					readFile(&nxtleaf, leaf.nxt, 1, sizeof(leafNode));
+					nxtleaf.pre = newleaf.offset;
+					writeFile(&nxtleaf, nxtleaf.offset, 1, sizeof(leafNode));
+				}
+				if (nxt_latch != nullptr) {
+					++nxt_latch -> version;
+					nxt_latch -> mutex.unlock();
+				}
+				leaf.nxt = newleaf.offset;
+				leaf.high = newleaf.data[0].first;
+				leaf.bounded = 1;
+				writeFile(&leaf, leaf.offset, 1, sizeof(leafNode));
+				std::lock_guard <std::mutex> lock(info_latch);
+				if (newleaf.nxt == 0) info.tail = newleaf.offset;
+				writeFile(&info, info_offset, 1, sizeof(basicInfo));
+				return true;
+			}
+
+			/**
+			 * function: put a leaf half split from left in its father under the shared latch, holding
+			 * only the latch of the father (the leaves are let go first, so latches are taken top down).
+			 * the father is still leaf.par: it only changes under the exclusive latch.
+			 * a full father would split, so then the leaf is queued for post_splits() instead.
+			 */
+			void post_shared(leafNode &newleaf, const leafNode &left) {
+				{
+					writeLatch lock(node_latch[newleaf.par]);
+					internalNode node;
+					readFile(&node, newleaf.par, 1, sizeof(internalNode));
+					if (node.cnt < M) {
+						insert_node(node, newleaf.data[0].first, newleaf.offset, newleaf.cnt, fold(newleaf), fold(left));
+						return;
+					}
+				}
+				std::lock_guard <std::mutex> lock(info_latch);
+				queue_offset(unposted, unposted_cnt, unposted_cap, newleaf.offset);
+			}
+
+			static void queue_offset(offset_t *&arr, int &cnt, int &cap, offset_t offset) {
+				if (cnt == cap) {
+					cap = cap == 0 ? 16 : cap * 2;
+					offset_t *tmp = new offset_t[cap];
+					for (int i = 0; i < cnt; ++i) tmp[i] = arr[i];
+					delete [] arr;
+					arr = tmp;
+				}
+				arr[cnt++] = offset;
+			}
+
+			/**
+			 * function: put every half split leaf in its father, the tree latch must be held exclusively.
+			 * the father is found again from the root: it is the father of the leaf the separator leads to.
+			 * then it commits if shadow_batch pages have moved since the last commit.
+			 */
+			void post_splits() {
+				for (int i = 0; i < unposted_cnt; ++i) {
+					leafNode leaf, left;
+					readFile(&leaf, unposted[i], 1, sizeof(leafNode));
+					readFile(&left, locate_leaf(leaf.data[0].first, info.root), 1, sizeof(leafNode));
+					leaf.par = left.par;
+					writeFile(&leaf, leaf.offset, 1, sizeof(leafNode));
+					internalNode par;
+					readFile(&par, left.par, 1, sizeof(internalNode));
+					insert_node(par, leaf.data[0].first, leaf.offset, leaf.cnt, fold(leaf), fold(left));
+				}
+				unposted_cnt = 0;
+				if (shadow_full()) shadow_commit();
+			}
+
+			/**
+			 * function: insert (key, value) in a full leaf under the shared latch, see half_split().
+			 * return false and write nothing if it cannot; newleaf.offset is 0 if it did not split.
+			 */
+			bool insert_half(leafNode &leaf, leafNode &newleaf, const KeyType &key, const ValueType &value, iterator *it, OperationResult *ret) {
+				int pos = lower_pair(leaf, key);
+				if (pos < leaf.cnt && key == leaf.data[pos].first) {
+					*it = iterator(nullptr), *ret = Fail;
+					return true;
+				}
+				for (int i = leaf.cnt - 1; i >= pos; --i)
+					leaf.data[i+1].first = leaf.data[i].first, leaf.data[i+1].second = leaf.data[i].second;
+				leaf.data[pos].first = key; leaf.data[pos].second = value;
+				++leaf.cnt;
+				iterator ret_it(this, leaf.offset, pos);
+				if (!half_split(leaf, newleaf, ret_it, key)) return false;
+				update_size(1);
+				*it = ret_it, *ret = Success;
+				return true;
+			}
+
+			void update_size(int delta) {
+				std::lock_guard <std::mutex> lock(info_latch);
+				info.size += delta;
+				writeFile(&info, info_offset, 1, sizeof(basicInfo));
+			}
+
+			/**
+			 * the versions an optimistic read saw, offset is the leaf (0 if there is none).
+			 */
+			struct readVersion {
+				uint64_t tree, leaf;
+				offset_t offset;
+			};
+
+			/**
+			 * function: check that no writer got in the way since the versions in rv were taken.
+			 */
+			inline bool validate(const readVersion &rv) const {
+				if (rv.offset != 0 && node_latch[rv.offset].version.load() != rv.leaf) return false;
+				return tree_latch.version.load() == rv.tree;
+			}
+
+			/**
+			 * function: read the leaf at offset without any latch.
+			 * return false if a writer got in the way (or holds a latch), then *leaf may be torn.
+			 */
+			bool read_leaf_optimistic(offset_t offset, leafNode *leaf, readVersion *rv) const {
+				rv -> tree = tree_latch.version.load();
+				rv -> offset = offset;
+				rv -> leaf = node_latch[offset].version.load();
+				if ((rv -> tree & 1) || (rv -> leaf & 1)) return false;
+				readFile(leaf, offset, 1, sizeof(leafNode));
+				return validate(*rv);
+			}
+
+			/**
+			 * function: find the leaf key should be in like locate_leaf(), without any latch.
+			 * every internal node is checked against the tree version and its own version before it is used.
+			 * return the leaf where it is in memory (peek_leaf()) or else read into *copy, nullptr if a
+			 * writer got in the way; rv -> offset is 0 if key is smaller than all keys. a leaf in memory
+			 * may change while the caller reads it, so what is read from it holds only if validate(*rv)
+			 * still does after.
+			 */
+			const leafNode *locate_optimistic(const KeyType &key, leafNode *copy, readVersion *rv) const {
+				uint64_t v = tree_latch.version.load();
+				if (v & 1) return nullptr;
+				if (info.buffer_cap != 0 || info.memtable_cap != 0) return nullptr;
+				offset_t offset = info.root;
+				nodeRoom <internalNode> node;
+				while (1) {
+					if (tree_latch.version.load() != v) return nullptr;
+					const versionLatch &latch = node_latch[offset];
+					uint64_t nv = latch.version.load();
+					if (nv & 1) return nullptr;
+					const internalNode *p = peek_node(offset);
+					if (p == nullptr) {
+						readFile(node.get(), offset, 1, sizeof(internalNode));
+						p = node.get();
+					}
+					int pos = upper_key(*p, key);
+					bool type = p -> type;
+					offset = pos == 0 ? 0 : p -> ch[pos - 1];
+					if (latch.version.load() != nv || tree_latch.version.load() != v) return nullptr;
+					if (pos == 0) {
+						rv -> tree = v, rv -> leaf = 0, rv -> offset = 0;
+						return copy;
+					}
+					if (type == 1) {
+						while (1) {
+							rv -> tree = v, rv -> offset = offset;
+							rv -> leaf = node_latch[offset].version.load();
+							if (rv -> leaf & 1) return nullptr;
+							const leafNode *leaf = peek_leaf(offset);
+							if (leaf == nullptr) {
+								readFile(copy, offset, 1, sizeof(leafNode));
+								leaf = copy;
+							}
+							bool right = leaf -> bounded && !(key < leaf -> high);
+							offset = leaf -> nxt;
+							if (!validate(*rv)) return nullptr;
+							if (!right) return leaf;
+							// half split, move right
+						}
+					}
+				}
+			}
+
+			/**
+			 * function: read a leaf for an iterator.
+			 */
+			void read_leaf(leafNode *leaf, offset_t offset) const {
+				readVersion rv;
+				for (int i = 0; i < RETRY; ++i) {
+					if (read_leaf_optimistic(offset, leaf, &rv)) return;
+					std::this_thread::yield();
+				}
+				shared_latch lock(tree_latch.mutex);
+				shared_latch leaf_lock(node_latch[offset].mutex);
+				readFile(leaf, offset, 1, sizeof(leafNode));
+			}
+
+			/**
+			 * function: change the value at the given place, the tree latch must be held exclusively.
+			 */
+			OperationResult modify_leaf(offset_t offset, int place, const ValueType &value) {
+				leafNode p;
+				readFile(&p, offset, 1, sizeof(leafNode));
+				compact_note(p.data[place].first);
+				if (newest(p.data[place].first) != nullptr) {
+					// a newer message of the key would overwrite it on merge, so queue it as well.
+					put(p.data[place].first, value, 0);
+					return Success;
+				}
+				p.data[place].second = value;
+				writeFile(&p, offset, 1, sizeof(leafNode));
+				cache.update(p.data[place].first, value);
+				if (info.augmented) update_path(p.par, p.offset, 0, fold(p));
+				return Success;
+			}
+
+			OperationResult modify_at(offset_t offset, int place, const ValueType &value) {
+				check_writable();
+				{
+					shared_latch lock(tree_latch.mutex);
+					if (optimistic()) {
+						writeLatch leaf_lock(node_latch[offset]);
+						leafNode *in_place = poke_leaf(offset);
+						if (in_place != nullptr) {
+							in_place -> data[place].second = value;
+							cache.update(in_place -> data[place].first, value);
+							return Success;
+						}
+						leafNode p;
+						readFile(&p, offset, 1, sizeof(leafNode));
+						p.data[place].second = value;
+						writeFile(&p, offset, 1, sizeof(leafNode));
+						cache.update(p.data[place].first, value);
+						return Success;
+					}
+				}
+				writeLatch lock(tree_latch);
+				post_splits();
+				return modify_leaf(offset, place, value);
+			}
+
+			/**
+			 * function: insert / erase / upsert under the shared latch, if it only changes one leaf.
+			 * return false and change nothing otherwise, the caller retries exclusively.
+			 * a leaf in memory (poke_leaf()) is changed where it is, unless it splits (split_optimistic()).
+			 */
+			bool insert_optimistic(const KeyType &key, const ValueType &value, iterator *it, OperationResult *ret) {
+				shared_latch lock(tree_latch.mutex);
+				if (!optimistic()) return false;
+				offset_t leaf_offset = locate_leaf(key, info.root);
+				if (leaf_offset == 0) return false;
+				{
+					writeLatch leaf_lock(node_latch[leaf_offset]);
+					nodeRoom <leafNode> copy;
+					leafNode *p = poke_leaf(leaf_offset);
+					if (p == nullptr) {
+						p = copy.get();
+						readFile(p, leaf_offset, 1, sizeof(leafNode));
+					}
+					if (p -> cnt == 0 || (p -> bounded && !(key < p -> high))) return false;
+					if (p -> cnt < L) {
+						pair <iterator, OperationResult> result = insert_leaf(*p, key, value, p != copy.get());
+						*it = result.first, *ret = result.second;
+						return true;
+					}
+				}
+				return split_optimistic(key, value, leaf_offset, it, ret);
+			}
+
+			/**
+			 * function: insert key into the full leaf at leaf_offset by half_split(), under the shared latch.
+			 * the leaf is latched and read again; return false and change nothing if it is no longer
+			 * full, or key is in it (an upsert must update it), the caller retries exclusively.
+			 */
+			bool split_optimistic(const KeyType &key, const ValueType &value, offset_t leaf_offset, iterator *it, OperationResult *ret) {
+				leafNode leaf, newleaf;
+				{
+					writeLatch leaf_lock(node_latch[leaf_offset]);
+					readFile(&leaf, leaf_offset, 1, sizeof(leafNode));
+					if (leaf.cnt < L || (leaf.bounded && !(key < leaf.high))) return false;
+					int pos = lower_pair(leaf, key);
+					if (pos < leaf.cnt && leaf.data[pos].first == key) return false;
+					if (!insert_half(leaf, newleaf, key, value, it, ret)) return false;
+				}
+				post_shared(newleaf, leaf);
+				return true;
+			}
+
+			bool erase_optimistic(const KeyType &key, OperationResult *ret) {
+				shared_latch lock(tree_latch.mutex);
+				if (!optimistic()) return false;
+				offset_t leaf_offset = locate_leaf(key, info.root);
+				if (leaf_offset == 0) {
+					*ret = Fail;
+					return true;
+				}
+				node_t par;
+				{
+					writeLatch leaf_lock(node_latch[leaf_offset]);
+					nodeRoom <leafNode> copy;
+					leafNode *p = poke_leaf(leaf_offset);
+					if (p == nullptr) {
+						p = copy.get();
+						readFile(p, leaf_offset, 1, sizeof(leafNode));
+					}
+					if (p -> bounded && !(key < p -> high)) return false;
+					int pos = lower_pair(*p, key);
+					if (pos == p -> cnt || !(p -> data[pos].first == key)) {
+						*ret = Fail;
+						return true;
+					}
+					if (pos == 0) return false;
+					// with the service on, a leaf may go one below LMIN (never to a single pair, which a
+					// later erase would empty); the service merges it later.
+					if (p -> cnt - 1 >= (service_on && LMIN > 2 ? LMIN - 1 : LMIN)) {
+						for (int i = pos + 1; i < p -> cnt; ++i)
+							p -> data[i - 1].first = p -> data[i].first, p -> data[i - 1].second = p -> data[i].second;
+						--p -> cnt;
+						if (p == copy.get()) writeFile(p, leaf_offset, 1, sizeof(leafNode));
+						cache.erase(key);
+						update_size(-1);
+						if (p -> cnt < LMIN) {
+							std::lock_guard <std::mutex> info_lock(info_latch);
+							queue_offset(deferred, deferred_cnt, deferred_cap, leaf_offset);
+						}
+						*ret = Success;
+						return true;
+					}
+					par = p -> par;
+				}
+				return erase_merge(key, leaf_offset, par, ret);
+			}
+
+			/**
+			 * function: erase key from the leaf at offset and merge it with a brother under the shared
+			 * latch, for a leaf that would go below LMIN. the father is latched first, then the two
+			 * leaves and the one before them with try_lock; the left one of the two goes into the right one,
+			 * and is left empty with its high key at its smallest key, so a reader or writer that still
+			 * comes to it from an old copy of the father moves right (or gives up), never to the left.
+			 * the right one keeps the separator of the left one, so separators stay the smallest keys.
+			 * return false and change nothing if anything is latched or does not fit, or the father
+			 * would go below MMIN; the caller retries exclusively.
+			 */
+			bool erase_merge(const KeyType &key, offset_t offset, offset_t par, OperationResult *ret) {
+				latchGroup latches;
+				latches.lock(node_latch[par]);
+				internalNode node;
+				readFile(&node, par, 1, sizeof(internalNode));
+				int i = 0;
+				while (i < node.cnt && node.ch[i] != offset) ++i;
+				if (i == node.cnt || node.cnt < 2 || (node.par != 0 && node.cnt - 1 < MMIN)) return false;
+				int j = i + 1 < node.cnt ? i : i - 1;       // ch[j] goes into ch[j + 1]
+				if (!latches.try_lock(node_latch[node.ch[j]]) || !latches.try_lock(node_latch[node.ch[j + 1]])) return false;
+				leafNode left, right, pre;
+				readFile(&left, node.ch[j], 1, sizeof(leafNode));
+				readFile(&right, node.ch[j + 1], 1, sizeof(leafNode));
+				if (left.nxt != right.offset || left.cnt == 0 || left.cnt + right.cnt - 1 > L) return false;
+				if (left.pre != 0) {
+					if (!latches.try_lock(node_latch[left.pre])) return false;
+					readFile(&pre, left.pre, 1, sizeof(leafNode));
+					if (pre.nxt != left.offset) return false;
+				}
+				leafNode &leaf = i == j ? left : right;
+				int pos = 0;
+				for (; pos < leaf.cnt; ++pos)
+					if (leaf.data[pos].first == key) break;
+				if (pos == leaf.cnt) {
+					*ret = Fail;
+					return true;
+				}
+				if (pos == 0) return false;
+				for (int k = pos + 1; k < leaf.cnt; ++k)
+					leaf.data[k - 1].first = leaf.data[k].first, leaf.data[k - 1].second = leaf.data[k].second;
+				--leaf.cnt;
+
+				for (int k = right.cnt - 1; k >= 0; --k)
+					right.data[k + left.cnt].first = right.data[k].first, right.data[k + left.cnt].second = right.data[k].second;
+				for (int k = 0; k < left.cnt; ++k)
+					right.data[k].first = left.data[k].first, right.data[k].second = left.data[k].second;
+				right.cnt += left.cnt;
+				right.pre = left.pre;
+				left.high = left.data[0].first;
+				left.bounded = 1;
+				left.cnt = 0;
+				writeFile(&right, right.offset, 1, sizeof(leafNode));
+				writeFile(&left, left.offset, 1, sizeof(leafNode));
+				if (left.pre != 0) {
+					pre.nxt = right.offset;
+					writeFile(&pre, pre.offset, 1, sizeof(leafNode));
+				}
+
+				node.ch[j] = right.offset;
+				node.num[j] += node.num[j + 1];
+				node.agg[j] = fold(right);
+				for (int k = j + 1; k < node.cnt - 1; ++k)
+					node.key[k] = node.key[k + 1], node.ch[k] = node.ch[k + 1], node.num[k] = node.num[k + 1], node.agg[k] = node.agg[k + 1];
+				--node.cnt;
+				writeFile(&node, node.offset, 1, sizeof(internalNode));
+
+				cache.erase(key);
+				std::lock_guard <std::mutex> info_lock(info_latch);
+				if (left.pre == 0) info.head = right.offset;
+				info.size -= 1;
+				writeFile(&info, info_offset, 1, sizeof(basicInfo));
+				if (right.cnt < LMIN) queue_offset(deferred, deferred_cnt, deferred_cap, right.offset);
+				*ret = Success;
+				return true;
+			}
+
+			bool upsert_optimistic(const KeyType &key, const ValueType &value) {
+				shared_latch lock(tree_latch.mutex);
+				if (!optimistic()) return false;
+				offset_t leaf_offset = locate_leaf(key, info.root);
+				if (leaf_offset == 0) return false;
+				{
+					writeLatch leaf_lock(node_latch[leaf_offset]);
+					nodeRoom <leafNode> copy;
+					leafNode *p = poke_leaf(leaf_offset);
+					if (p == nullptr) {
+						p = copy.get();
+						readFile(p, leaf_offset, 1, sizeof(leafNode));
+					}
+					if (p -> cnt == 0 || (p -> bounded && !(key < p -> high))) return false;
+					int pos = lower_pair(*p, key);
+					if (pos < p -> cnt && p -> data[pos].first == key) {
+						p -> data[pos].second = value;
+						if (p == copy.get()) writeFile(p, leaf_offset, 1, sizeof(leafNode));
+						cache.update(key, value);
+						return true;
+					}
+					if (p -> cnt < L) {
+						insert_leaf(*p, key, value, p != copy.get());
+						return true;
+					}
+				}
+				iterator it;
+				OperationResult ret;
+				return split_optimistic(key, value, leaf_offset, &it, &ret);
+			}
+
+			/**
+			 * function: find key under the shared latch, looking at the memtable and the buffer first.
+			 * return true and put the value in *value if found; the cache is filled under the leaf latch,
+			 * so a concurrent erase() or modify() cannot leave an old value in it. an optimistic read
+			 * fills it without the latch, and takes the key out again if the versions moved meanwhile
+			 * (the writer may have dropped the key from the cache before the fill).
+			 */
+			bool find_value(const KeyType &key, ValueType *value) const {
+				for (int i = 0; i < RETRY && info.buffer_cap == 0 && info.memtable_cap == 0; ++i) {
+					nodeRoom <leafNode> copy;
+					readVersion rv;
+					const leafNode *leaf = locate_optimistic(key, copy.get(), &rv);
+					if (leaf == nullptr) {
+						std::this_thread::yield();
+						continue;
+					}
+					if (rv.offset == 0) return false;
+					int j = lower_pair(*leaf, key);
+					bool found = j < leaf -> cnt && leaf -> data[j].first == key;
+					if (found) *value = leaf -> data[j].second;
+					if (!validate(rv)) continue;
+					if (!found) return false;
+					cache.admit(key, *value);
+					if (!validate(rv)) cache.erase(key);
+					return true;
+				}
+				shared_latch lock(tree_latch.mutex);
+				{
+					std::lock_guard <std::mutex> memtable_lock(memtable_latch);
+					const message *m = newest(key);
+					if (m != nullptr) {
+						if (m -> erased) return false;
+						*value = m -> value;
+						cache.admit(key, *value);
+						return true;
+					}
+				}
+				offset_t leaf_offset = locate_leaf(key, info.root);
+				if (leaf_offset == 0) return false;
+				shared_latch leaf_lock(node_latch[leaf_offset].mutex);
+				leafNode leaf;
+				readFile(&leaf, leaf_offset, 1, sizeof(leafNode));
+				while (leaf.bounded && !(key < leaf.high)) {
+					leaf_offset = leaf.nxt;
+					leaf_lock.unlock();
+					leaf_lock = shared_latch(node_latch[leaf_offset].mutex);
+					readFile(&leaf, leaf_offset, 1, sizeof(leafNode));
+				}
+				int i = lower_pair(leaf, key);
+				if (i < leaf.cnt && leaf.data[i].first == key) {
+					*value = leaf.data[i].second;
+					// a writer may have put key into the memtable since, with the memtable on
+					std::lock_guard <std::mutex> memtable_lock(memtable_latch);
+					if (memtable.find(key) == nullptr) cache.admit(key, *value);
+					return true;
+				}
+				return false;
+			}
+
+			/**
+			 * function: find key in the tree under the shared latch (sync() first).
+			 * return true and put its place in *offset, *place if found.
+			 */
+			bool find_place(const KeyType &key, offset_t *offset, int *place) const {
+				for (int i = 0; i < RETRY && info.buffer_cap == 0 && info.memtable_cap == 0; ++i) {
+					nodeRoom <leafNode> copy;
+					readVersion rv;
+					const leafNode *leaf = locate_optimistic(key, copy.get(), &rv);
+					if (leaf == nullptr) {
+						std::this_thread::yield();
+						continue;
+					}
+					if (rv.offset == 0) return false;
+					int j = lower_pair(*leaf, key);
+					bool found = j < leaf -> cnt && leaf -> data[j].first == key;
+					if (!validate(rv)) continue;
+					if (found) *offset = rv.offset, *place = j;
+					return found;
+				}
+				shared_latch lock(tree_latch.mutex);
+				offset_t leaf_offset = locate_leaf(key, info.root);
+				if (leaf_offset == 0) return false;
+				shared_latch leaf_lock(node_latch[leaf_offset].mutex);
+				leafNode leaf;
+				readFile(&leaf, leaf_offset, 1, sizeof(leafNode));
+				while (leaf.bounded && !(key < leaf.high)) {
+					leaf_offset = leaf.nxt;
+					leaf_lock.unlock();
+					leaf_lock = shared_latch(node_latch[leaf_offset].mutex);
+					readFile(&leaf, leaf_offset, 1, sizeof(leafNode));
+				}
+				for (int i = 0; i < leaf.cnt; ++i)
+					if (leaf.data[i].first == key) {
+						*offset = leaf_offset, *place = i;
+						return true;
+					}
+				return false;
+			}
+
+			// ================================= end of concurrency =================================== //
+
+			// ================================= background service =================================== //
+			/**
+			 * Instructions:
+			 *    the service is a thread of the tree that wakes every service_period milliseconds and
+			 *    does the work the foreground would otherwise do in the middle of a write:
+			 *    it posts half splits, merges the leaves erase_optimistic() left underfull, flushes the
+			 *    write buffer and merges the memtable when they are half full or their oldest change is
+			 *    service_age old, commits shadow paging on the same terms (if shadow_batch is set),
+			 *    carries a compaction started by compact(fill, false) on for up to a period,
+			 *    and keeps service_extent bytes of the file allocated ahead of its end.
+			 *    post_merges(): merge the deferred leaves, the tree latch must be held exclusively.
+			 *    maintain(): one round of the service.
+			 *    service_loop(): the thread.
+			 */
+			void post_merges() {
+				for (int i = 0; i < deferred_cnt; ++i) {
+					leafNode leaf;
+					readFile(&leaf, deferred[i], 1, sizeof(leafNode));
+					if (leaf.cnt == 0 || leaf.cnt >= LMIN) continue;
+					// merged into a brother meanwhile, the leaf is not in the tree any more.
+					if (locate_leaf(leaf.data[0].first, info.root) != leaf.offset) continue;
+					operate_leaf(leaf);
+				}
+				deferred_cnt = 0;
+			}
+
+			void maintain() {
+				bool structural, pressure, buffered, compacting;
+				{
+					shared_latch lock(tree_latch.mutex);
+					std::lock_guard <std::mutex> memtable_lock(memtable_latch);
+					std::lock_guard <std::mutex> info_lock(info_latch);
+					structural = unposted_cnt != 0 || deferred_cnt != 0;
+					compacting = compact_on;
+					size_t moved = info.shadow != 0 && shadow_batch != 0 ? pages.pending() : 0;
+					buffered = pending_cnt != 0 || !memtable.empty() || moved != 0;
+					pressure = (info.buffer_cap != 0 && pending_cnt * 2 >= info.buffer_cap) ||
+					           (info.memtable_cap != 0 && memtable.size() * 2 >= info.memtable_cap) ||
+					           (moved != 0 && moved * 2 >= shadow_batch);
+				}
+				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				if (!buffered) dirty = 0;
+				else if (!dirty) dirty = 1, dirty_since = now;
+				bool aged = dirty && now - dirty_since >= std::chrono::milliseconds(service_age);
+				if (structural || pressure || aged) {
+					writeLatch lock(tree_latch);
+					post_splits();
+					post_merges();
+					if (pressure || aged) {
+						merge_memtable();
+						if (shadow_batch != 0) shadow_commit();
+						dirty = 0;
+					}
+				}
+				if (compacting && compact_latch.try_lock()) {
+					std::lock_guard <std::mutex> guard(compact_latch, std::adopt_lock);
+					std::chrono::steady_clock::time_point until = now + std::chrono::milliseconds(service_period);
+					// once it is copied only the end is left, tried once a round (a snapshot may hold it up).
+					while (!compact_step() && !compact_copied && std::chrono::steady_clock::now() < until);
+				}
+				if (service_extent == 0 || space != nullptr) return;
+				shared_latch lock(tree_latch.mutex);
+				store.grow(file_end() + service_extent, service_extent);
+			}
+
+			void service_loop() {
+				std::unique_lock <std::mutex> lock(service_latch);
+				while (!service_stop) {
+					service_cv.wait_for(lock, std::chrono::milliseconds(service_period));
+					if (service_stop) break;
+					lock.unlock();
+					maintain();
+					lock.lock();
+				}
+			}
+
+			// ============================= end of background service ================================ //
+
+			// ===================================== compaction ======================================= //
+			/**
+			 * Instructions:
+			 *    compaction rewrites the tree into a new file: the leaves in key order one after another,
+			 *    compact_fill pairs each, then the internal nodes as bulk_load() lays them out.
+			 *    while it runs every write goes the exclusive way (optimistic() is off) and notes its key
+			 *    in compact_dirty. the pairs are copied a few leaves at a time under the shared latch,
+			 *    from the one after compact_cursor on, so the tree may change between two batches.
+			 *    at the end, under the exclusive latch, the new file takes the place of the old one and
+			 *    the keys written meanwhile get their values of the moment.
+			 *    the state belongs to whoever holds compact_latch, which is taken before the tree latch;
+			 *    clear(), bulk_load() and operator= only reset compact_on, the next holder drops the rest.
+			 *    compact_begin(fill): start, compact_step(): one batch (or the end), true when it is over.
+			 *    compact_drop(): forget the new file.
+			 */
+			static const int COMPACT_BATCH = 64;  // leaves copied under the shared latch at a time
+
+			void compact_note(const KeyType &key) {
+				if (compact_on) compact_dirty.insert(key, 1);
+			}
+
+			void compact_write(const void *place, size_t size, offset_t offset) {
+				if (compact_seg != nullptr) space -> write(compact_seg, place, size, offset);
+				else compact_store.write(place, size, offset);
+			}
+
+			void compact_read(void *place, size_t size, offset_t offset) {
+				if (compact_seg != nullptr) space -> read(compact_seg, place, size, offset);
+				else compact_store.read(place, size, offset);
+			}
+
+			void compact_drop() {
+				if (compact_seg != nullptr) {
+					space -> detach(compact_seg);
+					space -> drop(compact_name.str);
+				}
+				if (compact_store.is_open()) {
+					compact_store.close(-1);
+					remove(compact_name.str);
+				}
+				compact_seg = nullptr;
+				delete [] compact_batch;
+				delete [] compact_low;
+				delete [] compact_num;
+				delete [] compact_agg;
+				compact_batch = nullptr, compact_low = nullptr, compact_num = nullptr, compact_agg = nullptr;
+				compact_leaves = compact_cap = compact_size = 0;
+				compact_batch_cnt = 0;
+				compact_dirty.clear();
+			}
+
+			/**
+			 * function: start a compaction to leaves of fill pairs; compact_latch and the exclusive tree latch are held.
+			 */
+			void compact_begin(int fill) {
+				compact_drop();
+				merge_memtable();         // the leaves hold every pair now
+				if (space != nullptr) {
+					compact_name.setName(seg -> name, "~");
+					compact_seg = space -> attach(compact_name.str);
+					space -> truncate(compact_seg);
+				} else {
+					compact_name.setName(fp_name.str, ".compact");
+					openOptions o = options;
+					o.mode = openOptions::CREATE;
+					if (o.backend == openOptions::DIRECT) o.backend = openOptions::BUFFERED;   // no second pool
+					compact_store.open(compact_name.str, o);
+					compact_store.truncate();
+				}
+				compact_batch = new leafNode[LOAD_BATCH];
+				compact_fill = fill;
+				compact_started = compact_copied = 0;
+				compact_on = 1;
+			}
+
+			/**
+			 * function: put the pair after the last one in the new file.
+			 */
+			void compact_add(const KeyType &key, const ValueType &value) {
+				leafNode *leaf = compact_batch_cnt == 0 ? nullptr : compact_batch + compact_batch_cnt - 1;
+				if (leaf == nullptr || leaf -> cnt == compact_fill) {
+					if (leaf != nullptr) {
+						leaf -> nxt = leaf -> offset + sizeof(leafNode);
+						leaf -> bounded = 1, leaf -> high = key;
+						compact_num[compact_leaves - 1] = leaf -> cnt, compact_agg[compact_leaves - 1] = fold(*leaf);
+					}
+					if (compact_batch_cnt == LOAD_BATCH) {
+						compact_write(compact_batch, LOAD_BATCH * sizeof(leafNode), compact_batch[0].offset);
+						compact_batch_cnt = 0;
+					}
+					if (compact_leaves == compact_cap) {
+						compact_cap = compact_cap == 0 ? 1024 : compact_cap * 2;
+						KeyType *low = new KeyType[compact_cap];
+						size_t *num = new size_t[compact_cap];
+						aggregate_type *agg = new aggregate_type[compact_cap];
+						for (size_t i = 0; i < compact_leaves; ++i) low[i] = compact_low[i], num[i] = compact_num[i], agg[i] = compact_agg[i];
+						delete [] compact_low;
+						delete [] compact_num;
+						delete [] compact_agg;
+						compact_low = low, compact_num = num, compact_agg = agg;
+					}
+					leaf = compact_batch + compact_batch_cnt++;
+					leaf -> offset = node_offset + compact_leaves * sizeof(leafNode);
+					leaf -> pre = compact_leaves == 0 ? 0 : leaf -> offset - sizeof(leafNode);
+					leaf -> nxt = 0, leaf -> par = 0, leaf -> cnt = 0, leaf -> bounded = 0;
+					compact_low[compact_leaves++] = key;
+				}
+				leaf -> data[leaf -> cnt].first = key, leaf -> data[leaf -> cnt].second = value;
+				++leaf -> cnt;
+				++compact_size;
+			}
+
+			/**
+			 * function: after the last pair, write the last leaves and the internal nodes over them.
+			 */
+			void compact_levels() {
+				if (compact_leaves == 0) {   // no pair: one empty leaf
+					compact_add(KeyType(), ValueType());
+					compact_batch[0].cnt = 0;
+					compact_size = 0;
+				}
+				leafNode &last = compact_batch[compact_batch_cnt - 1];
+				compact_num[compact_leaves - 1] = last.cnt, compact_agg[compact_leaves - 1] = fold(last);
+				compact_write(compact_batch, compact_batch_cnt * sizeof(leafNode), compact_batch[0].offset);
+				size_t cnt[MAXH];
+				offset_t base[MAXH];
+				int h = plan_levels(compact_leaves, node_offset, cnt, base);
+				// the fathers are known only now
+				for (size_t b = 0; b < compact_leaves; b += LOAD_BATCH) {
+					size_t e = b + LOAD_BATCH < compact_leaves ? b + LOAD_BATCH : compact_leaves;
+					compact_read(compact_batch, (e - b) * sizeof(leafNode), base[0] + b * sizeof(leafNode));
+					for (size_t j = b; j < e; ++j)
+						compact_batch[j - b].par = base[1] + part(j, compact_leaves, cnt[1]) * sizeof(internalNode);
+					compact_write(compact_batch, (e - b) * sizeof(leafNode), base[0] + b * sizeof(leafNode));
+				}
+				build_levels(h, cnt, base, compact_low, compact_num, compact_agg, 1, [this](internalNode *batch, offset_t offset, size_t k) {
+					compact_write(batch, k * sizeof(internalNode), offset);
+				});
+				compact_low = nullptr, compact_num = nullptr, compact_agg = nullptr;
+				compact_root = base[h];
+				compact_eof = base[h] + sizeof(internalNode);
+			}
+
+			/**
+			 * function: copy the pairs of the next COMPACT_BATCH leaves; return true after the last leaf.
+			 */
+			bool compact_copy() {
+				shared_latch lock(tree_latch.mutex);
+				offset_t offset = compact_started ? locate_leaf(compact_cursor, info.root) : 0;
+				if (offset == 0) offset = info.head;
+				leafNode leaf;
+				readAhead ra;
+				for (int i = 0; i < COMPACT_BATCH; ++i) {
+					readFile(&leaf, offset, 1, sizeof(leafNode));
+					ahead(ra, leaf, 1);
+					for (int k = 0; k < leaf.cnt; ++k)
+						if (!compact_started || compact_cursor < leaf.data[k].first) {
+							compact_add(leaf.data[k].first, leaf.data[k].second);
+							compact_cursor = leaf.data[k].first;
+							compact_started = 1;
+						}
+					if (leaf.nxt == 0) return true;
+					offset = leaf.nxt;
+				}
+				return false;
+			}
+
+			/**
+			 * function: put the new file in the place of the old one, under the exclusive latch;
+			 * return false (and wait) while a snapshot is open.
+			 */
+			bool compact_finish() {
+				if (versions.active()) return false;
+				flush_buffer();
+				// the keys written meanwhile, as they are now
+				message *batch = new message[compact_dirty.size() + 1];
+				int n = 0;
+				compact_dirty.traverse([&](const KeyType &key, const bool &) {
+					message &m = batch[n++];
+					const message *newer = newest(key);
+					if (newer != nullptr) {
+						m = *newer;
+						return;
+					}
+					leafNode leaf;
+					offset_t offset;
+					int place;
+					m.key = key;
+					m.erased = !find_direct(key, &offset, &place, &leaf);
+					if (!m.erased) m.value = leaf.data[place].second;
+				});
+				basicInfo img = info;
+				img.head = node_offset;
+				img.tail = node_offset + (compact_leaves - 1) * sizeof(leafNode);
+				img.root = compact_root;
+				img.size = compact_size;
+				img.eof = compact_eof;
+				img.buffer = 0;
+				img.buffer_size = img.buffer_cap = img.buffer_cnt = 0;
+				img.shadow = 0;
+				compact_write(&img, sizeof(basicInfo), info_offset);
+				int capacity = info.buffer_cap;
+				bool shadowed = info.shadow != 0;
+				if (space != nullptr) {
+					space -> exchange(seg, compact_seg);
+				} else {
+					if (!store.replace(compact_store, fp_name.str)) {
+						delete [] batch;
+						throw "rename failed";
+					}
+				}
+				compact_on = 0;
+				compact_drop();
+				// field by field: the optimistic readers look at the settings without the latch.
+				info.head = img.head, info.tail = img.tail, info.root = img.root;
+				info.size = img.size, info.eof = img.eof;
+				info.buffer = 0, info.buffer_size = info.buffer_cnt = 0;
+				info.shadow = 0;
+				pages.reset(0);
+				deferred_cnt = 0;
+				apply_batch(batch, n);
+				delete [] batch;
+				if (capacity != 0) {
+					delete [] pending;
+					pending = nullptr;
+					reserve_buffer(capacity);
+				}
+				writeFile(&info, info_offset, 1, sizeof(basicInfo));
+				if (shadowed) shadow_start();
+				return true;
+			}
+
+			/**
+			 * function: carry the compaction on by one batch, compact_latch is held; return true when it is over.
+			 */
+			bool compact_step() {
+				{
+					shared_latch lock(tree_latch.mutex);
+					if (!compact_on) {        // cleared meanwhile
+						compact_drop();
+						return true;
+					}
+				}
+				if (!compact_copied) {
+					if (!compact_copy()) return false;
+					compact_levels();
+					compact_copied = 1;
+				}
+				writeLatch lock(tree_latch);
+				post_splits();
+				if (!compact_on) {
+					compact_drop();
+					return true;
+				}
+				return compact_finish();
+			}
+
+			// ================================= end of compaction ==================================== //
+
+#if __cpp_impl_coroutine
+			// ==================================== coroutines ======================================== //
+			/**
+			 * Instructions:
+			 *    the coroutine versions read nodes with io.read(), which suspends instead of waiting for
+			 *    the disk (a tree in a Database, opened with O_DIRECT or in memory only reads through
+			 *    its storage instead, synchronously).
+			 *    they cannot hold a latch while suspended, so they read like the optimistic
+			 *    lookups: every node is checked against the tree version and its own version after it
+			 *    arrives, and after RETRY failures they fall back to the synchronous functions.
+			 *    physical(offset): where the node at offset is in the file (shadow paging moves nodes).
+			 *    co_locate(io, key, *leaf, *rv): locate_optimistic(), suspending on every read.
+			 *    co_read_leaf(io, offset, *leaf): read_leaf(); return false if it had to take the latches.
+			 */
+			inline offset_t physical(offset_t offset) const {
+				return info.shadow != 0 ? pages.where(offset) : offset;
+			}
+
+			task <bool> co_locate(ioService &io, const KeyType &key, leafNode *leaf, readVersion *rv) const {
+				uint64_t v = tree_latch.version.load();
+				if (v & 1) co_return false;
+				if (info.buffer_cap != 0 || info.memtable_cap != 0 || space != nullptr || store.fd() < 0) co_return false;
+				offset_t offset = info.root;
+				internalNode p;
+				while (1) {
+					const versionLatch &latch = node_latch[offset];
+					uint64_t nv = latch.version.load();
+					if (nv & 1) co_return false;
+					co_await io.read(store.fd(), &p, sizeof(internalNode), physical(offset));
+					if (latch.version.load() != nv || tree_latch.version.load() != v) co_return false;
+					int pos = 0;
+					for (; pos < p.cnt; ++pos)
+						if (key < p.key[pos]) break;
+					if (pos == 0) {
+						rv -> tree = v, rv -> leaf = 0, rv -> offset = 0;
+						co_return true;
+					}
+					offset = p.ch[pos - 1];
+					if (p.type == 0) continue;
+					while (1) {
+						rv -> tree = v, rv -> offset = offset;
+						rv -> leaf = node_latch[offset].version.load();
+						if (rv -> leaf & 1) co_return false;
+						co_await io.read(store.fd(), leaf, sizeof(leafNode), physical(offset));
+						if (!validate(*rv)) co_return false;
+						if (!leaf -> bounded || key < leaf -> high) co_return true;
+						offset = leaf -> nxt;       // half split, move right
+					}
+				}
+			}
+
+			task <bool> co_read_leaf(ioService &io, offset_t offset, leafNode *leaf) const {
+				readVersion rv;
+				rv.offset = offset;
+				for (int i = 0; i < RETRY && space == nullptr && store.fd() >= 0; ++i) {
+					rv.tree = tree_latch.version.load();
+					rv.leaf = node_latch[offset].version.load();
+					if ((rv.tree & 1) || (rv.leaf & 1)) continue;
+					co_await io.read(store.fd(), leaf, sizeof(leafNode), physical(offset));
+					if (validate(rv)) co_return true;
+				}
+				read_leaf(leaf, offset);
+				co_return false;
+			}
+
+			// ================================ end of coroutines ===================================== //
+#endif
+
+		public:
+			class iterator {
+					friend class BTree;
+				private:
+					offset_t offset;        // offset of the leaf node
+					int place;							// place of the element in the leaf node
+					BTree *from;
+					readAhead ra;
+				public:
+					iterator() {
+						from = nullptr;
+						place = 0, offset = 0;
+					}
+					iterator(BTree *_from, offset_t _offset = 0, int _place = 0) {
+						from = _from;
+						offset = _offset; place = _place;
+					}
+					iterator(const iterator& other) {
+						from = other.from;
+						offset = other.offset;
+						place = other.place;
+						ra = other.ra;
+					}
+					iterator &operator=(const iterator& other) {
+						from = other.from;
+						offset = other.offset;
+						place = other.place;
+						ra = other.ra;
+						return *this;
+					}
+					iterator(const const_iterator& other) {
+						from = other.from;
+						offset = other.offset;
+						place = other.place;
+					}
+
+					// to get the value type pointed by iterator.
+					ValueType getValue() {
+						leafNode p;
+						from -> read_leaf(&p, offset);
+						return p.data[place].second;
+					}
+
+					OperationResult modify(const ValueType& value) {
+						return from -> modify_at(offset, place, value);
+					}
+
+					// Return a new iterator which points to the n-next elements
+					iterator operator++(int) {
+						iterator ret = *this;
+						// end of bptree
+						if(*this == from -> end()) {
+							from = nullptr; place = 0; offset = 0;
+							return ret;
+						}
+						leafNode p;
+						from -> read_leaf(&p, offset);
+						if(place == p.cnt - 1) {
+							if(p.nxt == 0) ++ place;
+							else {
+								from -> ahead(ra, p, 1);
+								offset = p.nxt;
+								place = 0;
+							}
+						} else ++ place;
+						return ret;
+					}
+					iterator& operator++() {
+						if(*this == from -> end()) {
+							from = nullptr; place = 0; offset = 0;
+							return *this;
+						}
+						leafNode p;
+						from -> read_leaf(&p, offset);
+						if(place == p.cnt - 1) {
+							if(p.nxt == 0) ++ place;
+							else {
+								from -> ahead(ra, p, 1);
+								offset = p.nxt;
+								place = 0;
+							}
+						} else ++ place;
+						return *this;
+					}
+					iterator operator--(int) {
+						iterator ret = *this;
+						if(*this == from -> begin()) {
+							from = nullptr; place = 0; offset = 0;
+							return ret;
+						}
+						leafNode p, q;
+						from -> read_leaf(&p, offset);
+						if(place == 0) {
+							from -> ahead(ra, p, 0);
+							offset = p.pre;
+							from -> read_leaf(&q, p.pre);
+							place = q.cnt - 1;
+						} else -- place;
+						return ret;
+					}
+					iterator& operator--() {
+						if(*this == from -> begin()) {
+							from = nullptr; place = 0; offset = 0;
+							return *this;
+						}
+						leafNode p, q;
+						from -> read_leaf(&p, offset);
+						if(place == 0) {
+							from -> ahead(ra, p, 0);
+							offset = p.pre;
+							from -> read_leaf(&q, p.pre);
+							place = q.cnt - 1;
+						} else -- place;
+						return *this;
+					}
+					bool operator==(const iterator& rhs) const {
+						return offset == rhs.offset && place == rhs.place && from == rhs.from;
+					}
+					bool operator==(const const_iterator& rhs) const {
+						return offset == rhs.offset && place == rhs.place && from == rhs.from;
+					}
+					bool operator!=(const iterator& rhs) const {
+						return offset != rhs.offset || place != rhs.place || from != rhs.from;
+					}
+					bool operator!=(const const_iterator& rhs) const {
+						return offset != rhs.offset || place != rhs.place || from != rhs.from;
+					}
+			};
+
+			class const_iterator {
+					friend class BTree;
+				private:
+					offset_t offset;        // offset of the leaf node
+					int place;							// place of the element in the leaf node
 					const BTree *from;
+					readAhead ra;
 				public:
 					const_iterator() {
 						from = nullptr;
@@ -919,11 +3427,19 @@ namespace sjtu {
 						from = other.from;
 						offset = other.offset;
 						place = other.place;
+						ra = other.ra;
+					}
+					const_iterator &operator=(const const_iterator& other) {
+						from = other.from;
+						offset = other.offset;
+						place = other.place;
+						ra = other.ra;
+						return *this;
 					}
 					// to get the value type pointed by iterator.
 					ValueType getValue() {
 						leafNode p;
-						from -> readFile(&p, offset, 1, sizeof(leafNode));
+						from -> read_leaf(&p, offset);
 						return p.data[place].second;
 					}
 					// Return a new iterator which points to the n-next elements
@@ -935,10 +3451,11 @@ namespace sjtu {
 							return ret;
 						}
 						leafNode p;
-						from -> readFile(&p, offset, 1, sizeof(leafNode));
+						from -> read_leaf(&p, offset);
 						if(place == p.cnt - 1) {
 							if(p.nxt == 0) ++ place;
 							else {
+								from -> ahead(ra, p, 1);
 								offset = p.nxt;
 								place = 0;
 							}
@@ -951,10 +3468,11 @@ namespace sjtu {
 							return *this;
 						}
 						leafNode p;
-						from -> readFile(&p, offset, 1, sizeof(leafNode));
+						from -> read_leaf(&p, offset);
 						if(place == p.cnt - 1) {
 							if(p.nxt == 0) ++ place;
 							else {
+								from -> ahead(ra, p, 1);
 								offset = p.nxt;
 								place = 0;
 							}
@@ -968,10 +3486,11 @@ namespace sjtu {
 							return ret;
 						}
 						leafNode p, q;
-						from -> readFile(&p, offset, 1, sizeof(leafNode));
+						from -> read_leaf(&p, offset);
 						if(place == 0) {
+							from -> ahead(ra, p, 0);
 							offset = p.pre;
-							from -> readFile(&q, p.pre, 1, sizeof(leafNode));
+							from -> read_leaf(&q, p.pre);
 							place = q.cnt - 1;
 						} else -- place;
 						return ret;
@@ -982,10 +3501,11 @@ namespace sjtu {
 							return *this;
 						}
 						leafNode p, q;
-						from -> readFile(&p, offset, 1, sizeof(leafNode));
+						from -> read_leaf(&p, offset);
 						if(place == 0) {
+							from -> ahead(ra, p, 0);
 							offset = p.pre;
-							from -> readFile(&q, p.pre, 1, sizeof(leafNode));
+							from -> read_leaf(&q, p.pre);
 							place = q.cnt - 1;
 						} else -- place;
 						return *this;
@@ -1004,128 +3524,577 @@ namespace sjtu {
 					}
 			};
 
+			/**
+			 * A point-in-time view of the tree, opened by snapshot().
+			 * it keeps showing the pairs of that moment however the tree changes, without blocking
+			 * or being blocked by the writers; the old nodes it needs are kept until it is destroyed.
+			 * it must be destroyed before the tree, and clear() and bulk_load() throw while it is open.
+			 */
+			class view {
+				friend class BTree;
+				private:
+					const BTree *from;
+					uint64_t epoch;
+					offset_t root, head;
+					size_t cnt;
+
+					view(const BTree *_from, uint64_t _epoch, offset_t _root, offset_t _head, size_t _cnt)
+						: from(_from), epoch(_epoch), root(_root), head(_head), cnt(_cnt) {}
+
+					bool find(const KeyType &key, ValueType *value) const {
+						offset_t offset = from -> view_leaf(key, root, epoch);
+						if (offset == 0) return 0;
+						leafNode leaf;
+						from -> view_node(&leaf, offset, sizeof(leafNode), epoch);
+						for (int i = 0; i < leaf.cnt; ++i)
+							if (leaf.data[i].first == key) {
+								*value = leaf.data[i].second;
+								return 1;
+							}
+						return 0;
+					}
+
+				public:
+					view(view &&other) : from(other.from), epoch(other.epoch), root(other.root), head(other.head), cnt(other.cnt) {
+						other.from = nullptr;
+					}
+					view(const view &) = delete;
+					view &operator=(const view &) = delete;
+					~view() {
+						if (from != nullptr) from -> versions.release(epoch);
+					}
+
+					size_t size() const { return cnt; }
+					bool empty() const { return cnt == 0; }
+					size_t count(const KeyType &key) const {
+						ValueType value;
+						return static_cast <size_t> (find(key, &value));
+					}
+					ValueType at(const KeyType &key) const {
+						ValueType value;
+						if (!find(key, &value)) throw "not found";
+						return value;
+					}
+					/**
+					 * call visitor(key, value) for the keys in [lo, hi) in key order.
+					 */
+					template <class Visitor>
+					void scan(const KeyType &lo, const KeyType &hi, Visitor visitor) const {
+						if (!(lo < hi)) return;
+						offset_t offset = from -> view_leaf(lo, root, epoch);
+						if (offset == 0) offset = head;
+						leafNode leaf;
+						readAhead ra;
+						while (offset != 0) {
+							from -> view_node(&leaf, offset, sizeof(leafNode), epoch);
+							from -> ahead(ra, leaf, 1);
+							for (int i = 0; i < leaf.cnt; ++i) {
+								if (leaf.data[i].first < lo) continue;
+								if (!(leaf.data[i].first < hi)) return;
+								visitor(leaf.data[i].first, leaf.data[i].second);
+							}
+							offset = leaf.nxt;
+						}
+					}
+			};
+
 			// Default Constructor and Copy Constructor
 
-			BTree() {
-				fp_name.setName(ID);
-				fp = nullptr;
+		private:
+			/**
+			 * function: set every member to its empty state, the names are set already.
+			 */
+			void prepare() {
+				fp_open = 0;
+				unposted = nullptr;
+				unposted_cnt = unposted_cap = 0;
+				deferred = nullptr;
+				deferred_cnt = deferred_cap = 0;
+				service_stop = service_on = dirty = 0;
+				service_period = service_age = 0, service_extent = 0;
+				readahead_leaves = 32;
+				compact_on = 0;
+				compact_seg = nullptr;
+				compact_batch = nullptr, compact_batch_cnt = 0;
+				compact_low = nullptr, compact_num = nullptr, compact_agg = nullptr;
+				compact_leaves = compact_cap = compact_size = 0;
+				versions.bind(ver_name.str, page_size());
+				shadow_batch = 0, shadow_seq = 0;
+				shadow_piece = nullptr;
+				shadow_pieces = shadow_piece_cap = 0, shadow_map_cnt = 0;
+				copy_source = nullptr;
+				space = nullptr, seg = nullptr;
+			}
+
+			/**
+			 * function: open the file and recover what it holds.
+			 */
+			void open_tree() {
 				openFile();
 				if (file_already_exists == 0) build_tree();
+				else shadow_open();
+				load_buffer();
+				log_open();
+				if (options.mode == openOptions::READ_ONLY && (pending_cnt != 0 || !memtable.empty())) {
+					log_close();
+					delete [] pending;
+					closeFile();
+					throw "the tree has unmerged changes, open it writable first";
+				}
+			}
+
+			/**
+			 * function: make this a new tree in the files already named, with what is in other.
+			 */
+			void copy_tree(const BTree &other) {
+				prepare();
+				openFile();
+				other.sync();
+				shared_latch other_lock(other.tree_latch.mutex);
+				copy_source = &other;
+				copyFile();
+				load_buffer();
+				log_open();
+			}
+
+		public:
+			/**
+			 * the size of a node in the file, the biggest of a leaf and an internal node.
+			 */
+			static size_t page_size() { return sizeof(leafNode) > sizeof(internalNode) ? sizeof(leafNode) : sizeof(internalNode); }
+
+
+			/**
+			 * the tree in datN.dat, N = ID, opened or created.
+			 */
+			BTree() {
+				fp_name.setName(ID);
+				log_name.setName(ID, "log");
+				ver_name.setName(ID, "ver");
+				prepare();
+				open_tree();
+			}
+
+			/**
+			 * the tree in the file path, opened as options say; the log and the snapshot versions
+			 * go to path.log and path.ver.
+			 */
+			explicit BTree(const char *path, const openOptions &_options = openOptions()) {
+				fp_name.setName(path);
+				log_name.setName(path, ".log");
+				ver_name.setName(path, ".ver");
+				options = _options;
+				if (options.page != 0 && options.page != page_size()) throw "page size does not match the nodes";
+				prepare();
+				if (options.cache != 0) cache.resize(options.cache);
+				open_tree();
+			}
+
+			/**
+			 * the tree name in the database db, opened or created; it has no file of its own, and the
+			 * log and the snapshot versions go to <db file>.<name>.log and .ver. close it before db.
+			 */
+			BTree(Database &db, const char *name) {
+				fp_name.setName(db.path(), ".");
+				fp_name.setName(fp_name.str, name);
+				log_name.setName(fp_name.str, ".log");
+				ver_name.setName(fp_name.str, ".ver");
+				prepare();
+				space = &db;
+				seg = db.attach(name);
+				open_tree();
 			}
 
+			/**
+			 * a copy of other in datN.dat, N = ID, like BTree(); a file of that name is overwritten.
+			 */
 			BTree(const BTree& other) {
 				fp_name.setName(ID);
-				openFile();
-				copyFile(fp_name.str, other.fp_name.str);
+				log_name.setName(ID, "log");
+				ver_name.setName(ID, "ver");
+				copy_tree(other);
+			}
+
+			/**
+			 * a copy of other in the file path (path.log and path.ver with it, like BTree(path)); a file
+			 * of that name is overwritten. path must not be the file of other.
+			 */
+			BTree(const BTree& other, const char *path) {
+				if (other.fp_name.str != nullptr && strcmp(path, other.fp_name.str) == 0) throw "cannot copy a tree onto its own file";
+				fp_name.setName(path);
+				log_name.setName(path, ".log");
+				ver_name.setName(path, ".ver");
+				copy_tree(other);
 			}
 
 			BTree& operator=(const BTree& other) {
-				fp_name.setName(ID);
-				openFile();
-				copyFile(fp_name.str, other.fp_name.str);
+				if (this == &other) return *this;
+				check_writable();
+				if (versions.active()) throw "a snapshot is open";
+				writeLatch lock(tree_latch);
+				post_splits();
+				cache.clear();
+				log_clear();
+				log_close();
+				other.sync();
+				shared_latch other_lock(other.tree_latch.mutex);
+				info.shadow = 0;
+				pages.reset(0);
+				deferred_cnt = 0;
+				compact_on = 0;
+				copy_source = &other;
+				copyFile();
+				delete [] pending;
+				load_buffer();
+				log_open();
+				return *this;
 			}
 
 			~BTree() {
+				set_background(0);
+				post_splits();
+				post_merges();
+				delete [] unposted;
+				delete [] deferred;
+				merge_memtable();
+				shadow_commit();
+				delete [] shadow_piece;
+				log_close();
+				delete [] pending;
 				closeFile();
+				if (space != nullptr) space -> detach(seg);
 			}
 
 			/**
 			 * Insert: Insert certain Key-Value into the database
 			 * Return a pair, the first of the pair is the iterator point to the new
 			 * element, the second of the pair is Success if it is successfully inserted
+			 * With the write buffer or the memtable on, the pair only goes there and the iterator is iterator().
+			 * insert, erase, upsert, modify and the queries may be called from several threads at once.
+			 */
+			pair <iterator, OperationResult> insert(const KeyType& key, const ValueType& value) {
+				check_writable();
+				iterator it;
+				OperationResult ret;
+				if (insert_optimistic(key, value, &it, &ret)) {
+					commit_if_full();
+					return pair <iterator, OperationResult> (it, ret);
+				}
+				if (put_shared(key, value, PUT_INSERT, &ret))
+					return pair <iterator, OperationResult> (ret == Fail ? iterator(nullptr) : iterator(), ret);
+				writeLatch lock(tree_latch);
+				post_splits();
+				compact_note(key);
+				if (info.buffer_cap == 0 && info.memtable_cap == 0) return insert_direct(key, value);
+				if (exists(key)) return pair <iterator, OperationResult> (iterator(nullptr), Fail);
+				put(key, value, 0);
+				return pair <iterator, OperationResult> (iterator(), Success);
+			}
+
+			/**
+			 * Erase: Erase the Key-Value
+			 * Return Success if it is successfully erased
+			 * Return Fail if the key doesn't exist in the database
+			 */
+			OperationResult erase(const KeyType& key) {
+				check_writable();
+				OperationResult ret;
+				if (erase_optimistic(key, &ret)) {
+					commit_if_full();
+					return ret;
+				}
+				if (put_shared(key, ValueType(), PUT_ERASE, &ret)) return ret;
+				writeLatch lock(tree_latch);
+				post_splits();
+				compact_note(key);
+				if (info.buffer_cap == 0 && info.memtable_cap == 0) return erase_direct(key);
+				if (!exists(key)) return Fail;
+				put(key, ValueType(), 1);
+				return Success;
+			}
+
+			/**
+			 * Upsert: insert the Key-Value, or change the value if the key already exists.
+			 * With the write buffer or the memtable on, it reads nothing: the pair is only recorded there.
+			 */
+			void upsert(const KeyType& key, const ValueType& value) {
+				check_writable();
+				if (upsert_optimistic(key, value)) {
+					commit_if_full();
+					return;
+				}
+				OperationResult ret;
+				if (put_shared(key, value, PUT_UPSERT, &ret)) return;
+				writeLatch lock(tree_latch);
+				post_splits();
+				compact_note(key);
+				if (info.buffer_cap != 0 || info.memtable_cap != 0) put(key, value, 0);
+				else upsert_direct(key, value);
+			}
+
+			/**
+			 * Write buffer (a one-level B-epsilon tree), off by default.
+			 * set_write_buffer(capacity) reserves room for capacity messages in the file (0 turns it off).
+			 * insert(), erase() and upsert() then append a message instead of writing a leaf; when the
+			 * buffer is full, flush() applies all of them in key order, one read and write per leaf.
+			 * at() and count() look at the buffer first; the other queries flush() before they start.
+			 * the messages stay in memory until a flush (the tree flushes when it is closed), so a crash
+			 * loses the ones since the last flush; a flush writes its batch to the file first.
+			 */
+			void set_write_buffer(int capacity) {
+				check_writable();
+				writeLatch lock(tree_latch);
+				post_splits();
+				if (info.shadow != 0 && capacity != 0) throw "shadow paging needs no write buffer";
+				flush_buffer();
+				delete [] pending;
+				pending = nullptr;
+				if (capacity > info.buffer_size) {
+					info.buffer = info.eof;
+					info.buffer_size = capacity;
+					info.eof += page_up(capacity * sizeof(message));
+				}
+				info.buffer_cap = capacity;
+				writeFile(&info, info_offset, 1, sizeof(basicInfo));
+				if (capacity > 0) pending = new message[capacity];
+			}
+			void flush() {
+				writeLatch lock(tree_latch);
+				post_splits();
+				flush_buffer();
+			}
+
+			/**
+			 * Memtable, off by default.
+			 * set_memtable(capacity) keeps mutations in memory (a skip list) and appends them to datN.log
+			 * instead of touching any node (0 turns it off). reads look at the memtable first.
+			 * writes only take the tree latch shared; an insert or erase reads the leaf of its key only
+			 * if an in-memory filter of the keys cannot tell it is not in the tree (an insert of a new
+			 * key, most of the time), or a merge is due.
+			 * when it has capacity keys, merge() applies them to the tree in key order, one read and
+			 * write per leaf like flush(). the log is replayed on open, and the tree merges when destroyed.
+			 */
+			void set_memtable(size_t capacity) {
+				check_writable();
+				writeLatch lock(tree_latch);
+				post_splits();
+				merge_memtable();
+				log_close();
+				info.memtable_cap = capacity;
+				writeFile(&info, info_offset, 1, sizeof(basicInfo));
+				log_open();
+			}
+			void merge() {
+				writeLatch lock(tree_latch);
+				post_splits();
+				merge_memtable();
+			}
+
+			/**
+			 * Shadow paging, off by default.
+			 * set_shadow_paging(batch) turns it on for good (the file remembers it, like augment()):
+			 * nodes are never overwritten in place, and commit() atomically makes the tree as it is now
+			 * the state the file opens in after a crash, with no log to replay. a commit also happens
+			 * whenever batch nodes have moved since the last one (0: only by commit()), on a merge of
+			 * the memtable, and when the tree is destroyed. the write buffer cannot be used with it.
+			 */
+			void set_shadow_paging(size_t batch) {
+				check_writable();
+				writeLatch lock(tree_latch);
+				post_splits();
+				if (info.buffer_cap != 0) throw "shadow paging needs no write buffer";
+				merge_memtable();
+				shadow_batch = batch;
+				if (info.shadow == 0) shadow_start();
+			}
+			void commit() {
+				writeLatch lock(tree_latch);
+				post_splits();
+				shadow_commit();
+			}
+
+			/**
+			 * Background service, off by default.
+			 * set_background(period, age, extent) starts a thread that every period milliseconds posts
+			 * half splits, merges the leaves erase() left underfull (with it on, an erase may leave a
+			 * leaf one pair short instead of merging at once), flushes the write buffer / merges the
+			 * memtable / commits when they are half full or have waited age milliseconds, and keeps
+			 * extent bytes of the file preallocated. set_background(0) stops it, and a compaction left to
+			 * it; so does the destructor.
 			 */
-			pair <iterator, OperationResult> insert(const KeyType& key, const ValueType& value) {
-				offset_t leaf_offset = locate_leaf(key, info.root);
-				leafNode leaf;
-				if(info.size == 0 || leaf_offset == 0) {					// smallest elements
-					readFile(&leaf, info.head, 1, sizeof(leafNode));
-					pair <iterator, OperationResult> ret = insert_leaf(leaf, key, value);
-					if(ret.second == Fail) return ret;
-					offset_t offset = leaf.par;
-					internalNode node;
-					while(offset != 0) {
-						readFile(&node, offset, 1, sizeof(internalNode));
-						node.key[0] = key;
-						writeFile(&node, offset, 1, sizeof(internalNode));
-						offset = node.par;
+			void set_background(int period, int age = 1000, size_t extent = 1 << 20) {
+				if (period > 0) check_writable();
+				if (service.joinable()) {
+					{
+						std::lock_guard <std::mutex> lock(service_latch);
+						service_stop = 1;
 					}
-					return ret;
+					service_cv.notify_all();
+					service.join();
 				}
-				readFile(&leaf, leaf_offset, 1, sizeof(leafNode));
-				pair <iterator, OperationResult> ret = insert_leaf(leaf, key, value);
-				return ret;
+				std::lock_guard <std::mutex> guard(compact_latch);
+				writeLatch lock(tree_latch);
+				post_splits();
+				post_merges();
+				service_on = period > 0;
+				if (!service_on) {         // a compaction left to the service stops too
+					compact_on = 0;
+					compact_drop();
+					return;
+				}
+				service_period = period, service_age = age, service_extent = extent;
+				service_stop = 0, dirty = 0;
+				service = std::thread(&BTree::service_loop, this);
 			}
 
 			/**
-			 * Erase: Erase the Key-Value
-			 * Return Success if it is successfully erased
-			 * Return Fail if the key doesn't exist in the database
+			 * Online compaction.
+			 * compact(fill) rewrites the tree into a new file where the leaves follow each other in key
+			 * order, fill * L pairs each (at least half full), the internal nodes come after them and
+			 * the file ends there; then the new file takes the place of the old one. it copies a few
+			 * leaves at a time under the shared latch, so queries go on meanwhile, and so do writes,
+			 * though only the exclusive way: the keys they write are brought up to date at the end.
+			 * iterators taken before are invalid after.
+			 * compact(fill, false) only starts it and leaves the rest to the background service;
+			 * compacting() tells whether it is still going.
+			 * it throws if a snapshot is open at the start. at the end the service waits for the
+			 * snapshots to close; compact(fill) gives up and throws instead.
 			 */
-			OperationResult erase(const KeyType& key) {
-				offset_t leaf_offset = locate_leaf(key, info.root);
-				if(leaf_offset == 0) return Fail;
-				leafNode leaf;
-				readFile(&leaf, leaf_offset, 1, sizeof(leafNode));
-				int pos = 0;
-				for (; pos < leaf.cnt; ++pos)
-					if (leaf.data[pos].first == key) break;
-				if (pos == leaf.cnt) return Fail;          // not found.
-				// erase in leaf...
-				for (int i = pos + 1; i < leaf.cnt; ++i)
-					leaf.data[i - 1].first = leaf.data[i].first, leaf.data[i - 1].second = leaf.data[i].second;
-				leaf.cnt --;
-				// if is the head of the leaf, then update ancestors.
-				offset_t internal_offset = leaf.par;
-				internalNode node;
-				while(pos == 0) {
-					if(internal_offset == 0) break;
-					readFile(&node, internal_offset, 1, sizeof(internalNode));
-					pos = 0;
-					for (; pos < node.cnt; ++pos)
-						if (node.key[pos] == key) break;
-					node.key[pos] = leaf.data[0].first;
-					writeFile(&node, node.offset, 1, sizeof(internalNode));
-					internal_offset = node.par;
+			void compact(double fill = 0.9, bool wait = true) {
+				check_writable();
+				int n = static_cast <int> (fill * L);
+				if (n < LMIN) n = LMIN;
+				if (n > L) n = L;
+				std::lock_guard <std::mutex> guard(compact_latch);
+				{
+					writeLatch lock(tree_latch);
+					post_splits();
+					if (versions.active()) throw "a snapshot is open";
+					if (!wait && !service_on) throw "the background service is off";
+					compact_begin(n);
 				}
-				info.size --;
-				writeFile(&info, info_offset, 1, sizeof(basicInfo));
-				if(leaf.cnt < LMIN) {
-					operate_leaf(leaf);
-					return Success;
-				}
-				writeFile(&leaf, leaf_offset, 1, sizeof(leafNode));
-				return Success;
+				if (!wait) return;
+				while (!compact_step())
+					if (compact_copied) {
+						{
+							writeLatch lock(tree_latch);
+							compact_on = 0;
+						}
+						compact_drop();
+						throw "a snapshot is open";
+					}
+			}
+			bool compacting() const {
+				shared_latch lock(tree_latch.mutex);
+				return compact_on;
 			}
 
 			// Return a iterator to the beginning
 			iterator begin() {
+				sync();
+				shared_latch lock(tree_latch.mutex);
 				return iterator(this, info.head, 0);
 			}
 			const_iterator cbegin() const {
+				sync();
+				shared_latch lock(tree_latch.mutex);
 				return const_iterator(this, info.head, 0);
 			}
 			// Return a iterator to the end(the next element after the last)
 			iterator end() {
+				sync();
+				shared_latch lock(tree_latch.mutex);
+				offset_t offset;
+				{
+					std::lock_guard <std::mutex> info_lock(info_latch);
+					offset = info.tail;
+				}
+				shared_latch leaf_lock(node_latch[offset].mutex);
 				leafNode tail;
-				readFile(&tail, info.tail, 1, sizeof(leafNode));
-				return iterator(this, info.tail, tail.cnt);
+				readFile(&tail, offset, 1, sizeof(leafNode));
+				return iterator(this, offset, tail.cnt);
 			}
 			const_iterator cend() const {
+				sync();
+				shared_latch lock(tree_latch.mutex);
+				offset_t offset;
+				{
+					std::lock_guard <std::mutex> info_lock(info_latch);
+					offset = info.tail;
+				}
+				shared_latch leaf_lock(node_latch[offset].mutex);
 				leafNode tail;
-				readFile(&tail, info.tail, 1, sizeof(leafNode));
-				return const_iterator(this, info.tail, tail.cnt);
+				readFile(&tail, offset, 1, sizeof(leafNode));
+				return const_iterator(this, offset, tail.cnt);
 			}
 			// Check whether this BTree is empty
-			bool empty() const {return info.size == 0;}
+			bool empty() const {return size() == 0;}
 			// Return the number of <K,V> pairs
-			size_t size() const {return info.size;}
+			size_t size() const {
+				sync();
+				std::lock_guard <std::mutex> lock(info_latch);
+				return info.size;
+			}
+			/**
+			 * the bytes the nodes take in the storage (the file, the mapping or the memory), freed
+			 * nodes included until they are compacted away.
+			 */
+			size_t bytes() const {
+				std::lock_guard <std::mutex> lock(info_latch);
+				return file_end();
+			}
 			// Clear the BTree
 			void clear() {
-				closeFile();
-				fp = fopen(fp_name.str, "w");
-				fclose(fp);
-				openFile();
+				check_writable();
+				writeLatch lock(tree_latch);
+				post_splits();
+				int capacity = info.buffer_cap;
+				bool shadowed = info.shadow != 0;
+				reset_file();
 				build_tree();
+				reserve_buffer(capacity);
+				if (shadowed) shadow_start();
+				if (info.memtable_cap != 0) fill_filter();
+			}
+			/**
+			 * Bulk load: replace the pairs of the tree by the pairs in [first, last), using nthreads threads.
+			 * the input must be sorted by key with no equal keys, or it throws and changes nothing.
+			 * the leaves are filled evenly, fill * L pairs each like compact(fill) (at least half full),
+			 * so the first inserts do not split them, and laid out in key order; the place of every node
+			 * is computed in advance, so each thread formats its own part of a level into its own region
+			 * of the file (links and fathers included), level by level from the leaves up.
+			 */
+			template <class RandomIt>
+			void bulk_load(RandomIt first, RandomIt last, int nthreads = 1, double fill = 0.9) {
+				size_t n = last - first;
+				int per_leaf = static_cast <int> (fill * L);
+				if (per_leaf < LMIN) per_leaf = LMIN;
+				if (per_leaf > L) per_leaf = L;
+				std::atomic <bool> sorted(1);
+				parallel_for(nthreads, n == 0 ? 0 : n - 1, [&](size_t lo, size_t hi) {
+					for (size_t i = lo; i < hi; ++i)
+						if (!(first[i].first < first[i + 1].first)) {
+							sorted = 0;
+							return;
+						}
+				});
+				if (!sorted) throw "bulk_load needs sorted keys";
+				check_writable();
+				writeLatch lock(tree_latch);
+				post_splits();
+				int capacity = info.buffer_cap;
+				bool shadowed = info.shadow != 0;
+				reset_file();
+				if (n == 0) {
+					build_tree();
+					reserve_buffer(capacity);
+				} else {
+					info.eof = node_offset;
+					reserve_buffer(capacity);
+					load_levels(first, n, per_leaf, nthreads);
+				}
+				if (shadowed) shadow_start();
+				if (info.memtable_cap != 0) fill_filter();
 			}
 			/**
 			 * Returns the number of elements with key
@@ -1133,17 +4102,54 @@ namespace sjtu {
 			 * The default method of check the equivalence is !(a < b || b > a)
 			 */
 			size_t count(const KeyType& key) const {
-				return static_cast <size_t> (find(key) != cend());
+				ValueType value;
+				if (cache.lookup(key, &value)) return 1;
+				return static_cast <size_t> (find_value(key, &value));
 			}
 			ValueType at(const KeyType& key){
-				iterator it = find(key);
-				leafNode leaf;
-				if(it == end()) {
-					throw "not found";
-				}
-				readFile(&leaf, it.offset, 1, sizeof(leafNode));
-				return leaf.data[it.place].second;
+				ValueType value;
+				if (cache.lookup(key, &value)) return value;
+				if (!find_value(key, &value)) throw "not found";
+				return value;
+			}
+			/**
+			 * Hot-key cache in front of the tree, off by default.
+			 * set_cache(capacity) keeps at most capacity pairs in memory (0 turns it off),
+			 * at() and count() answer cached keys without reading any node.
+			 * only keys in the tree are cached, so insert() never makes it stale;
+			 * erase(), iterator::modify() and clear() keep it coherent.
+			 * it is striped by key (see hotCache); turned off, a lookup does not touch it at all.
+			 */
+			void set_cache(size_t capacity) {
+				writeLatch lock(tree_latch);      // an optimistic read admitting meanwhile sees the version move
+				cache.resize(capacity);
+			}
+			/**
+			 * Readahead of scans, 32 leaves by default.
+			 * iterators, fetch(), parallel_scan() and the views ask the kernel for the next leaves
+			 * before they get there once they have crossed a couple of leaves in a row; set_readahead(0)
+			 * turns it off.
+			 */
+			void set_readahead(int leaves) { readahead_leaves = leaves < 0 ? 0 : leaves; }
+			/**
+			 * Growth of the file, 1 MB at a time by default.
+			 * the file is allocated extent bytes at a time (fallocate), so it is not fragmented by one
+			 * split after another and the writes that extend the tree do not change the size of the file;
+			 * what is left after the tree is cut off when it is closed. set_extent(0) grows it a node at
+			 * a time. MmapStorage maps and MemoryStorage commits memory by the same extents; a tree in a
+			 * Database grows by its chunks instead.
+			 */
+			void set_extent(size_t bytes) {
+				writeLatch lock(tree_latch);
+				store.set_extent(bytes);
 			}
+			size_t cache_hits() const { return cache.hit_count(); }
+			size_t cache_misses() const { return cache.miss_count(); }
+			// blocks found in and missing from the own buffer pool of a file opened with O_DIRECT
+			size_t pool_hits() const { return store.block_pool() != nullptr ? store.block_pool() -> hit_count() : 0; }
+			size_t pool_misses() const { return store.block_pool() != nullptr ? store.block_pool() -> miss_count() : 0; }
+			// bytes of that pool on huge pages (with openOptions::huge_pages)
+			size_t pool_huge_bytes() const { return store.block_pool() != nullptr ? store.block_pool() -> huge_bytes() : 0; }
 			/**
 			 * Finds an element with key equivalent to key.
 			 * key value of the element to search for.
@@ -1152,23 +4158,270 @@ namespace sjtu {
 			 * returned.`
 			 */
 			iterator find(const KeyType& key) {
-				offset_t leaf_offset = locate_leaf(key, info.root);
-				if(leaf_offset == 0) return end();
-				leafNode leaf;
-				readFile(&leaf, leaf_offset, 1, sizeof(leafNode));
-				for (int i = 0; i < leaf.cnt; ++i)
-					if (leaf.data[i].first == key) return iterator(this, leaf_offset, i);
+				sync();
+				offset_t offset;
+				int place;
+				if (find_place(key, &offset, &place)) return iterator(this, offset, place);
 				return end();
 			}
 			const_iterator find(const KeyType& key) const {
-				offset_t leaf_offset = locate_leaf(key, info.root);
-				if(leaf_offset == 0) return cend();
-				leafNode leaf;
-				readFile(&leaf, leaf_offset, 1, sizeof(leafNode));
-				for (int i = 0; i < leaf.cnt; ++i)
-					if (leaf.data[i].first == key) return const_iterator(this, leaf_offset, i);
+				sync();
+				offset_t offset;
+				int place;
+				if (find_place(key, &offset, &place)) return const_iterator(this, offset, place);
 				return cend();
 			}
+			/**
+			 * Order statistic and aggregate, needs augment() once; the tree remembers it in the file.
+			 * augment(): count all the subtree sizes and aggregates, and keep them up to date from now on.
+			 * rank(key): the number of keys smaller than key.
+			 * select(k): iterator to the k-th smallest key (from 0), end() if k >= size().
+			 * count_range(lo, hi): the number of keys in [lo, hi).
+			 * aggregate(lo, hi): Aggregate of the values of the keys in [lo, hi), identity() if none.
+			 * each of them reads only one path of the tree (the range ones read two below the fork).
+			 */
+			void augment() {
+				check_writable();
+				writeLatch lock(tree_latch);
+				post_splits();
+				merge_memtable();
+				recount(info.root);
+				info.augmented = 1;
+				writeFile(&info, info_offset, 1, sizeof(basicInfo));
+			}
+			size_t rank(const KeyType &key) const {
+				if (!info.augmented) throw "order statistic needs augment()";
+				sync();
+				shared_latch lock(tree_latch.mutex);
+				return rank_node(key, info.root);
+			}
+			iterator select(size_t k) {
+				if (!info.augmented) throw "order statistic needs augment()";
+				sync();
+				{
+					shared_latch lock(tree_latch.mutex);
+					internalNode p;
+					offset_t offset = info.root;
+					while (k < info.size) {
+						readFile(&p, offset, 1, sizeof(internalNode));
+						int pos = 0;
+						for (; pos < p.cnt && k >= p.num[pos]; ++pos) k -= p.num[pos];
+						if (pos == p.cnt) throw "the subtree sizes do not add up to the size";
+						if (p.type == 1) return iterator(this, p.ch[pos], k);
+						offset = p.ch[pos];
+					}
+				}
+				return end();
+			}
+			size_t count_range(const KeyType &lo, const KeyType &hi) const {
+				if (!info.augmented) throw "order statistic needs augment()";
+				sync();
+				shared_latch lock(tree_latch.mutex);
+				if (!(lo < hi)) return 0;
+				internalNode p;
+				offset_t offset = info.root;
+				while (1) {
+					readFile(&p, offset, 1, sizeof(internalNode));
+					int l = 0, r = 0;
+					for (; l < p.cnt; ++l)
+						if (lo < p.key[l]) break;
+					for (; r < p.cnt; ++r)
+						if (hi < p.key[r]) break;
+					// lo is in ch[l - 1] and hi is in ch[r - 1], -1 means smaller than all keys.
+					if (r == 0) return 0;
+					if (l == r) {
+						if (p.type == 0) {
+							offset = p.ch[l - 1];
+							continue;
+						}
+						leafNode leaf;
+						readFile(&leaf, p.ch[l - 1], 1, sizeof(leafNode));
+						size_t ret = 0;
+						for (int i = 0; i < leaf.cnt; ++i)
+							if (!(leaf.data[i].first < lo) && leaf.data[i].first < hi) ++ret;
+						return ret;
+					}
+					size_t ret = 0;
+					for (int i = l; i < r - 1; ++i) ret += p.num[i];
+					if (p.type == 1) {
+						if (l > 0) ret += p.num[l - 1] - rank_leaf(lo, p.ch[l - 1]);
+						return ret + rank_leaf(hi, p.ch[r - 1]);
+					}
+					if (l > 0) ret += p.num[l - 1] - rank_node(lo, p.ch[l - 1]);
+					return ret + rank_node(hi, p.ch[r - 1]);
+				}
+			}
+			aggregate_type aggregate(const KeyType &lo, const KeyType &hi) const {
+				if (!info.augmented) throw "aggregate needs augment()";
+				sync();
+				shared_latch lock(tree_latch.mutex);
+				if (!(lo < hi)) return combine.identity();
+				internalNode p;
+				offset_t offset = info.root;
+				while (1) {
+					readFile(&p, offset, 1, sizeof(internalNode));
+					int l = 0, r = 0;
+					for (; l < p.cnt; ++l)
+						if (lo < p.key[l]) break;
+					for (; r < p.cnt; ++r)
+						if (hi < p.key[r]) break;
+					if (r == 0) return combine.identity();
+					if (l == r) {
+						if (p.type == 0) {
+							offset = p.ch[l - 1];
+							continue;
+						}
+						leafNode leaf;
+						readFile(&leaf, p.ch[l - 1], 1, sizeof(leafNode));
+						aggregate_type ret = combine.identity();
+						for (int i = 0; i < leaf.cnt; ++i)
+							if (!(leaf.data[i].first < lo) && leaf.data[i].first < hi)
+								ret = combine(ret, aggregate_type(leaf.data[i].second));
+						return ret;
+					}
+					aggregate_type ret = combine.identity();
+					if (l > 0) ret = p.type == 1 ? suffix_leaf(lo, p.ch[l - 1]) : suffix_node(lo, p.ch[l - 1]);
+					for (int i = l; i < r - 1; ++i) ret = combine(ret, p.agg[i]);
+					return combine(ret, p.type == 1 ? prefix_leaf(hi, p.ch[r - 1]) : prefix_node(hi, p.ch[r - 1]));
+				}
+			}
+			/**
+			 * Parallel scan: call visitor(key, value) for every key in [lo, hi), from nthreads threads.
+			 * the range is cut into about equal parts at child boundaries of the internal nodes, and each
+			 * thread walks its own segment of the leaf chain, in key order within the segment.
+			 * visitor is called concurrently, so it must be safe for that, and it must not write the tree.
+			 */
+			template <class Visitor>
+			void parallel_scan(const KeyType &lo, const KeyType &hi, int nthreads, Visitor visitor) const {
+				sync();
+				if (!(lo < hi)) return;
+				if (nthreads < 1) nthreads = 1;
+				shared_latch lock(tree_latch.mutex);
+				KeyType *bound = new KeyType[nthreads + 1];
+				int parts = scan_bounds(lo, hi, nthreads, bound);
+				parallel_for(parts, parts, [&](size_t a, size_t b) {
+					for (size_t g = a; g < b; ++g) scan_part(bound[g], bound[g + 1], visitor);
+				});
+				delete [] bound;
+			}
+			/**
+			 * Fetch: copy the next at most max pairs in key order into key[] and value[], return how many.
+			 * they start at the smallest key if from is nullptr, else at *from (after it if skip).
+			 * call it again from the last key with skip set to go on, like a cursor.
+			 */
+			int fetch(const KeyType *from, bool skip, KeyType *key, ValueType *value, int max) const {
+				sync();
+				shared_latch lock(tree_latch.mutex);
+				offset_t offset = from == nullptr ? 0 : locate_leaf(*from, info.root);
+				if (offset == 0) offset = info.head;
+				leafNode leaf;
+				readAhead ra;
+				int n = 0;
+				while (offset != 0 && n < max) {
+					{
+						shared_latch leaf_lock(node_latch[offset].mutex);
+						readFile(&leaf, offset, 1, sizeof(leafNode));
+					}
+					ahead(ra, leaf, 1);
+					for (int i = 0; i < leaf.cnt && n < max; ++i) {
+						if (from != nullptr && (leaf.data[i].first < *from || (skip && !(*from < leaf.data[i].first)))) continue;
+						key[n] = leaf.data[i].first, value[n] = leaf.data[i].second;
+						++n;
+					}
+					offset = leaf.nxt;
+				}
+				return n;
+			}
+#if __cpp_impl_coroutine
+			/**
+			 * Coroutines (C++20), for callers running an event loop on top of an ioService.
+			 * co_find(io, key, &value) is count() / at(): it gives whether key is there and sets value.
+			 * co_insert(io, key, value) is insert(): it reads the path to the leaf asynchronously first,
+			 * then does the insert synchronously. that only helps through the OS page cache, which the
+			 * insert then reads from; with O_DIRECT, in a Database or in memory there is no page cache
+			 * to warm (see co_locate()), and it is just insert().
+			 * co_scan(io, lo, hi, visitor) calls visitor(key, value) for the keys in [lo, hi) in order,
+			 * and gives how many there were; it reads leaf by leaf like an iterator. like every scan it
+			 * starts with sync(), which does not suspend: while the write buffer, the memtable or a
+			 * half split is waiting it takes the tree latch and merges them before the first read.
+			 * they suspend on every node read, so one thread keeps many of them in flight; the
+			 * blocking functions stay as they are, and sync_wait(io, t) runs one of these to the end.
+			 */
+			task <bool> co_find(ioService &io, KeyType key, ValueType *value) const {
+				if (cache.lookup(key, value)) co_return true;
+				for (int i = 0; i < RETRY && info.buffer_cap == 0 && info.memtable_cap == 0; ++i) {
+					leafNode leaf;
+					readVersion rv;
+					if (!co_await co_locate(io, key, &leaf, &rv)) continue;
+					if (rv.offset == 0) co_return false;
+					for (int j = 0; j < leaf.cnt; ++j)
+						if (leaf.data[j].first == key) {
+							*value = leaf.data[j].second;
+							cache.admit(key, *value);
+							if (!validate(rv)) cache.erase(key);
+							co_return true;
+						}
+					co_return false;
+				}
+				co_return find_value(key, value);
+			}
+			task <OperationResult> co_insert(ioService &io, KeyType key, ValueType value) {
+				if (info.buffer_cap == 0 && info.memtable_cap == 0) {
+					leafNode leaf;
+					readVersion rv;
+					co_await co_locate(io, key, &leaf, &rv);
+				}
+				co_return insert(key, value).second;
+			}
+			template <class Visitor>
+			task <size_t> co_scan(ioService &io, KeyType lo, KeyType hi, Visitor visitor) const {
+				sync();
+				size_t n = 0;
+				if (!(lo < hi)) co_return n;
+				leafNode leaf;
+				readVersion rv;
+				bool located = 0;
+				for (int i = 0; i < RETRY && !located; ++i) located = co_await co_locate(io, lo, &leaf, &rv);
+				offset_t offset;
+				if (!located) {
+					{
+						shared_latch lock(tree_latch.mutex);
+						offset = locate_leaf(lo, info.root);
+						if (offset == 0) offset = info.head;
+					}
+					read_leaf(&leaf, offset);
+				} else if (rv.offset == 0) {
+					offset = info.head;
+					co_await co_read_leaf(io, offset, &leaf);
+				}
+				readAhead ra;
+				while (1) {
+					ahead(ra, leaf, 1);
+					for (int i = 0; i < leaf.cnt; ++i) {
+						if (leaf.data[i].first < lo) continue;
+						if (!(leaf.data[i].first < hi)) co_return n;
+						visitor(leaf.data[i].first, leaf.data[i].second);
+						++n;
+					}
+					offset = leaf.nxt;
+					if (offset == 0) co_return n;
+					co_await co_read_leaf(io, offset, &leaf);
+				}
+			}
+#endif
+			/**
+			 * Snapshot: open a view of the pairs as they are now (the buffer and the memtable merged).
+			 * while views are open, the first write of a node in each snapshot epoch copies the old
+			 * node to datN.ver; a copy is freed as soon as no open view is older than it.
+			 * retained() is the number of nodes kept for the views.
+			 */
+			view snapshot() const {
+				writeLatch lock(tree_latch);
+				const_cast <BTree *> (this) -> post_splits();
+				const_cast <BTree *> (this) -> merge_memtable();
+				return view(this, versions.acquire(info.eof), info.root, info.head, info.size);
+			}
+			size_t retained() const { return versions.retained(); }
 			/**
 			 * this is a simple debug function for B Tree's ID number.
 			 * very simple, use it if necessary.
@@ -1180,6 +4433,7 @@ namespace sjtu {
 			 * it will present all the elements in B Tree with its value type.
 			 */
 			void debug_traverse() {
+				sync();
 				basicInfo infoo;
 				readFile(&infoo, info_offset, 1, sizeof(basicInfo));
 				offset_t cur = infoo.head;
@@ -1223,4 +4477,396 @@ namespace sjtu {
 				}
 			}
 	};
+
+	/**
+	 * Several independent trees, each key kept in exactly one of them (a shard).
+	 * a key goes to shard hash(key) % shards, or with range sharding to the shard i whose range
+	 * [split[i - 1], split[i]) holds it. every shard has its own file datN.dat (N from ID on),
+	 * its own latches and its own write buffer / memtable / cache, so writes to different shards
+	 * never meet; shard(i) gives a shard to set them up.
+	 * range(lo, hi) merges the shards back into one key order: each shard is read ahead a batch at
+	 * a time with fetch(), and the iterator always takes the smallest head of the shards.
+	 * insert, erase, upsert and the queries may be called from several threads at once.
+	 */
+	template <class KeyType, class ValueType, class Compare = std::less<KeyType>, class Hash = std::hash<KeyType> >
+	class ShardedBTree {
+		public:
+			typedef BTree <KeyType, ValueType, Compare> tree;
+
+		private:
+			static const int FETCH = 64;          // pairs read ahead from a shard by an iterator
+
+			tree **shard;
+			int cnt;
+			KeyType *split;       // cnt - 1 bounds with range sharding, nullptr with hash sharding
+			Hash hasher;
+
+			void open(int first_id) {
+				int saved = ID;
+				shard = new tree *[cnt];
+				for (int i = 0; i < cnt; ++i) {
+					ID = first_id + i;
+					shard[i] = new tree;
+				}
+				ID = saved;
+			}
+
+			/**
+			 * function: open the shards in the files path.0, path.1, ...
+			 */
+			void open(const char *path) {
+				shard = new tree *[cnt];
+				char *name = new char[strlen(path) + 16];
+				for (int i = 0; i < cnt; ++i) {
+					snprintf(name, strlen(path) + 16, "%s.%d", path, i);
+					shard[i] = new tree(name);
+				}
+				delete [] name;
+			}
+
+			void set_split(const KeyType *_split, int n) {
+				for (int i = 1; i < n; ++i)
+					if (!(_split[i - 1] < _split[i])) throw "range sharding needs sorted splits";
+				split = new KeyType[n + 1];
+				for (int i = 0; i < n; ++i) split[i] = _split[i];
+			}
+
+			int place(const KeyType &key) const {
+				if (split == nullptr) {
+					size_t h = hasher(key) * 0x9e3779b97f4a7c15ULL;
+					return static_cast <int> ((h >> 32) % static_cast <size_t> (cnt));
+				}
+				int l = 0, r = cnt - 1;       // the first bound bigger than key
+				while (l < r) {
+					int mid = (l + r) >> 1;
+					if (key < split[mid]) r = mid;
+					else l = mid + 1;
+				}
+				return l;
+			}
+
+		public:
+			/**
+			 * k-way merge of the shards over [lo, hi) (or all the keys), in key order.
+			 * it reads the shards as they are while it moves, so it sees some concurrent writes
+			 * and not others, like the iterators of BTree.
+			 */
+			class iterator {
+				friend class ShardedBTree;
+				private:
+					struct cursor {
+						KeyType key[FETCH];
+						ValueType value[FETCH];
+						int pos, n;
+						bool more;            // the shard may have pairs after the batch
+					};
+
+					const ShardedBTree *from;
+					cursor *cur;
+					KeyType hi;
+					bool bounded;
+					int top;              // shard with the smallest head, -1 at the end
+
+					void refill(int i, const KeyType *start, bool skip) {
+						cursor &c = cur[i];
+						c.n = from -> shard[i] -> fetch(start, skip, c.key, c.value, FETCH);
+						c.pos = 0;
+						c.more = c.n == FETCH;
+					}
+
+					void pick() {
+						top = -1;
+						for (int i = 0; i < from -> cnt; ++i) {
+							const cursor &c = cur[i];
+							if (c.pos == c.n) continue;
+							if (bounded && !(c.key[c.pos] < hi)) continue;
+							if (top == -1 || c.key[c.pos] < cur[top].key[cur[top].pos]) top = i;
+						}
+					}
+
+					iterator(const ShardedBTree *_from, const KeyType *lo, const KeyType *_hi) : from(_from), bounded(_hi != nullptr) {
+						if (bounded) hi = *_hi;
+						cur = new cursor[from -> cnt];
+						for (int i = 0; i < from -> cnt; ++i) refill(i, lo, 0);
+						pick();
+					}
+
+				public:
+					iterator(iterator &&other) : from(other.from), cur(other.cur), hi(other.hi), bounded(other.bounded), top(other.top) {
+						other.cur = nullptr;
+					}
+					iterator(const iterator &) = delete;
+					iterator &operator=(const iterator &) = delete;
+					~iterator() { delete [] cur; }
+
+					bool valid() const { return top != -1; }
+					const KeyType &getKey() const { return cur[top].key[cur[top].pos]; }
+					const ValueType &getValue() const { return cur[top].value[cur[top].pos]; }
+					iterator &operator++() {
+						cursor &c = cur[top];
+						if (++c.pos == c.n && c.more) {
+							KeyType last = c.key[c.n - 1];
+							refill(top, &last, 1);
+						}
+						pick();
+						return *this;
+					}
+			};
+
+			/**
+			 * hash sharding over shards trees, in the files of ID, ID + 1, ...
+			 */
+			explicit ShardedBTree(int shards) : cnt(shards), split(nullptr) {
+				if (cnt < 1) throw "no shard";
+				open(ID);
+			}
+			/**
+			 * range sharding over n + 1 trees, split[0 .. n) sorted: shard i holds [split[i - 1], split[i]).
+			 */
+			ShardedBTree(const KeyType *_split, int n) : cnt(n + 1), split(nullptr) {
+				set_split(_split, n);
+				open(ID);
+			}
+			/**
+			 * the same two, in the files path.0, path.1, ... instead.
+			 */
+			ShardedBTree(int shards, const char *path) : cnt(shards), split(nullptr) {
+				if (cnt < 1) throw "no shard";
+				open(path);
+			}
+			ShardedBTree(const KeyType *_split, int n, const char *path) : cnt(n + 1), split(nullptr) {
+				set_split(_split, n);
+				open(path);
+			}
+
+			ShardedBTree(const ShardedBTree &) = delete;
+			ShardedBTree &operator=(const ShardedBTree &) = delete;
+
+			~ShardedBTree() {
+				for (int i = 0; i < cnt; ++i) delete shard[i];
+				delete [] shard;
+				delete [] split;
+			}
+
+			int shards() const { return cnt; }
+			tree &shard_at(int i) { return *shard[i]; }
+			tree &shard_of(const KeyType &key) { return *shard[place(key)]; }
+
+			OperationResult insert(const KeyType &key, const ValueType &value) {
+				return shard[place(key)] -> insert(key, value).second;
+			}
+			OperationResult erase(const KeyType &key) { return shard[place(key)] -> erase(key); }
+			void upsert(const KeyType &key, const ValueType &value) { shard[place(key)] -> upsert(key, value); }
+			ValueType at(const KeyType &key) { return shard[place(key)] -> at(key); }
+			size_t count(const KeyType &key) const { return shard[place(key)] -> count(key); }
+			size_t size() const {
+				size_t ret = 0;
+				for (int i = 0; i < cnt; ++i) ret += shard[i] -> size();
+				return ret;
+			}
+			bool empty() const { return size() == 0; }
+			void clear() {
+				for (int i = 0; i < cnt; ++i) shard[i] -> clear();
+			}
+
+			iterator begin() const { return iterator(this, nullptr, nullptr); }
+			iterator range(const KeyType &lo, const KeyType &hi) const { return iterator(this, &lo, &hi); }
+
+			/**
+			 * call visitor(key, value) for the keys in [lo, hi), the shards scanned at the same time on
+			 * up to nthreads threads; the calls are in no particular order and may be concurrent.
+			 */
+			template <class Visitor>
+			void parallel_scan(const KeyType &lo, const KeyType &hi, int nthreads, Visitor visitor) const {
+				if (nthreads < 1) nthreads = 1;
+				int per = nthreads / cnt > 0 ? nthreads / cnt : 1;
+				parallel_for(nthreads < cnt ? nthreads : cnt, cnt, [&](size_t a, size_t b) {
+					for (size_t i = a; i < b; ++i) shard[i] -> parallel_scan(lo, hi, per, visitor);
+				});
+			}
+	};
+
+	/**
+	 * A tree that starts in memory and moves to a file when it gets big (spills).
+	 * it is a BTree on MemoryStorage while bytes() stays within budget; the write that takes it past
+	 * the budget (or spill()) reads the pairs out in key order with fetch() and bulk-loads them into
+	 * a BTree in the file path, opened with options (the mode is always CREATE), then switches to it.
+	 * the file is scratch: the contents of a spilled tree are kept there only until it is destroyed,
+	 * when the file is removed, or cleared, when it goes back to memory.
+	 * reads go on during the move, from the memory tree, and then switch to the file at once;
+	 * writes wait for the move, so nothing is lost or copied twice. the pairs are copied out in
+	 * one array, so a spill needs about as much memory again for a moment.
+	 * insert, erase, upsert and the queries may be called from several threads at once.
+	 */
+	template <class KeyType, class ValueType, class Compare = std::less<KeyType> >
+	class SpillBTree {
+		public:
+			typedef BTree <KeyType, ValueType, Compare, noAggregate, MemoryStorage> memory_tree;
+			typedef BTree <KeyType, ValueType, Compare> file_tree;
+			typedef pair <KeyType, ValueType> value_type;
+
+		private:
+			typedef std::shared_lock <std::shared_timed_mutex> shared_latch;
+			typedef std::unique_lock <std::shared_timed_mutex> unique_latch;
+
+			static const int FETCH = 256;         // pairs read out of the memory tree at a time
+
+			memory_tree *memory;
+			file_tree *disk;      // the one serving, the other is nullptr
+			char *path;
+			size_t budget;
+			openOptions options;
+			int load_threads;
+			mutable std::shared_timed_mutex state;        // readers share it, switching to the file holds it
+			std::shared_timed_mutex write_latch;          // writers share it, spilling holds it
+
+			bool over_budget() const { return disk == nullptr && memory -> bytes() > budget; }
+
+		public:
+			/**
+			 * a tree in memory that spills to the file path once its nodes take more than budget bytes.
+			 */
+			SpillBTree(const char *_path, size_t _budget, const openOptions &_options = openOptions())
+					: disk(nullptr), budget(_budget), options(_options), load_threads(1) {
+				options.mode = openOptions::CREATE;
+				path = new char[strlen(_path) + 1];
+				strcpy(path, _path);
+				memory = new memory_tree(path);
+			}
+
+			SpillBTree(const SpillBTree &) = delete;
+			SpillBTree &operator=(const SpillBTree &) = delete;
+
+			~SpillBTree() {
+				delete memory;
+				if (disk != nullptr) {
+					delete disk;
+					remove(path);
+				}
+				delete [] path;
+			}
+
+			/**
+			 * function: move the pairs to the file now, if they are not there yet.
+			 */
+			void spill() {
+				unique_latch lock(write_latch);
+				if (disk != nullptr) return;
+				size_t n = memory -> size();
+				value_type *data = new value_type[n];
+				KeyType *key = new KeyType[FETCH];
+				ValueType *value = new ValueType[FETCH];
+				size_t got = 0;
+				while (got < n) {
+					int k = memory -> fetch(got == 0 ? nullptr : &data[got - 1].first, got != 0, key, value, FETCH);
+					if (k == 0) break;
+					for (int i = 0; i < k && got < n; ++i, ++got) data[got].first = key[i], data[got].second = value[i];
+				}
+				delete [] key;
+				delete [] value;
+				file_tree *tree = nullptr;
+				try {
+					tree = new file_tree(path, options);
+					tree -> bulk_load(data, data + got, load_threads);
+				} catch (...) {
+					delete tree;
+					delete [] data;
+					throw;
+				}
+				delete [] data;
+				memory_tree *old;
+				{
+					unique_latch switch_lock(state);
+					disk = tree;
+					old = memory, memory = nullptr;
+				}
+				delete old;
+			}
+
+			bool spilled() const {
+				shared_latch lock(state);
+				return disk != nullptr;
+			}
+			size_t limit() const { return budget; }
+			// threads bulk_load() uses when the tree spills, 1 by default
+			void set_load_threads(int threads) { load_threads = threads < 1 ? 1 : threads; }
+
+			OperationResult insert(const KeyType &key, const ValueType &value) {
+				OperationResult ret;
+				bool over;
+				{
+					shared_latch lock(write_latch);
+					ret = disk != nullptr ? disk -> insert(key, value).second : memory -> insert(key, value).second;
+					over = over_budget();
+				}
+				if (over) spill();
+				return ret;
+			}
+			OperationResult erase(const KeyType &key) {
+				shared_latch lock(write_latch);
+				return disk != nullptr ? disk -> erase(key) : memory -> erase(key);
+			}
+			void upsert(const KeyType &key, const ValueType &value) {
+				bool over;
+				{
+					shared_latch lock(write_latch);
+					if (disk != nullptr) disk -> upsert(key, value);
+					else memory -> upsert(key, value);
+					over = over_budget();
+				}
+				if (over) spill();
+			}
+			/**
+			 * function: remove every pair; a spilled tree drops its file and starts in memory again.
+			 */
+			void clear() {
+				unique_latch lock(write_latch);
+				if (disk == nullptr) {
+					memory -> clear();
+					return;
+				}
+				memory_tree *tree = new memory_tree(path);
+				file_tree *old;
+				{
+					unique_latch switch_lock(state);
+					memory = tree;
+					old = disk, disk = nullptr;
+				}
+				delete old;
+				remove(path);
+			}
+
+			ValueType at(const KeyType &key) {
+				shared_latch lock(state);
+				return disk != nullptr ? disk -> at(key) : memory -> at(key);
+			}
+			size_t count(const KeyType &key) const {
+				shared_latch lock(state);
+				return disk != nullptr ? disk -> count(key) : memory -> count(key);
+			}
+			size_t size() const {
+				shared_latch lock(state);
+				return disk != nullptr ? disk -> size() : memory -> size();
+			}
+			bool empty() const { return size() == 0; }
+			// bytes the nodes take, in memory or in the file
+			size_t bytes() const {
+				shared_latch lock(state);
+				return disk != nullptr ? disk -> bytes() : memory -> bytes();
+			}
+			/**
+			 * the cursor of BTree::fetch(); a batch comes from the memory tree or from the file,
+			 * so a cursor goes on across a spill.
+			 */
+			int fetch(const KeyType *from, bool skip, KeyType *key, ValueType *value, int max) const {
+				shared_latch lock(state);
+				return disk != nullptr ? disk -> fetch(from, skip, key, value, max) : memory -> fetch(from, skip, key, value, max);
+			}
+			template <class Visitor>
+			void parallel_scan(const KeyType &lo, const KeyType &hi, int nthreads, Visitor visitor) const {
+				shared_latch lock(state);
+				if (disk != nullptr) disk -> parallel_scan(lo, hi, nthreads, visitor);
+				else memory -> parallel_scan(lo, hi, nthreads, visitor);
+			}
+	};
 }  // namespace sjtu
@@ -0,0 +1,51 @@
+#ifndef BPLUSTREE_AGGREGATE_H
+#define BPLUSTREE_AGGREGATE_H
+
+# include <limits>
+
+namespace sjtu {
+
+	/**
+	 * Aggregates for BTree<KeyType, ValueType, Compare, Aggregate>.
+	 * An aggregate is a monoid over the values of the tree:
+	 *    value_type: the type of the aggregated result, constructible from ValueType.
+	 *    identity(): the neutral element.
+	 *    operator()(a, b): an associative combination of a (smaller keys) and b (bigger keys).
+	 */
+
+	/**
+	 * the default: nothing is aggregated.
+	 */
+	struct noAggregate {
+		struct value_type {
+			value_type() {}
+			template <class T> value_type(const T &) {}
+		};
+		value_type identity() const { return value_type(); }
+		value_type operator()(const value_type &, const value_type &) const { return value_type(); }
+	};
+
+	template <class T>
+	struct sumAggregate {
+		typedef T value_type;
+		T identity() const { return T(); }
+		T operator()(const T &a, const T &b) const { return a + b; }
+	};
+
+	template <class T>
+	struct minAggregate {
+		typedef T value_type;
+		T identity() const { return std::numeric_limits<T>::max(); }
+		T operator()(const T &a, const T &b) const { return b < a ? b : a; }
+	};
+
+	template <class T>
+	struct maxAggregate {
+		typedef T value_type;
+		T identity() const { return std::numeric_limits<T>::lowest(); }
+		T operator()(const T &a, const T &b) const { return a < b ? b : a; }
+	};
+
+}  // namespace sjtu
+
+#endif //BPLUSTREE_AGGREGATE_H
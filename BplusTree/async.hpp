@@ -0,0 +1,257 @@
+#ifndef BPLUSTREE_ASYNC_H
+#define BPLUSTREE_ASYNC_H
+
+// the coroutine API needs C++20; with an older standard this header is empty.
+#if __cpp_impl_coroutine
+
+# include <coroutine>
+# include <condition_variable>
+# include <cstddef>
+# include <cstdint>
+# include <exception>
+# include <mutex>
+# include <thread>
+# include <sys/eventfd.h>
+# include <sys/types.h>
+# include <unistd.h>
+
+namespace sjtu {
+
+	/**
+	 * Asynchronous page reads for coroutines.
+	 * co_await io.read(fd, place, size, offset) suspends the coroutine and gives the read to one of
+	 * the I/O threads; once it is done the coroutine is queued, and the thread running the event loop
+	 * resumes it in poll() or run(). so one loop thread keeps many reads in flight and never waits
+	 * for one of them. notify_fd() is an eventfd that is readable while poll() has work, so the
+	 * service fits in an epoll loop.
+	 * the reads are done by a fixed pool of threads started with the service, 8 unless told
+	 * otherwise. a read keeps its thread until pread() returns, so at most that many are in the
+	 * kernel at once and the others wait in the queue; more coroutines in flight cost no threads.
+	 */
+	class ioService {
+		private:
+			struct request {
+				int fd;
+				void *place;
+				size_t size;
+				off_t offset;
+				ssize_t *ret;
+				std::coroutine_handle <> waiter;
+			};
+
+			request *queue;           // ring of the reads not started yet
+			size_t head, cnt, cap;
+			std::coroutine_handle <> *done;       // coroutines to resume
+			size_t done_cnt, done_cap;
+			size_t outstanding;       // reads submitted and not resumed yet
+			bool stop;
+			std::thread *worker;
+			int worker_cnt;
+			int event;
+			std::mutex latch;
+			std::condition_variable ready, finished;
+
+			void submit(const request &r) {
+				{
+					std::lock_guard <std::mutex> lock(latch);
+					if (cnt == cap) {
+						size_t new_cap = cap == 0 ? 64 : cap * 2;
+						request *tmp = new request[new_cap];
+						for (size_t i = 0; i < cnt; ++i) tmp[i] = queue[(head + i) % cap];
+						delete [] queue;
+						queue = tmp, head = 0, cap = new_cap;
+					}
+					queue[(head + cnt++) % cap] = r;
+					++outstanding;
+				}
+				ready.notify_one();
+			}
+
+			void work() {
+				std::unique_lock <std::mutex> lock(latch);
+				while (1) {
+					ready.wait(lock, [this] { return stop || cnt > 0; });
+					if (cnt == 0) return;
+					request r = queue[head];
+					head = (head + 1) % cap, --cnt;
+					lock.unlock();
+					*r.ret = pread(r.fd, r.place, r.size, r.offset);
+					lock.lock();
+					if (done_cnt == done_cap) {
+						done_cap = done_cap == 0 ? 64 : done_cap * 2;
+						std::coroutine_handle <> *tmp = new std::coroutine_handle <>[done_cap];
+						for (size_t i = 0; i < done_cnt; ++i) tmp[i] = done[i];
+						delete [] done;
+						done = tmp;
+					}
+					done[done_cnt++] = r.waiter;
+					// an eventfd only fails to count when it is full, and then it is readable anyway
+					uint64_t one = 1;
+					ssize_t ret = write(event, &one, sizeof(one));
+					(void) ret;
+					finished.notify_all();
+				}
+			}
+
+		public:
+			class readAwaiter {
+				friend class ioService;
+				private:
+					ioService *io;
+					request r;
+					ssize_t ret;
+
+				public:
+					bool await_ready() const noexcept { return false; }
+					void await_suspend(std::coroutine_handle <> h) {
+						r.ret = &ret, r.waiter = h;
+						io -> submit(r);
+					}
+					ssize_t await_resume() const noexcept { return ret; }
+			};
+
+			explicit ioService(int threads = 8) : queue(nullptr), head(0), cnt(0), cap(0), done(nullptr), done_cnt(0), done_cap(0),
+			                                      outstanding(0), stop(0), worker_cnt(threads < 1 ? 1 : threads) {
+				event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+				if (event < 0) throw "eventfd failed";
+				worker = new std::thread[worker_cnt];
+				for (int i = 0; i < worker_cnt; ++i) worker[i] = std::thread(&ioService::work, this);
+			}
+
+			ioService(const ioService &) = delete;
+			ioService &operator=(const ioService &) = delete;
+
+			~ioService() {
+				{
+					std::lock_guard <std::mutex> lock(latch);
+					stop = 1;
+				}
+				ready.notify_all();
+				for (int i = 0; i < worker_cnt; ++i) worker[i].join();
+				delete [] worker;
+				delete [] queue;
+				delete [] done;
+				close(event);
+			}
+
+			/**
+			 * function: co_await it to read size bytes at offset of fd into place; it gives what pread() returns.
+			 */
+			readAwaiter read(int fd, void *place, size_t size, off_t offset) {
+				readAwaiter a;
+				a.io = this;
+				a.r.fd = fd, a.r.place = place, a.r.size = size, a.r.offset = offset;
+				return a;
+			}
+
+			int notify_fd() const { return event; }
+
+			/**
+			 * function: resume the coroutines whose reads are done, without waiting; return how many.
+			 */
+			size_t poll() {
+				std::coroutine_handle <> *batch;
+				size_t n;
+				{
+					std::lock_guard <std::mutex> lock(latch);
+					// EAGAIN if nothing was signalled, the eventfd does not block
+					uint64_t count;
+					ssize_t ret = ::read(event, &count, sizeof(count));
+					(void) ret;
+					batch = done, n = done_cnt;
+					done = nullptr, done_cnt = done_cap = 0;
+					outstanding -= n;
+				}
+				for (size_t i = 0; i < n; ++i) batch[i].resume();
+				delete [] batch;
+				return n;
+			}
+
+			/**
+			 * function: resume coroutines until no read is left in flight.
+			 */
+			void run() {
+				while (1) {
+					{
+						std::unique_lock <std::mutex> lock(latch);
+						if (outstanding == 0) return;
+						finished.wait(lock, [this] { return done_cnt > 0; });
+					}
+					poll();
+				}
+			}
+	};
+
+	/**
+	 * A lazy coroutine giving a T: it starts when it is co_awaited (or by start()), and the
+	 * awaiting coroutine goes on when it finishes. an exception thrown inside is thrown again
+	 * by co_await or get().
+	 */
+	template <class T>
+	class task {
+		public:
+			struct promise_type {
+				T value;
+				std::exception_ptr error;
+				std::coroutine_handle <> continuation;
+
+				struct finalAwaiter {
+					bool await_ready() const noexcept { return false; }
+					std::coroutine_handle <> await_suspend(std::coroutine_handle <promise_type> h) noexcept {
+						std::coroutine_handle <> next = h.promise().continuation;
+						return next ? next : std::noop_coroutine();
+					}
+					void await_resume() const noexcept {}
+				};
+
+				task get_return_object() { return task(std::coroutine_handle <promise_type>::from_promise(*this)); }
+				std::suspend_always initial_suspend() const noexcept { return {}; }
+				finalAwaiter final_suspend() const noexcept { return {}; }
+				void return_value(const T &v) { value = v; }
+				void unhandled_exception() { error = std::current_exception(); }
+			};
+
+		private:
+			std::coroutine_handle <promise_type> h;
+
+			explicit task(std::coroutine_handle <promise_type> _h) : h(_h) {}
+
+		public:
+			task(task &&other) noexcept : h(other.h) { other.h = nullptr; }
+			task(const task &) = delete;
+			task &operator=(const task &) = delete;
+			~task() { if (h) h.destroy(); }
+
+			bool await_ready() const noexcept { return false; }
+			std::coroutine_handle <> await_suspend(std::coroutine_handle <> awaiting) noexcept {
+				h.promise().continuation = awaiting;
+				return h;
+			}
+			T await_resume() {
+				if (h.promise().error) std::rethrow_exception(h.promise().error);
+				return h.promise().value;
+			}
+
+			/**
+			 * function: run it from the top level, up to its first suspension.
+			 */
+			void start() { h.resume(); }
+			bool done() const { return h.done(); }
+			T get() { return await_resume(); }
+	};
+
+	/**
+	 * function: the synchronous way: run t to the end on the calling thread and return its result.
+	 */
+	template <class T>
+	T sync_wait(ioService &io, task <T> t) {
+		t.start();
+		while (!t.done()) io.run();
+		return t.get();
+	}
+
+}  // namespace sjtu
+
+#endif
+
+#endif //BPLUSTREE_ASYNC_H
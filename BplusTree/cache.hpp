@@ -0,0 +1,346 @@
+#ifndef BPLUSTREE_CACHE_H
+#define BPLUSTREE_CACHE_H
+
+# include <atomic>
+# include <cstddef>
+# include <cstdint>
+# include <functional>
+# include <mutex>
+
+namespace sjtu {
+
+	/**
+	 * One stripe of hotCache, a bounded key -> value cache under a latch of its own.
+	 * Eviction is CLOCK (one reference bit per entry), admission is TinyLFU:
+	 * a small count-min sketch estimates key frequencies, and a new key only
+	 * replaces the CLOCK victim if it has been seen more often than the victim.
+	 * So one-off keys of a scan do not flush the hot set out of the cache.
+	 * All the public functions may be called from several threads.
+	 */
+	template <class KeyType, class ValueType, class Hash = std::hash<KeyType> >
+	class cacheStripe {
+		private:
+			struct entry {
+				KeyType key;
+				ValueType value;
+				bool used;            // slot holds a valid entry
+				bool ref;             // CLOCK reference bit
+				entry() : key(), value(), used(0), ref(0) {}
+			};
+
+			static const int depth = 4;     // rows of the count-min sketch
+
+			entry *slot;          // capacity entries
+			size_t *index;        // hash index, slot number + 1, 0 means empty
+			uint8_t *sketch;      // depth * width saturating counters
+			size_t capacity, mask, width, hand, used_cnt;
+			size_t samples;       // increments since the sketch was last halved
+			size_t hits, misses;
+			Hash hasher;
+			mutable std::mutex latch;
+
+			inline size_t mix(size_t h, int row) const {
+				h ^= (h >> 33) + static_cast <size_t> (row) * 0x9e3779b97f4a7c15ULL;
+				h *= 0xff51afd7ed558ccdULL;
+				h ^= h >> 29;
+				return h;
+			}
+
+			/**
+			 * function: bump the estimated frequency of a key.
+			 * every 10 * capacity samples all counters are halved, so old popularity fades out.
+			 */
+			void record(size_t h) {
+				for (int i = 0; i < depth; ++i) {
+					uint8_t &c = sketch[i * width + (mix(h, i) & (width - 1))];
+					if (c < 15) ++c;
+				}
+				if (++samples >= 10 * capacity) {
+					for (size_t i = 0; i < depth * width; ++i) sketch[i] >>= 1;
+					samples = 0;
+				}
+			}
+
+			uint8_t frequency(size_t h) const {
+				uint8_t ret = 15;
+				for (int i = 0; i < depth; ++i) {
+					uint8_t c = sketch[i * width + (mix(h, i) & (width - 1))];
+					if (c < ret) ret = c;
+				}
+				return ret;
+			}
+
+			/**
+			 * function: find the index position of a key.
+			 * return the position holding it, or the empty position where it would go.
+			 */
+			size_t probe(const KeyType &key, size_t h) const {
+				size_t pos = h & mask;
+				while (index[pos] != 0 && !(slot[index[pos] - 1].key == key)) pos = (pos + 1) & mask;
+				return pos;
+			}
+
+			/**
+			 * function: remove the index position pos (linear probing, backward shift).
+			 */
+			void unlink(size_t pos) {
+				size_t nxt = (pos + 1) & mask;
+				while (index[nxt] != 0) {
+					size_t home = hasher(slot[index[nxt] - 1].key) & mask;
+					// move it back if its home is not in (pos, nxt]
+					if (((nxt - home) & mask) >= ((nxt - pos) & mask)) {
+						index[pos] = index[nxt];
+						pos = nxt;
+					}
+					nxt = (nxt + 1) & mask;
+				}
+				index[pos] = 0;
+			}
+
+			/**
+			 * function: run the CLOCK hand until it points to an entry without reference bit.
+			 */
+			size_t victim() {
+				while (slot[hand].used && slot[hand].ref) {
+					slot[hand].ref = 0;
+					hand = (hand + 1) % capacity;
+				}
+				return hand;
+			}
+
+			void release() {
+				delete [] slot;
+				delete [] index;
+				delete [] sketch;
+				slot = nullptr, index = nullptr, sketch = nullptr;
+			}
+
+			void reset(size_t _capacity) {
+				release();
+				capacity = _capacity;
+				hand = used_cnt = samples = hits = misses = 0;
+				if (capacity == 0) return;
+				size_t len = 1;
+				while (len < capacity * 2) len <<= 1;
+				mask = len - 1;
+				width = len;
+				slot = new entry[capacity];
+				index = new size_t[len]();
+				sketch = new uint8_t[depth * width]();
+			}
+
+		public:
+			cacheStripe() : slot(nullptr), index(nullptr), sketch(nullptr), capacity(0), mask(0), width(0),
+			                hand(0), used_cnt(0), samples(0), hits(0), misses(0) {}
+
+			cacheStripe(const cacheStripe &) = delete;
+			cacheStripe &operator=(const cacheStripe &) = delete;
+
+			~cacheStripe() { release(); }
+
+			/**
+			 * function: set the number of entries the cache may hold, 0 turns it off.
+			 * all cached entries and counters are dropped.
+			 */
+			void resize(size_t _capacity) {
+				std::lock_guard <std::mutex> lock(latch);
+				reset(_capacity);
+			}
+
+			/**
+			 * function: look up a key, counting a hit or a miss.
+			 * return true and put the value in *value if cached.
+			 */
+			bool lookup(const KeyType &key, ValueType *value) {
+				std::lock_guard <std::mutex> lock(latch);
+				if (capacity == 0) return false;
+				size_t h = hasher(key);
+				record(h);
+				size_t pos = probe(key, h);
+				if (index[pos] == 0) {
+					++misses;
+					return false;
+				}
+				entry &e = slot[index[pos] - 1];
+				e.ref = 1;
+				*value = e.value;
+				++hits;
+				return true;
+			}
+
+			/**
+			 * function: offer a key just read from the tree to the cache.
+			 * it is taken if there is a free entry or it is more frequent than the CLOCK victim.
+			 */
+			void admit(const KeyType &key, const ValueType &value) {
+				std::lock_guard <std::mutex> lock(latch);
+				if (capacity == 0) return;
+				size_t h = hasher(key);
+				size_t pos = probe(key, h);
+				if (index[pos] != 0) {
+					slot[index[pos] - 1].value = value;
+					return;
+				}
+				size_t id;
+				if (used_cnt < capacity) {
+					id = used_cnt++;
+				} else {
+					id = victim();
+					if (frequency(h) <= frequency(hasher(slot[id].key))) {
+						hand = (hand + 1) % capacity;
+						return;
+					}
+					unlink(probe(slot[id].key, hasher(slot[id].key)));
+					pos = probe(key, h);
+					hand = (hand + 1) % capacity;
+				}
+				slot[id].key = key;
+				slot[id].value = value;
+				slot[id].used = 1;
+				slot[id].ref = 0;
+				index[pos] = id + 1;
+			}
+
+			/**
+			 * function: change the value of a key if it is cached.
+			 */
+			void update(const KeyType &key, const ValueType &value) {
+				std::lock_guard <std::mutex> lock(latch);
+				if (capacity == 0) return;
+				size_t pos = probe(key, hasher(key));
+				if (index[pos] != 0) slot[index[pos] - 1].value = value;
+			}
+
+			/**
+			 * function: drop a key from the cache if it is cached.
+			 * the entry is refilled by the next admit() through the CLOCK hand.
+			 */
+			void erase(const KeyType &key) {
+				std::lock_guard <std::mutex> lock(latch);
+				if (capacity == 0) return;
+				size_t pos = probe(key, hasher(key));
+				if (index[pos] == 0) return;
+				entry &e = slot[index[pos] - 1];
+				e.used = 0, e.ref = 0;
+				unlink(pos);
+				// move the last entry into the hole, so that [0, used_cnt) stay valid.
+				size_t id = &e - slot, last = used_cnt - 1;
+				if (id != last) {
+					size_t lpos = probe(slot[last].key, hasher(slot[last].key));
+					e = slot[last];
+					index[lpos] = id + 1;
+					slot[last].used = 0, slot[last].ref = 0;
+				}
+				--used_cnt;
+			}
+
+			void clear() {
+				std::lock_guard <std::mutex> lock(latch);
+				reset(capacity);
+			}
+
+			size_t hit_count() const {
+				std::lock_guard <std::mutex> lock(latch);
+				return hits;
+			}
+			size_t miss_count() const {
+				std::lock_guard <std::mutex> lock(latch);
+				return misses;
+			}
+	};
+
+	/**
+	 * A bounded key -> value cache placed in front of the B plus tree: STRIPES cacheStripes, a key
+	 * going to the one its hash picks, so threads looking up different keys seldom meet on a latch.
+	 * the capacity is shared out among the stripes (fewer of them for a tiny cache). while it is
+	 * off, the default, every call returns before it takes any latch.
+	 * All the public functions may be called from several threads.
+	 */
+	template <class KeyType, class ValueType, class Hash = std::hash<KeyType> >
+	class hotCache {
+		private:
+			static const size_t STRIPES = 16;
+
+			cacheStripe <KeyType, ValueType, Hash> stripe[STRIPES];
+			std::atomic <size_t> active;          // stripes in use, 0 when the cache is off
+			Hash hasher;
+			std::mutex resize_latch;
+
+			cacheStripe <KeyType, ValueType, Hash> *pick(const KeyType &key, size_t n) {
+				size_t h = hasher(key) * 0x9e3779b97f4a7c15ULL;
+				return &stripe[(h >> 32) % n];
+			}
+
+		public:
+			hotCache() : active(0) {}
+
+			hotCache(const hotCache &) = delete;
+			hotCache &operator=(const hotCache &) = delete;
+
+			/**
+			 * function: set the number of entries the cache may hold, 0 turns it off.
+			 * all cached entries and counters are dropped.
+			 */
+			void resize(size_t capacity) {
+				std::lock_guard <std::mutex> lock(resize_latch);
+				size_t n = capacity < STRIPES ? capacity : STRIPES;
+				active.store(0);
+				for (size_t i = 0; i < STRIPES; ++i) stripe[i].resize(i < n ? capacity / n + (i < capacity % n) : 0);
+				active.store(n);
+			}
+
+			bool enabled() const { return active.load(std::memory_order_relaxed) != 0; }
+
+			/**
+			 * function: look up a key, counting a hit or a miss.
+			 * return true and put the value in *value if cached.
+			 */
+			bool lookup(const KeyType &key, ValueType *value) {
+				size_t n = active.load(std::memory_order_relaxed);
+				return n != 0 && pick(key, n) -> lookup(key, value);
+			}
+
+			/**
+			 * function: offer a key just read from the tree to the cache.
+			 */
+			void admit(const KeyType &key, const ValueType &value) {
+				size_t n = active.load(std::memory_order_relaxed);
+				if (n != 0) pick(key, n) -> admit(key, value);
+			}
+
+			/**
+			 * function: change the value of a key if it is cached.
+			 */
+			void update(const KeyType &key, const ValueType &value) {
+				size_t n = active.load(std::memory_order_relaxed);
+				if (n != 0) pick(key, n) -> update(key, value);
+			}
+
+			/**
+			 * function: drop a key from the cache if it is cached.
+			 */
+			void erase(const KeyType &key) {
+				size_t n = active.load(std::memory_order_relaxed);
+				if (n != 0) pick(key, n) -> erase(key);
+			}
+
+			void clear() {
+				if (active.load(std::memory_order_relaxed) == 0) return;
+				for (size_t i = 0; i < STRIPES; ++i) stripe[i].clear();
+			}
+
+			size_t hit_count() const {
+				size_t ret = 0;
+				for (size_t i = 0; i < STRIPES; ++i) ret += stripe[i].hit_count();
+				return ret;
+			}
+			size_t miss_count() const {
+				size_t ret = 0;
+				for (size_t i = 0; i < STRIPES; ++i) ret += stripe[i].miss_count();
+				return ret;
+			}
+	};
+
+}  // namespace sjtu
+
+#endif //BPLUSTREE_CACHE_H
@@ -0,0 +1,391 @@
+#ifndef BPLUSTREE_DATABASE_H
+#define BPLUSTREE_DATABASE_H
+
+# include <cstddef>
+# include <cstdint>
+# include <cstring>
+# include <fcntl.h>
+# include <mutex>
+# include <shared_mutex>
+# include <sys/types.h>
+# include <unistd.h>
+# include "io.hpp"
+# include "pool.hpp"
+# include "shadow.hpp"
+
+namespace sjtu {
+
+	/**
+	 * Many named B plus trees in one file.
+	 * the file is cut into chunks of CHUNK bytes. every tree (a segment) sees offsets from 0 on as
+	 * if it had a file of its own, and its chunk map says which chunk of the file holds each CHUNK
+	 * bytes of them; a chunk is taken on the first write there, from the free list first (chunks of
+	 * cleared or dropped trees, once a catalog without them is saved), else at the end of the file.
+	 * chunk 0 is the header; it points to the catalog, the names and chunk maps of all the trees,
+	 * which sync() writes to fresh chunks before it switches the header to it, so a crash leaves the
+	 * catalog of the last sync(). the free list is not kept: opening finds it again as the chunks
+	 * nobody uses.
+	 * all the trees read and write through one blockPool, whose size is the memory budget of the
+	 * whole database, and share its one file descriptor.
+	 * a tree is opened with BTree(database, name); at most one BTree may have a name open at a time.
+	 */
+	class Database {
+		public:
+			static const size_t CHUNK = 64 << 10;
+			static const int NAME = 64;           // longest name, with its '\0'
+
+			struct segment {
+				char name[NAME];
+				size_t *chunk;        // chunk of the file for each CHUNK bytes, 0 if none yet
+				size_t cnt, cap;
+				bool open;
+				mutable std::shared_timed_mutex latch;
+				segment() : chunk(nullptr), cnt(0), cap(0), open(0) { name[0] = 0; }
+				~segment() { delete [] chunk; }
+			};
+
+		private:
+			struct header {
+				uint64_t magic;
+				size_t chunk_size;
+				size_t total;         // chunks in the file
+				size_t catalog;       // first chunk of the catalog
+				size_t catalog_size;  // bytes of the catalog
+				uint64_t check;
+			};
+
+			static const uint64_t MAGIC = 0x4244455254425053ULL;
+
+			char *name;
+			int fd;
+			blockPool pool;
+			segment **seg;
+			int seg_cnt, seg_cap;
+			size_t total;
+			size_t catalog, catalog_chunks;
+			size_t *free_chunk;
+			size_t free_cnt, free_cap;
+			size_t *freed;        // chunks let go since the last save(), the catalog on disk may still map them
+			size_t freed_cnt, freed_cap;
+			std::mutex latch;     // the segments, the free lists and the catalog
+
+			static void push(size_t *&arr, size_t &cnt, size_t &cap, size_t c) {
+				if (cnt == cap) {
+					cap = cap == 0 ? 64 : cap * 2;
+					size_t *tmp = new size_t[cap];
+					for (size_t i = 0; i < cnt; ++i) tmp[i] = arr[i];
+					delete [] arr;
+					arr = tmp;
+				}
+				arr[cnt++] = c;
+			}
+
+			void give(size_t c) { push(free_chunk, free_cnt, free_cap, c); }
+
+			/**
+			 * function: free a chunk a tree no longer uses; it is only taken again after the next save(),
+			 * so until a crash-safe catalog without it is written, nobody overwrites what the last one maps.
+			 */
+			void release(size_t c) { push(freed, freed_cnt, freed_cap, c); }
+
+			size_t take() {
+				std::lock_guard <std::mutex> lock(latch);
+				if (free_cnt > 0) return free_chunk[--free_cnt];
+				return total++;
+			}
+
+			segment *find(const char *_name) const {
+				for (int i = 0; i < seg_cnt; ++i)
+					if (strcmp(seg[i] -> name, _name) == 0) return seg[i];
+				return nullptr;
+			}
+
+			segment *add(const char *_name) {
+				if (seg_cnt == seg_cap) {
+					seg_cap = seg_cap == 0 ? 16 : seg_cap * 2;
+					segment **tmp = new segment *[seg_cap];
+					for (int i = 0; i < seg_cnt; ++i) tmp[i] = seg[i];
+					delete [] seg;
+					seg = tmp;
+				}
+				segment *s = new segment;
+				strcpy(s -> name, _name);
+				seg[seg_cnt++] = s;
+				return s;
+			}
+
+			/**
+			 * function: the file offset of byte offset of s, taking a chunk for it if write is set.
+			 * return -1 if it has no chunk (and write is not set).
+			 */
+			off_t where(segment *s, off_t offset, bool write) {
+				size_t c = offset / CHUNK;
+				{
+					std::shared_lock <std::shared_timed_mutex> lock(s -> latch);
+					if (c < s -> cnt && s -> chunk[c] != 0) return s -> chunk[c] * CHUNK + offset % CHUNK;
+				}
+				if (!write) return -1;
+				size_t fresh = take();
+				size_t got;
+				{
+					std::lock_guard <std::shared_timed_mutex> lock(s -> latch);
+					if (c >= s -> cap) {
+						size_t cap = s -> cap == 0 ? 16 : s -> cap;
+						while (cap <= c) cap <<= 1;
+						size_t *tmp = new size_t[cap]();
+						for (size_t i = 0; i < s -> cnt; ++i) tmp[i] = s -> chunk[i];
+						delete [] s -> chunk;
+						s -> chunk = tmp, s -> cap = cap;
+					}
+					if (c >= s -> cnt) s -> cnt = c + 1;
+					if (s -> chunk[c] == 0) s -> chunk[c] = fresh, fresh = 0;
+					got = s -> chunk[c];
+				}
+				if (fresh != 0) {     // someone else took one first
+					std::lock_guard <std::mutex> lock(latch);
+					give(fresh);
+				}
+				return got * CHUNK + offset % CHUNK;
+			}
+
+			/**
+			 * function: write the catalog to fresh chunks, then the header pointing to it.
+			 */
+			void save() {
+				// the trees may grow meanwhile; a chunk taken after its map is counted waits for the next save.
+				size_t *counted = new size_t[seg_cnt + 1];
+				size_t size = sizeof(int);
+				for (int i = 0; i < seg_cnt; ++i) {
+					std::shared_lock <std::shared_timed_mutex> lock(seg[i] -> latch);
+					counted[i] = seg[i] -> cnt;
+					size += NAME + sizeof(size_t) + counted[i] * sizeof(size_t);
+				}
+				char *blob = new char[size];
+				char *p = blob;
+				memcpy(p, &seg_cnt, sizeof(int)), p += sizeof(int);
+				for (int i = 0; i < seg_cnt; ++i) {
+					std::shared_lock <std::shared_timed_mutex> lock(seg[i] -> latch);
+					if (seg[i] -> cnt < counted[i]) counted[i] = seg[i] -> cnt;      // truncated meanwhile
+					memcpy(p, seg[i] -> name, NAME), p += NAME;
+					memcpy(p, &counted[i], sizeof(size_t)), p += sizeof(size_t);
+					memcpy(p, seg[i] -> chunk, counted[i] * sizeof(size_t)), p += counted[i] * sizeof(size_t);
+				}
+				delete [] counted;
+				size = p - blob;
+				size_t old = catalog, old_chunks = catalog_chunks;
+				catalog = total, catalog_chunks = (size + CHUNK - 1) / CHUNK;
+				total += catalog_chunks;
+				pool.write(blob, size, static_cast <off_t> (catalog * CHUNK));
+				delete [] blob;
+				fdatasync(fd);
+				header h;
+				h.magic = MAGIC, h.chunk_size = CHUNK, h.total = total;
+				h.catalog = catalog, h.catalog_size = size;
+				h.check = checksum(&h, offsetof(header, check));
+				pool.write(&h, sizeof(header), 0);
+				fdatasync(fd);
+				for (size_t i = 0; i < old_chunks; ++i) give(old + i);
+				for (size_t i = 0; i < freed_cnt; ++i) give(freed[i]);
+				freed_cnt = 0;
+			}
+
+			void load() {
+				header h;
+				if (pread(fd, &h, sizeof(header), 0) != sizeof(header) || h.magic != MAGIC ||
+				    h.check != checksum(&h, offsetof(header, check)) || h.chunk_size != CHUNK) throw "not a database file";
+				total = h.total;
+				catalog = h.catalog, catalog_chunks = (h.catalog_size + CHUNK - 1) / CHUNK;
+				char *blob = new char[h.catalog_size];
+				try {
+					read_at(fd, blob, h.catalog_size, static_cast <off_t> (catalog * CHUNK));
+				} catch (...) {
+					delete [] blob;
+					throw;
+				}
+				const char *p = blob;
+				int n;
+				memcpy(&n, p, sizeof(int)), p += sizeof(int);
+				bool *used = new bool[total]();
+				used[0] = 1;
+				for (size_t i = 0; i < catalog_chunks; ++i) used[catalog + i] = 1;
+				for (int i = 0; i < n; ++i) {
+					segment *s = add(p);
+					p += NAME;
+					memcpy(&s -> cnt, p, sizeof(size_t)), p += sizeof(size_t);
+					s -> cap = s -> cnt;
+					s -> chunk = new size_t[s -> cap];
+					memcpy(s -> chunk, p, s -> cnt * sizeof(size_t)), p += s -> cnt * sizeof(size_t);
+					for (size_t j = 0; j < s -> cnt; ++j) used[s -> chunk[j]] = 1;
+				}
+				for (size_t c = total; c-- > 1; )
+					if (!used[c]) give(c);
+				delete [] used;
+				delete [] blob;
+			}
+
+		public:
+			/**
+			 * open the database in the file path, or create it; budget is the size of the buffer pool,
+			 * whose frames are put on huge pages with huge_pages (see blockPool), if the system has them.
+			 */
+			explicit Database(const char *path, size_t budget = 64 << 20, bool huge_pages = 0) : seg(nullptr), seg_cnt(0), seg_cap(0), total(1),
+			                                                             catalog(0), catalog_chunks(0),
+			                                                             free_chunk(nullptr), free_cnt(0), free_cap(0),
+			                                                             freed(nullptr), freed_cnt(0), freed_cap(0) {
+				name = new char[strlen(path) + 1];
+				strcpy(name, path);
+				fd = open(path, O_RDWR | O_CREAT, 0644);
+				if (fd < 0) {
+					delete [] name;
+					throw "open database failed";
+				}
+				pool.reset(fd, budget, 0, huge_pages);
+				off_t end = lseek(fd, 0, SEEK_END);
+				if (end == 0) save();
+				else load();
+			}
+
+			Database(const Database &) = delete;
+			Database &operator=(const Database &) = delete;
+
+			~Database() {
+				save();
+				for (int i = 0; i < seg_cnt; ++i) delete seg[i];
+				delete [] seg;
+				delete [] free_chunk;
+				delete [] freed;
+				close(fd);
+				delete [] name;
+			}
+
+			const char *path() const { return name; }
+
+			/**
+			 * function: the segment of the tree _name, made if there is none; a BTree calls it.
+			 */
+			segment *attach(const char *_name) {
+				if (strlen(_name) >= static_cast <size_t> (NAME)) throw "tree name too long";
+				std::lock_guard <std::mutex> lock(latch);
+				segment *s = find(_name);
+				if (s == nullptr) s = add(_name);
+				if (s -> open) throw "the tree is open already";
+				s -> open = 1;
+				return s;
+			}
+
+			void detach(segment *s) {
+				std::lock_guard <std::mutex> lock(latch);
+				s -> open = 0;
+				save();
+			}
+
+			/**
+			 * function: remove the tree _name and free its chunks; return false if there is none.
+			 */
+			bool drop(const char *_name) {
+				std::lock_guard <std::mutex> lock(latch);
+				int i = 0;
+				for (; i < seg_cnt; ++i)
+					if (strcmp(seg[i] -> name, _name) == 0) break;
+				if (i == seg_cnt) return false;
+				if (seg[i] -> open) throw "the tree is open";
+				for (size_t j = 0; j < seg[i] -> cnt; ++j)
+					if (seg[i] -> chunk[j] != 0) release(seg[i] -> chunk[j]);
+				delete seg[i];
+				seg[i] = seg[--seg_cnt];
+				save();
+				return true;
+			}
+
+			/**
+			 * function: free every chunk of s, it reads as empty again; the chunks are reused after the next save().
+			 */
+			void truncate(segment *s) {
+				std::lock_guard <std::mutex> lock(latch);
+				std::lock_guard <std::shared_timed_mutex> seg_lock(s -> latch);
+				for (size_t j = 0; j < s -> cnt; ++j)
+					if (s -> chunk[j] != 0) release(s -> chunk[j]), s -> chunk[j] = 0;
+				s -> cnt = 0;
+			}
+
+			/**
+			 * function: give a the chunks of b and b those of a; a tree swaps in a rewritten segment so.
+			 */
+			void exchange(segment *a, segment *b) {
+				std::lock_guard <std::mutex> lock(latch);
+				{
+					std::lock_guard <std::shared_timed_mutex> a_lock(a -> latch);
+					std::lock_guard <std::shared_timed_mutex> b_lock(b -> latch);
+					size_t *chunk = a -> chunk, cnt = a -> cnt, cap = a -> cap;
+					a -> chunk = b -> chunk, a -> cnt = b -> cnt, a -> cap = b -> cap;
+					b -> chunk = chunk, b -> cnt = cnt, b -> cap = cap;
+				}
+				save();
+			}
+
+			bool empty(segment *s) const {
+				std::shared_lock <std::shared_timed_mutex> lock(s -> latch);
+				return s -> cnt == 0 || s -> chunk[0] == 0;
+			}
+
+			/**
+			 * function: read size bytes at offset of s; what was never written reads as zeros.
+			 */
+			void read(segment *s, void *place, size_t size, off_t offset) {
+				char *out = static_cast <char *> (place);
+				while (size > 0) {
+					size_t len = CHUNK - offset % CHUNK < size ? CHUNK - offset % CHUNK : size;
+					off_t at = where(s, offset, 0);
+					if (at < 0) memset(out, 0, len);
+					else pool.read(out, len, at);
+					out += len, offset += len, size -= len;
+				}
+			}
+
+			void write(segment *s, const void *place, size_t size, off_t offset) {
+				const char *in = static_cast <const char *> (place);
+				while (size > 0) {
+					size_t len = CHUNK - offset % CHUNK < size ? CHUNK - offset % CHUNK : size;
+					pool.write(in, len, where(s, offset, 1));
+					in += len, offset += len, size -= len;
+				}
+			}
+
+			/**
+			 * function: tell the kernel the bytes [offset, offset + size) of s are read soon.
+			 */
+			void advise(segment *s, off_t offset, size_t size) {
+				while (size > 0) {
+					size_t len = CHUNK - offset % CHUNK < size ? CHUNK - offset % CHUNK : size;
+					off_t at = where(s, offset, 0);
+					if (at >= 0) posix_fadvise(fd, at, len, POSIX_FADV_WILLNEED);
+					offset += len, size -= len;
+				}
+			}
+
+			/**
+			 * function: make everything written so far durable, the catalog included.
+			 */
+			void sync() {
+				std::lock_guard <std::mutex> lock(latch);
+				save();
+			}
+
+			int trees() {
+				std::lock_guard <std::mutex> lock(latch);
+				return seg_cnt;
+			}
+			size_t chunks() {
+				std::lock_guard <std::mutex> lock(latch);
+				return total - free_cnt;
+			}
+			size_t budget() const { return pool.capacity(); }
+			size_t hits() const { return pool.hit_count(); }
+			size_t misses() const { return pool.miss_count(); }
+			blockPool::pageKind backing() const { return pool.backing(); }
+			size_t huge_bytes() const { return pool.huge_bytes(); }
+	};
+
+}  // namespace sjtu
+
+#endif //BPLUSTREE_DATABASE_H
@@ -0,0 +1,82 @@
+#ifndef BPLUSTREE_FILTER_H
+#define BPLUSTREE_FILTER_H
+
+# include <atomic>
+# include <cstddef>
+# include <cstdint>
+# include <functional>
+
+namespace sjtu {
+
+	/**
+	 * A Bloom filter over keys, used by BTree to tell that a key is surely not in the tree
+	 * without reading a leaf. may_contain() is never false for a key that was add()ed; it is
+	 * true for a key that was not with a probability of about 1% while no more than the expected
+	 * number of keys were added, more after that (full() says when to build it again).
+	 * add() and may_contain() may be called from several threads at once; reset() may not.
+	 */
+	template <class KeyType, class Hash = std::hash<KeyType> >
+	class keyFilter {
+		private:
+			static const int PROBES = 7;
+			static const int BITS_PER_KEY = 10;
+
+			std::atomic <uint64_t> *word;
+			size_t mask;          // bits - 1, bits a power of 2
+			size_t expected;
+			std::atomic <size_t> added;
+			Hash hasher;
+
+			static inline size_t mix(size_t h) {
+				h ^= h >> 33;
+				h *= 0xff51afd7ed558ccdULL;
+				h ^= h >> 33;
+				h *= 0xc4ceb9fe1a85ec53ULL;
+				h ^= h >> 33;
+				return h;
+			}
+
+		public:
+			keyFilter() : word(nullptr), mask(0), expected(0), added(0) {}
+
+			keyFilter(const keyFilter &) = delete;
+			keyFilter &operator=(const keyFilter &) = delete;
+
+			~keyFilter() { delete [] word; }
+
+			/**
+			 * function: forget every key and make room for keys keys (0: drop the filter).
+			 */
+			void reset(size_t keys) {
+				delete [] word;
+				word = nullptr;
+				mask = 0, expected = keys, added = 0;
+				if (keys == 0) return;
+				size_t bits = 512;
+				while (bits < keys * BITS_PER_KEY) bits <<= 1;
+				word = new std::atomic <uint64_t>[bits / 64];
+				for (size_t i = 0; i < bits / 64; ++i) word[i].store(0, std::memory_order_relaxed);
+				mask = bits - 1;
+			}
+
+			bool ready() const { return word != nullptr; }
+			bool full() const { return added.load(std::memory_order_relaxed) > expected; }
+
+			void add(const KeyType &key) {
+				size_t h = mix(hasher(key)), step = (h >> 32) | 1;
+				for (int i = 0; i < PROBES; ++i, h += step)
+					word[(h & mask) >> 6].fetch_or(uint64_t(1) << (h & 63), std::memory_order_relaxed);
+				added.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			bool may_contain(const KeyType &key) const {
+				size_t h = mix(hasher(key)), step = (h >> 32) | 1;
+				for (int i = 0; i < PROBES; ++i, h += step)
+					if (!(word[(h & mask) >> 6].load(std::memory_order_relaxed) >> (h & 63) & 1)) return false;
+				return true;
+			}
+	};
+
+}  // namespace sjtu
+
+#endif //BPLUSTREE_FILTER_H
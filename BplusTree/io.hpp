@@ -0,0 +1,45 @@
+#ifndef BPLUSTREE_IO_H
+#define BPLUSTREE_IO_H
+
+# include <cerrno>
+# include <cstddef>
+# include <cstring>
+# include <sys/types.h>
+# include <unistd.h>
+
+namespace sjtu {
+
+	/**
+	 * function: read size bytes at offset of fd into place, all of them (pread() may give fewer).
+	 * what is past the end of the file reads as zeros; throws if the read fails.
+	 */
+	inline void read_at(int fd, void *place, size_t size, off_t offset) {
+		char *p = static_cast <char *> (place);
+		while (size > 0) {
+			ssize_t n = pread(fd, p, size, offset);
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0) throw "read failed";
+			if (n == 0) {
+				memset(p, 0, size);
+				return;
+			}
+			p += n, offset += n, size -= n;
+		}
+	}
+
+	/**
+	 * function: write size bytes from place at offset of fd, all of them; throws if the write fails.
+	 */
+	inline void write_at(int fd, const void *place, size_t size, off_t offset) {
+		const char *p = static_cast <const char *> (place);
+		while (size > 0) {
+			ssize_t n = pwrite(fd, p, size, offset);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) throw "write failed";
+			p += n, offset += n, size -= n;
+		}
+	}
+
+}  // namespace sjtu
+
+#endif //BPLUSTREE_IO_H
@@ -0,0 +1,138 @@
+#ifndef BPLUSTREE_LATCH_H
+#define BPLUSTREE_LATCH_H
+
+# include <atomic>
+# include <cstddef>
+# include <cstdint>
+# include <cstdlib>
+# include <new>
+# include <shared_mutex>
+# include <sys/types.h>
+
+namespace sjtu {
+
+	/**
+	 * A reader / writer latch with a version counter.
+	 * the version is odd while a writer holds the latch and grows by 2 with every write,
+	 * so a reader may skip the latch: it reads the version, reads the data, and the data is
+	 * good if the version was even and has not changed (a sequence lock).
+	 */
+	struct versionLatch {
+		std::shared_timed_mutex mutex;
+		std::atomic <uint64_t> version;
+		versionLatch() : version(0) {}
+	};
+
+	/**
+	 * hold a versionLatch exclusively, bumping its version on both ends.
+	 */
+	class writeLatch {
+		private:
+			versionLatch &latch;
+
+		public:
+			explicit writeLatch(versionLatch &_latch) : latch(_latch) {
+				latch.mutex.lock();
+				++latch.version;
+			}
+			~writeLatch() {
+				++latch.version;
+				latch.mutex.unlock();
+			}
+
+			writeLatch(const writeLatch &) = delete;
+			writeLatch &operator=(const writeLatch &) = delete;
+	};
+
+	/**
+	 * hold a few versionLatches exclusively at once, bumping their versions like writeLatch.
+	 * a latch already in the group is not taken again (nodes may share a latch); all of them
+	 * are let go when the group goes.
+	 */
+	class latchGroup {
+		private:
+			static const int MAX = 4;
+			versionLatch *held[MAX];
+			int cnt;
+
+			bool has(versionLatch &latch) const {
+				for (int i = 0; i < cnt; ++i)
+					if (held[i] == &latch) return 1;
+				return 0;
+			}
+
+		public:
+			latchGroup() : cnt(0) {}
+
+			void lock(versionLatch &latch) {
+				if (has(latch)) return;
+				latch.mutex.lock();
+				++latch.version;
+				held[cnt++] = &latch;
+			}
+
+			/**
+			 * function: take latch if no one holds it, return false (and take nothing) otherwise.
+			 */
+			bool try_lock(versionLatch &latch) {
+				if (has(latch)) return 1;
+				if (!latch.mutex.try_lock()) return 0;
+				++latch.version;
+				held[cnt++] = &latch;
+				return 1;
+			}
+
+			~latchGroup() {
+				for (int i = cnt - 1; i >= 0; --i) {
+					++held[i] -> version;
+					held[i] -> mutex.unlock();
+				}
+			}
+
+			latchGroup(const latchGroup &) = delete;
+			latchGroup &operator=(const latchGroup &) = delete;
+	};
+
+	/**
+	 * Latches of the nodes of a tree, found by the offset of the node.
+	 * a fixed number of latches is shared by all the nodes (striped), so two nodes may share
+	 * a latch; a thread only waits for a node latch while it holds none, and takes any more
+	 * with try_lock, so that only costs concurrency.
+	 * each latch is on a cache line of its own; the table is allocated apart with that alignment,
+	 * since new does not align an over-aligned type before C++17.
+	 */
+	class latchTable {
+		private:
+			static const int SIZE = 1024;
+
+			struct alignas(64) stripe {
+				versionLatch latch;
+			};
+
+			stripe *table;
+
+		public:
+			latchTable() {
+				void *place = nullptr;
+				if (posix_memalign(&place, alignof(stripe), sizeof(stripe) * SIZE) != 0) throw "out of memory";
+				table = static_cast <stripe *> (place);
+				for (int i = 0; i < SIZE; ++i) new (table + i) stripe;
+			}
+
+			latchTable(const latchTable &) = delete;
+			latchTable &operator=(const latchTable &) = delete;
+
+			~latchTable() {
+				for (int i = 0; i < SIZE; ++i) table[i].~stripe();
+				free(table);
+			}
+
+			versionLatch &operator[](ssize_t offset) {
+				size_t h = static_cast <size_t> (offset) * 0x9e3779b97f4a7c15ULL;
+				return table[(h >> 32) & (SIZE - 1)].latch;
+			}
+	};
+
+}  // namespace sjtu
+
+#endif //BPLUSTREE_LATCH_H
@@ -0,0 +1,27 @@
+#ifndef BPLUSTREE_PARALLEL_H
+#define BPLUSTREE_PARALLEL_H
+
+# include <cstddef>
+# include <thread>
+
+namespace sjtu {
+
+	/**
+	 * run func(lo, hi) for nthreads contiguous parts [lo, hi) of [0, n) of about the same size,
+	 * each on its own thread; the calling thread runs the last part. func must not throw.
+	 */
+	template <class Func>
+	void parallel_for(int nthreads, size_t n, Func func) {
+		if (nthreads < 1) nthreads = 1;
+		if (static_cast <size_t> (nthreads) > n) nthreads = n == 0 ? 1 : static_cast <int> (n);
+		std::thread *worker = new std::thread[nthreads - 1];
+		for (int t = 0; t < nthreads - 1; ++t)
+			worker[t] = std::thread(func, n * t / nthreads, n * (t + 1) / nthreads);
+		func(n * (nthreads - 1) / nthreads, n);
+		for (int t = 0; t < nthreads - 1; ++t) worker[t].join();
+		delete [] worker;
+	}
+
+}  // namespace sjtu
+
+#endif //BPLUSTREE_PARALLEL_H
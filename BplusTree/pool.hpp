@@ -0,0 +1,319 @@
+#ifndef BPLUSTREE_POOL_H
+#define BPLUSTREE_POOL_H
+
+# include <atomic>
+# include <cstddef>
+# include <cstdint>
+# include <cstdio>
+# include <cstdlib>
+# include <cstring>
+# include <mutex>
+# include <sys/mman.h>
+# include <sys/types.h>
+# include <sys/uio.h>
+# include <unistd.h>
+# include "io.hpp"
+
+namespace sjtu {
+
+	/**
+	 * A buffer pool of the BLOCK byte blocks of one file, with CLOCK eviction.
+	 * it is cut into stripes by block number, each with its own latch and its own share of the
+	 * frames, so threads reading different blocks rarely meet. reads fill it; writes go to the file
+	 * first and then update the blocks it holds (write-through), so it never holds anything the
+	 * file does not. a miss reads the block under the stripe latch, so a write of the block either
+	 * happens before the read or finds the block in the pool and updates it.
+	 * all the public functions may be called from several threads.
+	 * for a file opened with O_DIRECT (reset(fd, budget, 1)) it is the only cache: the frames are
+	 * aligned to BLOCK, and a write changes the frames of its blocks and writes them whole, one
+	 * block at a time under its stripe latch, so two writes into the same block never lose each other.
+	 * the frames of all the stripes are one arena. asked for huge pages, the arena is mapped with
+	 * 2 MB pages reserved by the system (MAP_HUGETLB) if it has enough of them, else aligned to 2 MB
+	 * and handed to transparent huge pages; both are faulted in at once. backing() says which way it
+	 * went and huge_bytes() how much of it huge pages really back.
+	 */
+	class blockPool {
+		public:
+			static const size_t BLOCK = 4096;
+			static const size_t HUGE_PAGE = 2 << 20;
+
+			enum pageKind { SMALL, TRANSPARENT_HUGE, EXPLICIT_HUGE };
+
+		private:
+			static const int STRIPES = 16;
+			static const size_t NO_BLOCK = ~size_t(0);     // block number of a frame holding nothing
+
+			struct stripe {
+				char *data;           // capacity frames of BLOCK bytes
+				size_t *block;        // block number in each frame
+				bool *ref;            // CLOCK reference bit of each frame
+				size_t *index;        // hash index, frame + 1, 0 means empty
+				size_t capacity, mask, hand, used_cnt;
+				std::mutex latch;
+				stripe() : data(nullptr), block(nullptr), ref(nullptr), index(nullptr), capacity(0), mask(0), hand(0), used_cnt(0) {}
+			};
+
+			stripe part[STRIPES];
+			int fd;
+			bool direct;              // the file is read and written in whole aligned blocks
+			char *arena;              // the frames of all the stripes
+			size_t arena_size;
+			void *mapping;            // what mmap() gave, nullptr if the arena is from the heap
+			size_t mapping_size;
+			pageKind kind;
+			std::atomic <size_t> hits, misses;
+
+			static inline size_t mix(size_t b) { return (b * 0x9e3779b97f4a7c15ULL) >> 16; }
+
+			size_t probe(const stripe &s, size_t b) const {
+				size_t pos = mix(b) & s.mask;
+				while (s.index[pos] != 0 && s.block[s.index[pos] - 1] != b) pos = (pos + 1) & s.mask;
+				return pos;
+			}
+
+			/**
+			 * function: remove the index position pos (linear probing, backward shift).
+			 */
+			void unlink(stripe &s, size_t pos) {
+				size_t nxt = (pos + 1) & s.mask;
+				while (s.index[nxt] != 0) {
+					size_t home = mix(s.block[s.index[nxt] - 1]) & s.mask;
+					if (((nxt - home) & s.mask) >= ((nxt - pos) & s.mask)) {
+						s.index[pos] = s.index[nxt];
+						pos = nxt;
+					}
+					nxt = (nxt + 1) & s.mask;
+				}
+				s.index[pos] = 0;
+			}
+
+			/**
+			 * function: the frame holding block b, read from the file if it is not there (and fill is set).
+			 */
+			char *frame(stripe &s, size_t b, bool fill = 1) {
+				size_t pos = probe(s, b);
+				if (s.index[pos] != 0) {
+					++hits;
+					size_t f = s.index[pos] - 1;
+					s.ref[f] = 1;
+					return s.data + f * BLOCK;
+				}
+				++misses;
+				size_t f;
+				if (s.used_cnt < s.capacity) f = s.used_cnt++;
+				else {
+					while (s.ref[s.hand]) {
+						s.ref[s.hand] = 0;
+						s.hand = (s.hand + 1) % s.capacity;
+					}
+					f = s.hand;
+					s.hand = (s.hand + 1) % s.capacity;
+					unlink(s, probe(s, s.block[f]));
+					pos = probe(s, b);
+				}
+				char *ret = s.data + f * BLOCK;
+				ssize_t n = fill ? pread(fd, ret, BLOCK, static_cast <off_t> (b * BLOCK)) : static_cast <ssize_t> (BLOCK);
+				if (n < 0) {
+					// the frame is left empty, no probe finds it and the hand takes it again
+					s.block[f] = NO_BLOCK, s.ref[f] = 0;
+					throw "read failed";
+				}
+				if (n < static_cast <ssize_t> (BLOCK)) memset(ret + n, 0, BLOCK - n);
+				s.block[f] = b, s.ref[f] = 1;
+				s.index[pos] = f + 1;
+				return ret;
+			}
+
+			/**
+			 * function: get the arena of size bytes, on huge pages if huge and the system has them.
+			 */
+			void map_arena(size_t size, bool huge) {
+				arena_size = size, kind = SMALL;
+				if (huge) {
+					size_t len = (size + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+					void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+					if (p != MAP_FAILED) {
+						mapping = p, mapping_size = len, kind = EXPLICIT_HUGE;
+						arena = static_cast <char *> (p);
+						return;
+					}
+					// over-map by a huge page to align the arena to one, then give back the ends.
+					p = mmap(nullptr, len + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+					if (p != MAP_FAILED) {
+						char *from = static_cast <char *> (p), *to = from + len + HUGE_PAGE;
+						char *start = reinterpret_cast <char *> ((reinterpret_cast <uintptr_t> (from) + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE);
+						if (start > from) munmap(from, start - from);
+						if (to > start + len) munmap(start + len, to - start - len);
+						mapping = start, mapping_size = len;
+						arena = start;
+						if (madvise(start, len, MADV_HUGEPAGE) == 0) kind = TRANSPARENT_HUGE;
+						for (size_t i = 0; i < len; i += BLOCK) arena[i] = 0;
+						return;
+					}
+				}
+				void *data = nullptr;
+				if (posix_memalign(&data, BLOCK, size) != 0) throw "buffer pool allocation failed";
+				arena = static_cast <char *> (data);
+			}
+
+			void release() {
+				if (mapping != nullptr) munmap(mapping, mapping_size);
+				else free(arena);
+				arena = nullptr, arena_size = 0;
+				mapping = nullptr, mapping_size = 0;
+				kind = SMALL;
+				for (int i = 0; i < STRIPES; ++i) {
+					stripe &s = part[i];
+					delete [] s.block;
+					delete [] s.ref;
+					delete [] s.index;
+					s.data = nullptr, s.block = nullptr, s.ref = nullptr, s.index = nullptr;
+					s.capacity = s.mask = s.hand = s.used_cnt = 0;
+				}
+			}
+
+		public:
+			blockPool() : fd(-1), direct(0), arena(nullptr), arena_size(0), mapping(nullptr), mapping_size(0), kind(SMALL),
+			              hits(0), misses(0) {}
+
+			blockPool(const blockPool &) = delete;
+			blockPool &operator=(const blockPool &) = delete;
+
+			~blockPool() { release(); }
+
+			/**
+			 * function: serve the file fd with budget bytes of frames (0: no pool, straight to the file).
+			 * with _direct the file is only accessed in whole aligned blocks, and there is a frame per
+			 * stripe at least. with huge the frames are on huge pages if the system gives them.
+			 * not to be called while others use the pool.
+			 */
+			void reset(int _fd, size_t budget, bool _direct = 0, bool huge = 0) {
+				release();
+				fd = _fd, direct = _direct;
+				size_t per = budget / BLOCK / STRIPES;
+				if (per == 0 && (budget != 0 || direct)) per = 1;
+				if (per != 0) map_arena(per * BLOCK * STRIPES, huge);
+				for (int i = 0; i < STRIPES && per != 0; ++i) {
+					stripe &s = part[i];
+					size_t len = 1;
+					while (len < per * 2) len <<= 1;
+					s.capacity = per, s.mask = len - 1;
+					s.data = arena + i * per * BLOCK;
+					s.block = new size_t[per];
+					s.ref = new bool[per]();
+					s.index = new size_t[len]();
+				}
+			}
+
+			void read(void *place, size_t size, off_t offset) {
+				char *out = static_cast <char *> (place);
+				while (size > 0) {
+					size_t b = offset / BLOCK, in = offset % BLOCK;
+					size_t len = BLOCK - in < size ? BLOCK - in : size;
+					stripe &s = part[b % STRIPES];
+					if (s.capacity == 0) {
+						read_at(fd, out, size, offset);
+						return;
+					}
+					{
+						std::lock_guard <std::mutex> lock(s.latch);
+						memcpy(out, frame(s, b) + in, len);
+					}
+					out += len, offset += len, size -= len;
+				}
+			}
+
+			void write(const void *place, size_t size, off_t offset) {
+				const char *in_data = static_cast <const char *> (place);
+				if (direct) {
+					// up to STRIPES blocks in a row at a time, all in different stripes, latched in stripe
+					// order and written by one pwritev().
+					while (size > 0) {
+						size_t first = offset / BLOCK, last = (offset + size - 1) / BLOCK;
+						if (last - first >= static_cast <size_t> (STRIPES)) last = first + STRIPES - 1;
+						size_t n = last - first + 1;
+						std::unique_lock <std::mutex> lock[STRIPES];
+						for (int i = 0; i < STRIPES; ++i)
+							if ((i + STRIPES - first % STRIPES) % STRIPES < n) lock[i] = std::unique_lock <std::mutex> (part[i].latch);
+						iovec vec[STRIPES];
+						for (size_t b = first; b <= last; ++b) {
+							size_t in = offset % BLOCK;
+							size_t len = BLOCK - in < size ? BLOCK - in : size;
+							char *f = frame(part[b % STRIPES], b, len != BLOCK);
+							memcpy(f + in, in_data, len);
+							vec[b - first].iov_base = f, vec[b - first].iov_len = BLOCK;
+							in_data += len, offset += len, size -= len;
+						}
+						if (pwritev(fd, vec, static_cast <int> (n), static_cast <off_t> (first * BLOCK)) != static_cast <ssize_t> (n * BLOCK))
+							throw "write failed";
+					}
+					return;
+				}
+				write_at(fd, place, size, offset);
+				while (size > 0) {
+					size_t b = offset / BLOCK, in = offset % BLOCK;
+					size_t len = BLOCK - in < size ? BLOCK - in : size;
+					stripe &s = part[b % STRIPES];
+					if (s.capacity == 0) return;
+					{
+						std::lock_guard <std::mutex> lock(s.latch);
+						size_t pos = probe(s, b);
+						if (s.index[pos] != 0) memcpy(s.data + (s.index[pos] - 1) * BLOCK + in, in_data, len);
+					}
+					in_data += len, offset += len, size -= len;
+				}
+			}
+
+			/**
+			 * function: forget every block, the file was cut or replaced under the pool.
+			 */
+			void invalidate() {
+				for (int i = 0; i < STRIPES; ++i) {
+					stripe &s = part[i];
+					std::lock_guard <std::mutex> lock(s.latch);
+					if (s.capacity == 0) continue;
+					memset(s.index, 0, (s.mask + 1) * sizeof(size_t));
+					memset(s.ref, 0, s.capacity * sizeof(bool));
+					s.hand = s.used_cnt = 0;
+				}
+			}
+
+			size_t capacity() const {
+				size_t ret = 0;
+				for (int i = 0; i < STRIPES; ++i) ret += part[i].capacity;
+				return ret * BLOCK;
+			}
+			pageKind backing() const { return kind; }
+
+			/**
+			 * function: bytes of the frames on huge pages; for transparent ones the kernel is asked
+			 * (/proc/self/smaps), as it may have backed only part of the arena, or none of it.
+			 */
+			size_t huge_bytes() const {
+				if (kind == EXPLICIT_HUGE) return arena_size;
+				if (kind == SMALL) return 0;
+				FILE *f = fopen("/proc/self/smaps", "r");
+				if (f == nullptr) return 0;
+				char line[256];
+				bool inside = 0;
+				size_t ret = 0;
+				while (fgets(line, sizeof(line), f) != nullptr) {
+					unsigned long lo, hi;
+					if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {     // the first line of a mapping
+						inside = lo < reinterpret_cast <uintptr_t> (arena) + mapping_size && hi > reinterpret_cast <uintptr_t> (arena);
+						continue;
+					}
+					size_t kb;
+					if (inside && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) ret += kb << 10;
+				}
+				fclose(f);
+				return ret < arena_size ? ret : arena_size;
+			}
+
+			size_t hit_count() const { return hits.load(); }
+			size_t miss_count() const { return misses.load(); }
+	};
+
+}  // namespace sjtu
+
+#endif //BPLUSTREE_POOL_H
@@ -0,0 +1,249 @@
+#ifndef BPLUSTREE_SHADOW_H
+#define BPLUSTREE_SHADOW_H
+
+# include <cstddef>
+# include <cstdint>
+# include <mutex>
+# include <shared_mutex>
+# include <sys/types.h>
+# include "skiplist.hpp"
+
+namespace sjtu {
+
+	/**
+	 * function: 64-bit FNV-1a checksum of n bytes.
+	 */
+	inline uint64_t checksum(const void *data, size_t n) {
+		const unsigned char *p = static_cast <const unsigned char *> (data);
+		uint64_t h = 14695981039346656037ULL;
+		for (size_t i = 0; i < n; ++i) h = (h ^ p[i]) * 1099511628211ULL;
+		return h;
+	}
+
+	/**
+	 * The page map of shadow paging: where each page of a file really is.
+	 * a page keeps its offset (its logical place) for good, so the links between pages never change;
+	 * the first write of a page after a commit goes to a fresh physical place instead, and later
+	 * writes before the next commit overwrite that place. pages that were never moved are at their
+	 * logical place. the physical places a commit no longer needs are handed out again after the
+	 * next commit is durable, so the last committed state is never overwritten.
+	 * all the public functions may be called from several threads.
+	 */
+	class pageTable {
+		public:
+			struct image {
+				ssize_t logical, place;
+				size_t size;
+			};
+
+		private:
+			struct entry {
+				ssize_t place;        // where the page is now
+				size_t size;
+				ssize_t old;          // where the last commit has it, -1 if at its logical place
+				bool dirty;           // moved since the last commit
+				entry() : place(0), size(0), old(-1), dirty(0) {}
+			};
+			struct extent {
+				ssize_t offset;
+				size_t size;
+			};
+
+			skipList <ssize_t, entry> table;
+			ssize_t *dirty;           // pages moved since the last commit
+			int dirty_cnt, dirty_cap;
+			extent *hole;             // free physical space
+			int hole_cnt, hole_cap;
+			ssize_t end;              // physical space from here on is free
+			mutable std::shared_timed_mutex latch;
+
+			template <class T>
+			static void push(T *&arr, int &cnt, int &cap, const T &x) {
+				if (cnt == cap) {
+					cap = cap == 0 ? 16 : cap * 2;
+					T *tmp = new T[cap];
+					for (int i = 0; i < cnt; ++i) tmp[i] = arr[i];
+					delete [] arr;
+					arr = tmp;
+				}
+				arr[cnt++] = x;
+			}
+
+			/**
+			 * function: take size bytes of free space, first fit among the holes or else at the end.
+			 */
+			ssize_t take(size_t size) {
+				for (int i = 0; i < hole_cnt; ++i)
+					if (hole[i].size >= size) {
+						ssize_t ret = hole[i].offset;
+						hole[i].offset += size, hole[i].size -= size;
+						if (hole[i].size == 0) hole[i] = hole[--hole_cnt];
+						return ret;
+					}
+				ssize_t ret = end;
+				end += size;
+				return ret;
+			}
+
+			void give(ssize_t offset, size_t size) {
+				if (size == 0) return;
+				extent e;
+				e.offset = offset, e.size = size;
+				push(hole, hole_cnt, hole_cap, e);
+			}
+
+		public:
+			pageTable() : dirty(nullptr), dirty_cnt(0), dirty_cap(0), hole(nullptr), hole_cnt(0), hole_cap(0), end(0) {}
+
+			pageTable(const pageTable &) = delete;
+			pageTable &operator=(const pageTable &) = delete;
+
+			~pageTable() {
+				delete [] dirty;
+				delete [] hole;
+			}
+
+			/**
+			 * function: forget every page; physical space from _end on is free.
+			 */
+			void reset(ssize_t _end) {
+				std::lock_guard <std::shared_timed_mutex> lock(latch);
+				table.clear();
+				dirty_cnt = hole_cnt = 0;
+				end = _end;
+			}
+
+			/**
+			 * function: the physical place of the page at logical offset.
+			 */
+			ssize_t where(ssize_t logical) const {
+				std::shared_lock <std::shared_timed_mutex> lock(latch);
+				const entry *e = table.find(logical);
+				return e == nullptr ? logical : e -> place;
+			}
+
+			/**
+			 * function: the physical place to write the page at logical offset to.
+			 * *fresh is set if it is a new place, which publish() has to make known after the write.
+			 */
+			ssize_t place(ssize_t logical, size_t size, bool *fresh) {
+				std::lock_guard <std::shared_timed_mutex> lock(latch);
+				const entry *e = table.find(logical);
+				*fresh = e == nullptr || !e -> dirty;
+				return *fresh ? take(size) : e -> place;
+			}
+
+			void publish(ssize_t logical, ssize_t place, size_t size) {
+				std::lock_guard <std::shared_timed_mutex> lock(latch);
+				entry *e = table.find(logical);
+				entry now;
+				if (e != nullptr) now.old = e -> place;
+				now.place = place, now.size = size, now.dirty = 1;
+				table.insert(logical, now);
+				push(dirty, dirty_cnt, dirty_cap, logical);
+			}
+
+			/**
+			 * function: take size bytes of physical space, for something else than a page.
+			 */
+			ssize_t allocate(size_t size) {
+				std::lock_guard <std::shared_timed_mutex> lock(latch);
+				return take(size);
+			}
+
+			/**
+			 * function: the pages moved since the last commit.
+			 */
+			size_t pending() const {
+				std::shared_lock <std::shared_timed_mutex> lock(latch);
+				return dirty_cnt;
+			}
+
+			size_t size() const {
+				std::shared_lock <std::shared_timed_mutex> lock(latch);
+				return table.size();
+			}
+
+			/**
+			 * function: the end of the physical space in use.
+			 */
+			ssize_t limit() const {
+				std::shared_lock <std::shared_timed_mutex> lock(latch);
+				return end;
+			}
+
+			/**
+			 * function: put every moved page in out[0 .. size()), in logical order.
+			 */
+			void dump(image *out) const {
+				std::shared_lock <std::shared_timed_mutex> lock(latch);
+				size_t n = 0;
+				table.traverse([&](const ssize_t &logical, const entry &e) {
+					out[n].logical = logical, out[n].place = e.place, out[n].size = e.size;
+					++n;
+				});
+			}
+
+			/**
+			 * function: put the pages moved since the last commit in out[0 .. pending()).
+			 */
+			void dump_moved(image *out) const {
+				std::shared_lock <std::shared_timed_mutex> lock(latch);
+				for (int i = 0; i < dirty_cnt; ++i) {
+					const entry *e = table.find(dirty[i]);
+					out[i].logical = dirty[i], out[i].place = e -> place, out[i].size = e -> size;
+				}
+			}
+
+			/**
+			 * function: a commit is durable; free the places it replaced.
+			 */
+			void committed() {
+				std::lock_guard <std::shared_timed_mutex> lock(latch);
+				for (int i = 0; i < dirty_cnt; ++i) {
+					entry *e = table.find(dirty[i]);
+					if (e -> old != -1) give(e -> old, e -> size);
+					e -> old = -1, e -> dirty = 0;
+				}
+				dirty_cnt = 0;
+			}
+
+			/**
+			 * function: free size bytes at offset that allocate() gave, once no commit needs them.
+			 */
+			void release(ssize_t offset, size_t size) {
+				std::lock_guard <std::shared_timed_mutex> lock(latch);
+				give(offset, size);
+			}
+
+			/**
+			 * function: start from a committed map of n pages, a later one of the same page winning,
+			 * kept in maps pieces at (map[i], map_size[i]). physical space from base on that neither
+			 * the pages nor the map use is free.
+			 */
+			void load(const image *img, size_t n, ssize_t base, const ssize_t *map, const size_t *map_size, int maps) {
+				std::lock_guard <std::shared_timed_mutex> lock(latch);
+				table.clear();
+				dirty_cnt = hole_cnt = 0;
+				skipList <ssize_t, size_t> used;
+				for (size_t i = 0; i < n; ++i) {
+					entry e;
+					e.place = img[i].place, e.size = img[i].size;
+					table.insert(img[i].logical, e);
+				}
+				table.traverse([&](const ssize_t &, const entry &e) {
+					if (e.place >= base) used.insert(e.place, e.size);
+				});
+				for (int i = 0; i < maps; ++i)
+					if (map_size[i] > 0) used.insert(map[i], map_size[i]);
+				end = base;
+				used.traverse([&](const ssize_t &offset, const size_t &size) {
+					if (offset > end) give(end, offset - end);
+					if (offset + static_cast <ssize_t> (size) > end) end = offset + size;
+				});
+			}
+	};
+
+}  // namespace sjtu
+
+#endif //BPLUSTREE_SHADOW_H
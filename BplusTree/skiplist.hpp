@@ -0,0 +1,123 @@
+#ifndef BPLUSTREE_SKIPLIST_H
+#define BPLUSTREE_SKIPLIST_H
+
+# include <cstddef>
+# include <cstdint>
+
+namespace sjtu {
+
+	/**
+	 * An ordered in-memory map (skip list), used as the memtable of BTree.
+	 * every node is on level 0, and on each next level with probability 1/4.
+	 */
+	template <class KeyType, class ValueType>
+	class skipList {
+		private:
+			static const int MAXLEVEL = 16;
+
+			struct node {
+				KeyType key;
+				ValueType value;
+				node *nxt[MAXLEVEL];
+				node() : key(), value() {
+					for (int i = 0; i < MAXLEVEL; ++i) nxt[i] = nullptr;
+				}
+			};
+
+			node *head;
+			int level;            // levels in use
+			size_t cnt;
+			uint32_t seed;
+
+			int random_level() {
+				int ret = 1;
+				while (ret < MAXLEVEL) {
+					seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5;
+					if (seed & 3) break;
+					++ret;
+				}
+				return ret;
+			}
+
+			/**
+			 * function: find the last node with key smaller than key on every level, put it in pre.
+			 */
+			node *search(const KeyType &key, node **pre) const {
+				node *p = head;
+				for (int i = level - 1; i >= 0; --i) {
+					while (p -> nxt[i] != nullptr && p -> nxt[i] -> key < key) p = p -> nxt[i];
+					if (pre != nullptr) pre[i] = p;
+				}
+				return p -> nxt[0];
+			}
+
+		public:
+			skipList() : head(new node), level(1), cnt(0), seed(2463534242u) {}
+
+			skipList(const skipList &) = delete;
+			skipList &operator=(const skipList &) = delete;
+
+			~skipList() {
+				clear();
+				delete head;
+			}
+
+			/**
+			 * function: return a pointer to the value of key, nullptr if there is none.
+			 */
+			ValueType *find(const KeyType &key) const {
+				node *p = search(key, nullptr);
+				if (p != nullptr && p -> key == key) return &p -> value;
+				return nullptr;
+			}
+
+			/**
+			 * function: insert (key, value), or change the value if key already exists.
+			 */
+			void insert(const KeyType &key, const ValueType &value) {
+				node *pre[MAXLEVEL];
+				node *p = search(key, pre);
+				if (p != nullptr && p -> key == key) {
+					p -> value = value;
+					return;
+				}
+				int lv = random_level();
+				for (int i = level; i < lv; ++i) pre[i] = head;
+				if (lv > level) level = lv;
+				p = new node;
+				p -> key = key;
+				p -> value = value;
+				for (int i = 0; i < lv; ++i) {
+					p -> nxt[i] = pre[i] -> nxt[i];
+					pre[i] -> nxt[i] = p;
+				}
+				++cnt;
+			}
+
+			/**
+			 * function: call func(key, value) for every pair in key order.
+			 */
+			template <class Func>
+			void traverse(Func func) const {
+				for (node *p = head -> nxt[0]; p != nullptr; p = p -> nxt[0]) func(p -> key, p -> value);
+			}
+
+			void clear() {
+				node *p = head -> nxt[0];
+				while (p != nullptr) {
+					node *q = p -> nxt[0];
+					delete p;
+					p = q;
+				}
+				for (int i = 0; i < MAXLEVEL; ++i) head -> nxt[i] = nullptr;
+				level = 1;
+				cnt = 0;
+			}
+
+			size_t size() const { return cnt; }
+			bool empty() const { return cnt == 0; }
+	};
+
+}  // namespace sjtu
+
+#endif //BPLUSTREE_SKIPLIST_H
@@ -0,0 +1,463 @@
+#ifndef BPLUSTREE_STORAGE_H
+#define BPLUSTREE_STORAGE_H
+
+# include <atomic>
+# include <cerrno>
+# include <cstddef>
+# include <cstdio>
+# include <cstring>
+# include <limits>
+# include <mutex>
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/types.h>
+# include <unistd.h>
+# include "io.hpp"
+# include "pool.hpp"
+
+namespace sjtu {
+
+	/**
+	 * How BTree(path, options) opens its file.
+	 * mode: CREATE opens the file or creates it, OPEN needs it to exist, READ_ONLY needs it to exist
+	 *       and never writes it (the mutators throw).
+	 * page: the node size the caller expects, 0 for any; it is fixed by the key and value types,
+	 *       so a different one throws instead of opening a file laid out for other nodes.
+	 * cache: capacity of the hot-key cache, like set_cache().
+	 * backend: BUFFERED goes through the page cache, DSYNC opens with O_DSYNC so every write is
+	 *          durable when it returns, DIRECT opens with O_DIRECT: the page cache is bypassed and
+	 *          the tree keeps its own buffer pool of pool bytes (16 MB if 0) instead, which reads and
+	 *          writes the file in aligned 4 KB blocks. the file system has to support O_DIRECT.
+	 * huge_pages: put the frames of that pool on 2 MB huge pages, if the system gives them.
+	 * backend, pool and huge_pages are for FileStorage; the other storages ignore them.
+	 */
+	struct openOptions {
+		enum openMode { CREATE, OPEN, READ_ONLY };
+		enum ioBackend { BUFFERED, DSYNC, DIRECT };
+		openMode mode;
+		size_t page;
+		size_t cache;
+		ioBackend backend;
+		size_t pool;
+		bool huge_pages;
+		openOptions() : mode(CREATE), page(0), cache(0), backend(BUFFERED), pool(0), huge_pages(0) {}
+	};
+
+	/**
+	 * The storages a BTree keeps its nodes in, its last template parameter.
+	 * a storage is a flat array of bytes from offset 0 on; the tree reads and writes it at any offset,
+	 * from several threads at once (never the same bytes while someone writes them), and a read of
+	 * bytes never written gives zeros. they all have:
+	 *    open(path, options): open or create; return true if there is something in it already.
+	 *    close(end): give back what lies after end (nothing if end < 0 or read-only) and close.
+	 *    read(place, size, offset) / write(place, size, offset) / sync().
+	 *    grow(end, extent): have space up to end at least, taken extent bytes at a time.
+	 *    reserve(end): bytes up to end are written soon (by bulk_load()).
+	 *    advise(offset, size): the bytes [offset, offset + size) are read soon.
+	 *    truncate(): forget everything; a reader meanwhile gets zeros, never a fault.
+	 *    replace(other, path): take the contents of other, which is closed after; a file of other
+	 *                          is renamed to path. a reader meanwhile gets the old or the new bytes.
+	 *    peek(offset, size): where the bytes are in memory, to be read in place; nullptr if they are not.
+	 *    poke(offset, size): the same to be written in place, nullptr if a write has to go through write().
+	 *    fd(): a descriptor pread() reads the contents from, -1 if there is none.
+	 *    set_extent(bytes), block_pool().
+	 */
+
+	/**
+	 * A file, read and written with pread / pwrite, or through an own blockPool with O_DIRECT.
+	 * the file is longer than the tree: write() calls grow(), which allocates extent bytes at a time
+	 * with fallocate(), so it grows in a few contiguous pieces and a split does not change the size
+	 * of the file; close() cuts the rest off.
+	 */
+	class FileStorage {
+		private:
+			int file;
+			char *name;
+			bool read_only;
+			blockPool *pool;          // the own buffer pool with O_DIRECT, nullptr otherwise
+			std::atomic <off_t> prealloc_end;   // the file has space allocated up to here
+			std::mutex grow_latch;
+			size_t extent;            // the file grows this many bytes at a time, 0 for a write at a time
+
+			void reset_growth() {
+				struct stat st;
+				prealloc_end = fstat(file, &st) == 0 ? st.st_size : 0;
+			}
+
+		public:
+			FileStorage() : file(-1), name(nullptr), read_only(0), pool(nullptr), prealloc_end(0), extent(1 << 20) {}
+
+			FileStorage(const FileStorage &) = delete;
+			FileStorage &operator=(const FileStorage &) = delete;
+
+			~FileStorage() { close(-1); }
+
+			bool open(const char *path, const openOptions &options) {
+				read_only = options.mode == openOptions::READ_ONLY;
+				int flags = read_only ? O_RDONLY : O_RDWR;
+				if (options.backend == openOptions::DSYNC) flags |= O_DSYNC;
+				if (options.backend == openOptions::DIRECT) flags |= O_DIRECT;
+				bool existed = 1;
+				file = ::open(path, flags);
+				if (file < 0 && errno == EINVAL) throw "the file system does not support O_DIRECT";
+				if (file < 0) {
+					if (options.mode != openOptions::CREATE) throw "no such tree file";
+					existed = 0;
+					file = ::open(path, flags | O_CREAT, 0644);
+					if (file < 0 && errno == EINVAL) throw "the file system does not support O_DIRECT";
+					if (file < 0) throw "open file failed";
+				}
+				name = new char[strlen(path) + 1];
+				strcpy(name, path);
+				if (options.backend == openOptions::DIRECT) {
+					pool = new blockPool;
+					pool -> reset(file, options.pool != 0 ? options.pool : 16 << 20, 1, options.huge_pages);
+				}
+				reset_growth();
+				return existed;
+			}
+
+			bool is_open() const { return file >= 0; }
+
+			void close(off_t end) {
+				if (file < 0) return;
+				struct stat st;
+				if (end >= 0 && !read_only && fstat(file, &st) == 0 && st.st_size > end) {
+					// a trim that fails only leaves the unused extent behind, and close() must not throw
+					int trimmed = ftruncate(file, end);
+					(void) trimmed;
+				}
+				::close(file);
+				delete pool;
+				delete [] name;
+				file = -1, pool = nullptr, name = nullptr;
+				prealloc_end = 0;
+			}
+
+			void read(void *place, size_t size, off_t offset) const {
+				if (pool != nullptr) pool -> read(place, size, offset);
+				else read_at(file, place, size, offset);
+			}
+
+			void write(const void *place, size_t size, off_t offset) {
+				grow(offset + size, extent);
+				if (pool != nullptr) pool -> write(place, size, offset);
+				else write_at(file, place, size, offset);
+			}
+
+			void sync() { fdatasync(file); }
+
+			/**
+			 * function: if the file system cannot fallocate(), the file is left to grow by itself.
+			 */
+			void grow(off_t end, size_t by) {
+				if (by == 0 || end <= prealloc_end.load(std::memory_order_acquire)) return;
+				std::lock_guard <std::mutex> lock(grow_latch);
+				off_t from = prealloc_end.load(std::memory_order_relaxed);
+				if (end <= from) return;
+				off_t to = (end + by - 1) / by * by;
+				if (fallocate(file, 0, from, to - from) != 0) to = std::numeric_limits <off_t>::max();
+				prealloc_end.store(to, std::memory_order_release);
+			}
+
+			void reserve(off_t end) {
+				if (extent != 0) grow(end, extent);
+				else if (ftruncate(file, end) != 0) throw "truncate failed";
+			}
+
+			void advise(off_t offset, size_t size) const {
+				if (pool == nullptr) posix_fadvise(file, offset, size, POSIX_FADV_WILLNEED);
+			}
+
+			void truncate() {
+				if (ftruncate(file, 0) != 0) throw "truncate failed";
+				if (pool != nullptr) pool -> invalidate();
+				prealloc_end = 0;
+			}
+
+			/**
+			 * function: the descriptor changes under the readers (dup2), so none is left with a closed one.
+			 */
+			bool replace(FileStorage &other, const char *path) {
+				fdatasync(other.file);
+				if (rename(other.name, path) != 0) return false;
+				dup2(other.file, file);
+				if (pool != nullptr) {
+					fcntl(file, F_SETFL, fcntl(file, F_GETFL) | O_DIRECT);
+					pool -> invalidate();
+				}
+				other.close(-1);
+				reset_growth();
+				return true;
+			}
+
+			const char *peek(off_t, size_t) const { return nullptr; }
+			char *poke(off_t, size_t) { return nullptr; }
+			int fd() const { return pool == nullptr ? file : -1; }
+			void set_extent(size_t bytes) { extent = bytes; }
+			const blockPool *block_pool() const { return pool; }
+	};
+
+	/**
+	 * A file mapped into memory: a read or a write is a memcpy, with no system call.
+	 * a big range of addresses is reserved when it opens and the file is mapped at its start, a
+	 * piece more whenever it grows (extent bytes at a time), so the bytes never move while others
+	 * read them. advise() is madvise(); sync() writes the dirty pages back with fdatasync().
+	 */
+	class MmapStorage {
+		private:
+			int file;
+			char *name;
+			bool read_only;
+			char *base;
+			size_t reserved;          // addresses reserved from base on
+			std::atomic <size_t> mapped;        // the file is mapped at [base, base + mapped)
+			std::mutex grow_latch;
+			size_t extent;
+
+			static size_t page() { return static_cast <size_t> (sysconf(_SC_PAGESIZE)); }
+
+			void map(size_t from, size_t to) {
+				int prot = read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+				if (to > from && mmap(base + from, to - from, prot, MAP_SHARED | MAP_FIXED, file, from) == MAP_FAILED)
+					throw "mmap failed";
+			}
+
+		public:
+			MmapStorage() : file(-1), name(nullptr), read_only(0), base(nullptr), reserved(0), mapped(0), extent(1 << 20) {}
+
+			MmapStorage(const MmapStorage &) = delete;
+			MmapStorage &operator=(const MmapStorage &) = delete;
+
+			~MmapStorage() { close(-1); }
+
+			bool open(const char *path, const openOptions &options) {
+				read_only = options.mode == openOptions::READ_ONLY;
+				int flags = read_only ? O_RDONLY : O_RDWR;
+				bool existed = 1;
+				file = ::open(path, flags);
+				if (file < 0) {
+					if (options.mode != openOptions::CREATE) throw "no such tree file";
+					existed = 0;
+					file = ::open(path, flags | O_CREAT, 0644);
+					if (file < 0) throw "open file failed";
+				}
+				void *p = MAP_FAILED;
+				for (reserved = size_t(1) << 40; reserved >= (size_t(1) << 30); reserved >>= 1) {
+					p = mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+					if (p != MAP_FAILED) break;
+				}
+				if (p == MAP_FAILED) {
+					::close(file);
+					file = -1;
+					throw "mmap failed";
+				}
+				base = static_cast <char *> (p);
+				name = new char[strlen(path) + 1];
+				strcpy(name, path);
+				struct stat st;
+				size_t size = fstat(file, &st) == 0 ? st.st_size : 0;
+				mapped = (size + page() - 1) / page() * page();
+				map(0, mapped);
+				return existed;
+			}
+
+			bool is_open() const { return file >= 0; }
+
+			void close(off_t end) {
+				if (file < 0) return;
+				munmap(base, reserved);
+				struct stat st;
+				if (end >= 0 && !read_only && fstat(file, &st) == 0 && st.st_size > end) {
+					// a trim that fails only leaves the unused extent behind, and close() must not throw
+					int trimmed = ftruncate(file, end);
+					(void) trimmed;
+				}
+				::close(file);
+				delete [] name;
+				file = -1, name = nullptr, base = nullptr;
+				reserved = 0, mapped = 0;
+			}
+
+			void read(void *place, size_t size, off_t offset) const {
+				if (offset + size <= mapped.load(std::memory_order_acquire)) memcpy(place, base + offset, size);
+				else read_at(file, place, size, offset);
+			}
+
+			void write(const void *place, size_t size, off_t offset) {
+				grow(offset + size, extent);
+				memcpy(base + offset, place, size);
+			}
+
+			void sync() { fdatasync(file); }
+
+			/**
+			 * function: the file is extended first, a mapped page past its end would fault.
+			 */
+			void grow(off_t end, size_t by) {
+				if (static_cast <size_t> (end) <= mapped.load(std::memory_order_acquire)) return;
+				std::lock_guard <std::mutex> lock(grow_latch);
+				size_t from = mapped.load(std::memory_order_relaxed);
+				if (static_cast <size_t> (end) <= from) return;
+				by = by < page() ? page() : (by + page() - 1) / page() * page();
+				size_t to = (end + by - 1) / by * by;
+				if (to > reserved) throw "the mapping is full";
+				if (fallocate(file, 0, from, to - from) != 0 && ftruncate(file, to) != 0) throw "grow failed";
+				map(from, to);
+				mapped.store(to, std::memory_order_release);
+			}
+
+			void reserve(off_t end) { grow(end, extent); }
+
+			void advise(off_t offset, size_t size) const {
+				size_t end = offset + size, limit = mapped.load(std::memory_order_acquire);
+				size_t from = offset / page() * page();
+				if (end > limit) end = limit;
+				if (end > from) madvise(base + from, end - from, MADV_WILLNEED);
+			}
+
+			/**
+			 * function: punch the whole file out, so the mapping stays and reads zeros.
+			 */
+			void truncate() {
+				size_t limit = mapped.load(std::memory_order_acquire);
+				if (limit != 0 && fallocate(file, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, limit) != 0)
+					memset(base, 0, limit);
+			}
+
+			/**
+			 * function: the new file is mapped over the old one in place; past its end the old pages
+			 * give way to zeros, and it grows from there again.
+			 */
+			bool replace(MmapStorage &other, const char *path) {
+				fdatasync(other.file);
+				if (rename(other.name, path) != 0) return false;
+				dup2(other.file, file);
+				std::lock_guard <std::mutex> lock(grow_latch);
+				size_t size = other.mapped.load(), limit = mapped.load();
+				map(0, size);
+				if (limit > size && mmap(base + size, limit - size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+					throw "mmap failed";
+				mapped.store(size, std::memory_order_release);
+				other.close(-1);
+				return true;
+			}
+
+			const char *peek(off_t offset, size_t size) const {
+				return offset >= 0 && offset + size <= mapped.load(std::memory_order_acquire) ? base + offset : nullptr;
+			}
+			char *poke(off_t, size_t) { return nullptr; }     // mapped read-only, written with pwrite()
+			int fd() const { return file; }
+			void set_extent(size_t bytes) { extent = bytes; }
+			const blockPool *block_pool() const { return nullptr; }
+	};
+
+	/**
+	 * Memory only, no file: the nodes are in a big range of addresses reserved when it opens and
+	 * made usable extent bytes at a time as the tree grows, so they never move while others read
+	 * them. open() with OPEN or READ_ONLY throws, there is nothing to open; close() gives it all back.
+	 */
+	class MemoryStorage {
+		private:
+			char *base;
+			size_t reserved;
+			std::atomic <size_t> committed;     // [base, base + committed) can be read and written
+			std::mutex grow_latch;
+			size_t extent;
+
+		public:
+			MemoryStorage() : base(nullptr), reserved(0), committed(0), extent(1 << 20) {}
+
+			MemoryStorage(const MemoryStorage &) = delete;
+			MemoryStorage &operator=(const MemoryStorage &) = delete;
+
+			~MemoryStorage() { close(-1); }
+
+			bool open(const char *, const openOptions &options) {
+				if (options.mode != openOptions::CREATE) throw "a tree in memory has no file to open";
+				void *p = MAP_FAILED;
+				for (reserved = size_t(1) << 40; reserved >= (size_t(1) << 30); reserved >>= 1) {
+					p = mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+					if (p != MAP_FAILED) break;
+				}
+				if (p == MAP_FAILED) throw "mmap failed";
+				base = static_cast <char *> (p);
+				committed = 0;
+				return false;
+			}
+
+			bool is_open() const { return base != nullptr; }
+
+			void close(off_t) {
+				if (base == nullptr) return;
+				munmap(base, reserved);
+				base = nullptr;
+				reserved = 0, committed = 0;
+			}
+
+			void read(void *place, size_t size, off_t offset) const {
+				size_t limit = committed.load(std::memory_order_acquire);
+				if (offset + size <= limit) {
+					memcpy(place, base + offset, size);
+					return;
+				}
+				size_t have = static_cast <size_t> (offset) < limit ? limit - offset : 0;
+				if (have != 0) memcpy(place, base + offset, have);
+				memset(static_cast <char *> (place) + have, 0, size - have);
+			}
+
+			void write(const void *place, size_t size, off_t offset) {
+				grow(offset + size, extent);
+				memcpy(base + offset, place, size);
+			}
+
+			void sync() {}
+
+			void grow(off_t end, size_t by) {
+				if (static_cast <size_t> (end) <= committed.load(std::memory_order_acquire)) return;
+				std::lock_guard <std::mutex> lock(grow_latch);
+				size_t from = committed.load(std::memory_order_relaxed);
+				if (static_cast <size_t> (end) <= from) return;
+				if (by < (64 << 10)) by = 64 << 10;
+				size_t to = (end + by - 1) / by * by;
+				if (to > reserved || mprotect(base + from, to - from, PROT_READ | PROT_WRITE) != 0) throw "out of memory";
+				committed.store(to, std::memory_order_release);
+			}
+
+			void reserve(off_t end) { grow(end, extent); }
+
+			void advise(off_t, size_t) const {}
+
+			/**
+			 * function: the pages go back to the system and read zeros from now on.
+			 */
+			void truncate() {
+				size_t limit = committed.load(std::memory_order_acquire);
+				if (limit != 0) madvise(base, limit, MADV_DONTNEED);
+			}
+
+			bool replace(MemoryStorage &other, const char *) {
+				size_t size = other.committed.load();
+				grow(size, extent);
+				memcpy(base, other.base, size);
+				size_t limit = committed.load();
+				if (limit > size) madvise(base + size, limit - size, MADV_DONTNEED);
+				other.close(-1);
+				return true;
+			}
+
+			const char *peek(off_t offset, size_t size) const {
+				return offset >= 0 && offset + size <= committed.load(std::memory_order_acquire) ? base + offset : nullptr;
+			}
+			char *poke(off_t offset, size_t size) {
+				return offset >= 0 && offset + size <= committed.load(std::memory_order_acquire) ? base + offset : nullptr;
+			}
+			int fd() const { return -1; }
+			void set_extent(size_t bytes) { extent = bytes; }
+			const blockPool *block_pool() const { return nullptr; }
+	};
+
+}  // namespace sjtu
+
+#endif //BPLUSTREE_STORAGE_H
@@ -0,0 +1,67 @@
+#ifndef BPLUSTREE_TEST_CHECK_H
+#define BPLUSTREE_TEST_CHECK_H
+
+# include <cstdio>
+# include <cstdlib>
+# include <map>
+
+/**
+ * CHECK(cond): stop the test with the place of cond if it does not hold.
+ */
+# define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		exit(1); \
+	} \
+} while (0)
+
+namespace test {
+
+	/**
+	 * function: run body, a function returning nothing; a thrown message fails the test.
+	 */
+	template <class Body>
+	int run(const char *name, Body body) {
+		try {
+			body();
+		} catch (const char *e) {
+			fprintf(stderr, "%s: threw \"%s\"\n", name, e);
+			return 1;
+		}
+		printf("%s: PASS\n", name);
+		return 0;
+	}
+
+	/**
+	 * function: tell whether tree holds exactly the pairs of ref: every key with its value, and
+	 * the values in key order when it is iterated.
+	 */
+	template <class Tree, class KeyType, class ValueType>
+	bool same(Tree &tree, const std::map <KeyType, ValueType> &ref) {
+		if (tree.size() != ref.size()) return false;
+		typename std::map <KeyType, ValueType>::const_iterator p = ref.begin();
+		for (typename Tree::iterator it = tree.begin(); it != tree.end(); ++it, ++p) {
+			if (p == ref.end()) return false;
+			if (!(it.getValue() == p -> second)) return false;
+		}
+		if (p != ref.end()) return false;
+		for (p = ref.begin(); p != ref.end(); ++p)
+			if (tree.count(p -> first) != 1 || !(tree.at(p -> first) == p -> second)) return false;
+		return true;
+	}
+
+	/**
+	 * function: remove the file path and the log and versions a tree keeps next to it.
+	 */
+	inline void remove_tree(const char *path) {
+		char name[256];
+		remove(path);
+		snprintf(name, sizeof(name), "%s.log", path);
+		remove(name);
+		snprintf(name, sizeof(name), "%s.ver", path);
+		remove(name);
+	}
+
+}  // namespace test
+
+#endif //BPLUSTREE_TEST_CHECK_H
@@ -0,0 +1,77 @@
+# include <map>
+# include <random>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// the aggregate queries of an augmented tree: the sum and the maximum of the values of a key range
+// agree with a std::map after inserts, upserts, erases and the splits and merges they cause.
+
+typedef sjtu::BTree <int, long long, std::less <int>, sjtu::sumAggregate <long long> > sum_tree;
+typedef sjtu::BTree <int, int, std::less <int>, sjtu::maxAggregate <int> > max_tree;
+
+static const char *PATH = "test_aggregate.dat";
+static const int RANGE = 40000;
+
+template <class Tree, class ValueType>
+static void mix(Tree &t, std::map <int, ValueType> &ref, std::mt19937 &gen, int n) {
+	for (int i = 0; i < n; ++i) {
+		int key = static_cast <int> (gen() % RANGE);
+		ValueType value = static_cast <ValueType> (gen() % 100000) - 50000;
+		switch (gen() % 3) {
+			case 0:
+				if (t.insert(key, value).second == sjtu::Success) ref[key] = value;
+				break;
+			case 1:
+				t.upsert(key, value);
+				ref[key] = value;
+				break;
+			default:
+				t.erase(key);
+				ref.erase(key);
+		}
+	}
+}
+
+/**
+ * function: compare aggregate(lo, hi) with the values of ref in [lo, hi) folded by combine.
+ */
+template <class Tree, class ValueType, class Aggregate>
+static void check_ranges(Tree &t, const std::map <int, ValueType> &ref, std::mt19937 &gen, Aggregate combine) {
+	for (int i = 0; i < 300; ++i) {
+		int lo = static_cast <int> (gen() % (RANGE + 20)) - 10;
+		int hi = lo + static_cast <int> (gen() % (i % 2 == 0 ? 50 : RANGE));
+		ValueType expect = combine.identity();
+		for (typename std::map <int, ValueType>::const_iterator p = ref.lower_bound(lo); p != ref.end() && p -> first < hi; ++p)
+			expect = combine(expect, p -> second);
+		CHECK(t.aggregate(lo, hi) == expect);
+	}
+	CHECK(t.aggregate(9, 9) == combine.identity());
+}
+
+template <class Tree, class ValueType, class Aggregate>
+static void check_aggregate(Aggregate combine) {
+	test::remove_tree(PATH);
+	std::map <int, ValueType> ref;
+	std::mt19937 gen(28);
+	{
+		Tree t(PATH);
+		mix(t, ref, gen, 20000);
+		t.augment();
+		check_ranges(t, ref, gen, combine);
+		mix(t, ref, gen, 80000);
+		CHECK(test::same(t, ref));
+		check_ranges(t, ref, gen, combine);
+	}
+	{
+		Tree t(PATH);
+		check_ranges(t, ref, gen, combine);
+	}
+	test::remove_tree(PATH);
+}
+
+int main() {
+	return test::run("aggregate", [] {
+		check_aggregate <sum_tree, long long> (sjtu::sumAggregate <long long> ());
+		check_aggregate <max_tree, int> (sjtu::maxAggregate <int> ());
+	});
+}
@@ -0,0 +1,71 @@
+# include <map>
+# include <utility>
+# include <vector>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// bulk loading: sorted input gives the tree of those pairs with any number of threads, and the
+// tree takes writes and opens again as usual; input with an equal or smaller key after another
+// is refused and leaves the tree as it was; empty input gives an empty tree.
+
+typedef sjtu::BTree <int, int> tree;
+typedef std::vector <std::pair <int, int> > input;
+
+static const char *PATH = "test_bulk.dat";
+
+/**
+ * function: whether bulk_load(in) throws, with nthreads threads.
+ */
+static bool refused(tree &t, input &in, int nthreads) {
+	try {
+		t.bulk_load(in.begin(), in.end(), nthreads);
+	} catch (const char *) {
+		return true;
+	}
+	return false;
+}
+
+int main() {
+	return test::run("bulk", [] {
+		int threads[] = {1, 4};
+		for (int round = 0; round < 2; ++round) {
+			test::remove_tree(PATH);
+			std::map <int, int> ref;
+			input in;
+			for (int i = 0; i < 150000; ++i) {
+				in.push_back(std::make_pair(3 * i, i));
+				ref[3 * i] = i;
+			}
+			{
+				tree t(PATH);
+				t.insert(-5, 5);         // replaced by the load
+				t.bulk_load(in.begin(), in.end(), threads[round]);
+				CHECK(test::same(t, ref));
+				for (int i = 0; i < 20000; ++i) {
+					t.insert(3 * i + 1, -i);
+					ref[3 * i + 1] = -i;
+					t.erase(3 * i + 30000);
+					ref.erase(3 * i + 30000);
+				}
+				CHECK(test::same(t, ref));
+			}
+			tree t(PATH);
+			CHECK(test::same(t, ref));
+
+			input twice = in;
+			twice.insert(twice.begin() + 1000, twice[1000]);
+			CHECK(refused(t, twice, threads[round]));
+			input unsorted = in;
+			std::swap(unsorted[70000], unsorted[70001]);
+			CHECK(refused(t, unsorted, threads[round]));
+			CHECK(test::same(t, ref));
+
+			input none;
+			t.bulk_load(none.begin(), none.end(), threads[round]);
+			CHECK(t.size() == 0 && t.begin() == t.end());
+			t.insert(1, 1);
+			CHECK(t.size() == 1 && t.at(1) == 1);
+		}
+		test::remove_tree(PATH);
+	});
+}
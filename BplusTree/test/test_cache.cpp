@@ -0,0 +1,78 @@
+# include <map>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// the hot-key cache: a second read of a key is a hit; the keys read often stay cached while a
+// scan of one-off keys goes by (TinyLFU admission); erase, modify, upsert and clear never leave
+// an old value in it; and turned off it counts nothing at all.
+
+typedef sjtu::BTree <int, int> tree;
+
+static const char *PATH = "test_cache.dat";
+static const int N = 50000;
+
+/**
+ * function: the number of hits reading every key in [from, to) once.
+ */
+static size_t hits_reading(tree &t, int from, int to) {
+	size_t before = t.cache_hits();
+	for (int key = from; key < to; ++key) CHECK(t.at(key) == key);
+	return t.cache_hits() - before;
+}
+
+int main() {
+	return test::run("cache", [] {
+		test::remove_tree(PATH);
+		std::map <int, int> ref;
+		tree t(PATH);
+		for (int i = 0; i < N; ++i) {
+			t.insert(i, i);
+			ref[i] = i;
+		}
+
+		// hits and misses
+		t.set_cache(1024);
+		CHECK(t.cache_hits() == 0 && t.cache_misses() == 0);
+		CHECK(hits_reading(t, 0, 100) == 0);
+		CHECK(t.cache_misses() == 100);
+		CHECK(hits_reading(t, 0, 100) == 100);
+		CHECK(t.count(N) == 0);
+		CHECK(t.cache_misses() == 101);
+
+		// admission: 256 hot keys read often, then 2000 keys read once each
+		t.set_cache(1024);
+		for (int round = 0; round < 10; ++round) hits_reading(t, 0, 256);
+		hits_reading(t, 1000, 3000);
+		CHECK(hits_reading(t, 0, 256) >= 240);
+
+		// coherence: every key below is cached before it is changed
+		hits_reading(t, 0, 256);
+		for (int key = 0; key < 256; key += 4) {
+			CHECK(t.erase(key) == sjtu::Success);
+			ref.erase(key);
+		}
+		for (int key = 1; key < 256; key += 4) {
+			CHECK(t.find(key).modify(-key) == sjtu::Success);
+			ref[key] = -key;
+		}
+		for (int key = 2; key < 256; key += 4) {
+			t.upsert(key, key + N);
+			ref[key] = key + N;
+		}
+		CHECK(test::same(t, ref));
+		t.clear();
+		ref.clear();
+		for (int key = 0; key < 256; ++key) CHECK(t.count(key) == 0);
+		for (int key = 0; key < 256; ++key) {
+			t.insert(key, 2 * key);
+			ref[key] = 2 * key;
+		}
+		CHECK(test::same(t, ref));
+
+		// turned off
+		t.set_cache(0);
+		for (int key = 0; key < 256; ++key) CHECK(t.at(key) == 2 * key);
+		CHECK(t.cache_hits() == 0 && t.cache_misses() == 0);
+		test::remove_tree(PATH);
+	});
+}
@@ -0,0 +1,58 @@
+# include <map>
+# include <random>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// online compaction: compact() rewrites the tree with the leaves in key order and the file
+// ending where they do, keeping every pair, and the tree takes writes as usual after it.
+
+typedef sjtu::BTree <int, int> tree;
+
+static const char *PATH = "test_compact.dat";
+
+int main() {
+	return test::run("compact", [] {
+		test::remove_tree(PATH);
+		std::map <int, int> ref;
+		std::mt19937 gen(44);
+		{
+			tree t(PATH);
+			for (int i = 0; i < 60000; ++i) {
+				int key = static_cast <int> (gen() % 200000);
+				t.upsert(key, i);
+				ref[key] = i;
+			}
+			for (std::map <int, int>::iterator p = ref.begin(); p != ref.end(); ) {
+				if (p -> first % 3 != 0) {
+					t.erase(p -> first);
+					ref.erase(p++);
+				} else {
+					++p;
+				}
+			}
+			size_t before = t.bytes();
+			t.compact(0.9);
+			CHECK(!t.compacting());
+			CHECK(t.bytes() < before);
+			CHECK(test::same(t, ref));
+
+			for (int i = 0; i < 5000; ++i) {
+				int key = static_cast <int> (gen() % 200000);
+				t.upsert(key, -i);
+				ref[key] = -i;
+			}
+			CHECK(test::same(t, ref));
+		}
+		{
+			tree t(PATH);
+			CHECK(test::same(t, ref));
+			t.compact(1.0);
+			CHECK(test::same(t, ref));
+		}
+		{
+			tree t(PATH);
+			CHECK(test::same(t, ref));
+		}
+		test::remove_tree(PATH);
+	});
+}
@@ -0,0 +1,80 @@
+# include <atomic>
+# include <map>
+# include <random>
+# include <thread>
+# include <vector>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// threads writing and reading at once through the optimistic paths: writers own the keys of their
+// residue mod WRITERS + 1 and split and merge the leaves under the readers; the keys of the last
+// residue are never written, so a reader always finds them with their values. in the end the tree
+// holds what the writers left, and no reader has thrown.
+
+typedef sjtu::BTree <int, int> tree;
+
+static const char *PATH = "test_concurrent.dat";
+static const int WRITERS = 4, READERS = 4;
+static const int STRIDE = WRITERS + 1;
+static const int RANGE = 200000;
+static const int OPS = 40000;
+
+int main() {
+	return test::run("concurrent", [] {
+		test::remove_tree(PATH);
+		std::map <int, int> ref;
+		tree t(PATH);
+		for (int key = WRITERS; key < RANGE; key += STRIDE) {
+			t.insert(key, -key);
+			ref[key] = -key;
+		}
+
+		std::vector <std::map <int, int> > own(WRITERS);
+		std::atomic <int> writing(WRITERS);
+		std::atomic <bool> failed(0);
+		std::vector <std::thread> threads;
+		for (int w = 0; w < WRITERS; ++w)
+			threads.push_back(std::thread([&, w] {
+				std::mt19937 gen(310 + w);
+				try {
+					for (int i = 0; i < OPS; ++i) {
+						int key = static_cast <int> (gen() % (RANGE / STRIDE)) * STRIDE + w;
+						switch (gen() % 3) {
+							case 0:
+								if (t.insert(key, i).second == sjtu::Success) own[w][key] = i;
+								break;
+							case 1:
+								t.upsert(key, i);
+								own[w][key] = i;
+								break;
+							default:
+								t.erase(key);
+								own[w].erase(key);
+						}
+					}
+				} catch (const char *) {
+					failed = 1;
+				}
+				--writing;
+			}));
+		for (int r = 0; r < READERS; ++r)
+			threads.push_back(std::thread([&, r] {
+				std::mt19937 gen(320 + r);
+				try {
+					while (writing > 0) {
+						int key = static_cast <int> (gen() % (RANGE / STRIDE)) * STRIDE;
+						if (t.at(key + WRITERS) != -(key + WRITERS) || t.count(key + WRITERS) != 1) failed = 1;
+						t.count(key + static_cast <int> (gen() % WRITERS));
+					}
+				} catch (const char *) {
+					failed = 1;
+				}
+			}));
+		for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+		CHECK(!failed);
+
+		for (int w = 0; w < WRITERS; ++w) ref.insert(own[w].begin(), own[w].end());
+		CHECK(test::same(t, ref));
+		test::remove_tree(PATH);
+	});
+}
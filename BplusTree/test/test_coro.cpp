@@ -0,0 +1,93 @@
+# include <map>
+# include <vector>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// the coroutines: many co_find, co_insert and co_scan in flight on one ioService at once, each
+// giving what the blocking function does; built only with C++20.
+
+typedef sjtu::BTree <int, int> tree;
+
+static const char *PATH = "test_coro.dat";
+static const int N = 40000;
+static const int FLIGHT = 64;             // tasks in flight at once
+
+/**
+ * function: start every task, then run the service until all of them are done.
+ */
+template <class T>
+static void run_all(sjtu::ioService &io, std::vector <sjtu::task <T> > &tasks) {
+	for (size_t i = 0; i < tasks.size(); ++i) tasks[i].start();
+	io.run();
+	for (size_t i = 0; i < tasks.size(); ++i) CHECK(tasks[i].done());
+}
+
+int main() {
+	return test::run("coro", [] {
+		test::remove_tree(PATH);
+		std::map <int, int> ref;
+		tree t(PATH);
+		for (int i = 0; i < N; ++i) {
+			t.insert(2 * i, i);
+			ref[2 * i] = i;
+		}
+		sjtu::ioService io(4);
+
+		// co_find: keys that are there and keys that are not
+		for (int round = 0; round < 10; ++round) {
+			std::vector <sjtu::task <bool> > tasks;
+			int value[FLIGHT];
+			for (int i = 0; i < FLIGHT; ++i) tasks.push_back(t.co_find(io, (round * 7919 + i * 1237) % (2 * N), &value[i]));
+			run_all(io, tasks);
+			for (int i = 0; i < FLIGHT; ++i) {
+				int key = (round * 7919 + i * 1237) % (2 * N);
+				CHECK(tasks[i].get() == (t.count(key) == 1));
+				if (tasks[i].get()) CHECK(value[i] == t.at(key));
+			}
+		}
+
+		// co_insert: new keys, and keys already there
+		for (int round = 0; round < 10; ++round) {
+			std::vector <sjtu::task <sjtu::OperationResult> > tasks;
+			for (int i = 0; i < FLIGHT; ++i) tasks.push_back(t.co_insert(io, round * 4000 + i * 61, -i));
+			run_all(io, tasks);
+			for (int i = 0; i < FLIGHT; ++i) {
+				int key = round * 4000 + i * 61;
+				bool fresh = ref.count(key) == 0;
+				CHECK((tasks[i].get() == sjtu::Success) == fresh);
+				if (fresh) ref[key] = -i;
+			}
+		}
+		CHECK(test::same(t, ref));
+
+		// co_scan: ranges, some empty, compared with the pairs in order
+		std::vector <std::vector <int> > seen(FLIGHT);
+		std::vector <sjtu::task <size_t> > tasks;
+		for (int i = 0; i < FLIGHT; ++i) {
+			std::vector <int> *out = &seen[i];
+			int lo = i * 1300 - 500, hi = lo + (i % 8) * 700;
+			tasks.push_back(t.co_scan(io, lo, hi, [out](const int &key, const int &value) {
+				out -> push_back(key);
+				out -> push_back(value);
+			}));
+		}
+		run_all(io, tasks);
+		for (int i = 0; i < FLIGHT; ++i) {
+			int lo = i * 1300 - 500, hi = lo + (i % 8) * 700;
+			std::vector <int> expect;
+			for (std::map <int, int>::iterator p = ref.lower_bound(lo); p != ref.end() && p -> first < hi; ++p) {
+				expect.push_back(p -> first);
+				expect.push_back(p -> second);
+			}
+			CHECK(tasks[i].get() == expect.size() / 2);
+			CHECK(seen[i] == expect);
+		}
+
+		// one at a time through sync_wait
+		int value;
+		CHECK(sjtu::sync_wait(io, t.co_find(io, 2 * 123, &value)) && value == ref[2 * 123]);
+		CHECK(sjtu::sync_wait(io, t.co_insert(io, -1, 1)) == sjtu::Success);
+		CHECK(t.at(-1) == 1);
+		test::remove_tree(PATH);
+	});
+}
@@ -0,0 +1,72 @@
+# include <cstdio>
+# include <map>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// the Database catalog: several named trees in one file, found again by name when the file is
+// opened again; a dropped tree is gone, and its chunks are used again by the next tree.
+
+typedef sjtu::BTree <int, int> tree;
+
+static const char *PATH = "test_database.db";
+
+static void remove_all() {
+	remove(PATH);
+	const char *names[] = {"a", "b", "c"};
+	for (int i = 0; i < 3; ++i) {
+		char name[64];
+		snprintf(name, sizeof(name), "%s.%s", PATH, names[i]);
+		test::remove_tree(name);
+	}
+}
+
+int main() {
+	return test::run("database", [] {
+		remove_all();
+		std::map <int, int> ra, rb;
+		{
+			sjtu::Database db(PATH, 4 << 20);
+			tree a(db, "a"), b(db, "b");
+			for (int i = 0; i < 30000; ++i) {
+				a.insert(i, i);
+				ra[i] = i;
+				b.insert(-i, 2 * i);
+				rb[-i] = 2 * i;
+			}
+			bool thrown = 0;
+			try {
+				tree again(db, "a");
+			} catch (const char *) {
+				thrown = 1;
+			}
+			CHECK(thrown);
+		}
+		size_t chunks;
+		{
+			sjtu::Database db(PATH, 4 << 20);
+			CHECK(db.trees() == 2);
+			{
+				tree a(db, "a"), b(db, "b");
+				CHECK(test::same(a, ra));
+				CHECK(test::same(b, rb));
+			}
+			chunks = db.chunks();
+			CHECK(db.drop("b"));
+			CHECK(!db.drop("b"));
+			CHECK(db.trees() == 1);
+			{
+				tree c(db, "c");
+				for (int i = 0; i < 30000; ++i) c.insert(i, -i);
+			}
+			CHECK(db.chunks() <= chunks);
+		}
+		{
+			sjtu::Database db(PATH, 4 << 20);
+			CHECK(db.trees() == 2);
+			tree a(db, "a"), c(db, "c");
+			CHECK(test::same(a, ra));
+			CHECK(c.size() == 30000 && c.at(12345) == -12345);
+		}
+		remove_all();
+	});
+}
@@ -0,0 +1,124 @@
+# include <map>
+# include <random>
+# include <sys/types.h>
+# include <sys/wait.h>
+# include <unistd.h>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// the memtable: writes kept in memory and in the log read like the tree; a process that dies
+// without closing the tree loses none of them, the log is replayed on open; and the key filter
+// in front of it never says a key of the tree is not there.
+
+typedef sjtu::BTree <int, int> tree;
+
+static const char *PATH = "test_memtable.dat";
+
+/**
+ * function: n inserts, upserts and erases, done to t and ref alike.
+ */
+template <class Tree>
+static void mix(Tree &t, std::map <int, int> &ref, unsigned seed, int n) {
+	std::mt19937 gen(seed);
+	for (int i = 0; i < n; ++i) {
+		int key = static_cast <int> (gen() % 30000);
+		switch (gen() % 3) {
+			case 0:
+				if (t.insert(key, i).second == sjtu::Success) {
+					CHECK(ref.count(key) == 0);
+					ref[key] = i;
+				} else {
+					CHECK(ref.count(key) == 1);
+				}
+				break;
+			case 1:
+				t.upsert(key, i);
+				ref[key] = i;
+				break;
+			default:
+				CHECK((t.erase(key) == sjtu::Success) == (ref.erase(key) == 1));
+		}
+	}
+}
+
+// the same writes without a tree, to know what the crashed one held
+struct model {
+	std::map <int, int> m;
+	sjtu::pair <int, sjtu::OperationResult> insert(int key, int value) {
+		return sjtu::pair <int, sjtu::OperationResult> (0, m.insert(std::make_pair(key, value)).second ? sjtu::Success : sjtu::Fail);
+	}
+	void upsert(int key, int value) { m[key] = value; }
+	sjtu::OperationResult erase(int key) { return m.erase(key) == 1 ? sjtu::Success : sjtu::Fail; }
+};
+
+/**
+ * function: in a child process, do the writes of seed to a tree with a memtable of capacity keys
+ * and die without closing it.
+ */
+static void crash_after(unsigned seed, size_t capacity) {
+	pid_t pid = fork();
+	CHECK(pid >= 0);
+	if (pid == 0) {
+		std::map <int, int> ref;
+		tree *t = new tree(PATH);
+		t -> set_memtable(capacity);
+		mix(*t, ref, seed, 40000);
+		_exit(0);                 // no destructor: the memtable is not merged
+	}
+	int status;
+	CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main() {
+	return test::run("memtable", [] {
+		// no false negatives: every key added is said to be there
+		{
+			sjtu::keyFilter <int> filter;
+			filter.reset(20000);
+			for (int key = 0; key < 60000; key += 3) filter.add(key);
+			int wrong = 0;
+			for (int key = 0; key < 60000; ++key) {
+				if (key % 3 == 0) CHECK(filter.may_contain(key));
+				else wrong += filter.may_contain(key);
+			}
+			CHECK(wrong < 40000 / 20);
+		}
+
+		// reads through the memtable, and inserts of keys already there, which the filter must see
+		test::remove_tree(PATH);
+		std::map <int, int> ref;
+		{
+			tree t(PATH);
+			mix(t, ref, 30, 20000);
+			t.set_memtable(4096);
+			mix(t, ref, 31, 60000);
+			CHECK(test::same(t, ref));
+			for (std::map <int, int>::iterator p = ref.begin(); p != ref.end(); ++p)
+				CHECK(t.insert(p -> first, 0).second == sjtu::Fail);
+			t.merge();
+			CHECK(test::same(t, ref));
+		}
+		{
+			tree t(PATH);
+			CHECK(test::same(t, ref));
+		}
+
+		// log replay: once with the whole run in the log, once with merges in between
+		size_t capacity[] = {100000, 1000};
+		for (int i = 0; i < 2; ++i) {
+			test::remove_tree(PATH);
+			ref.clear();
+			crash_after(32 + i, capacity[i]);
+			model crashed;
+			mix(crashed, ref, 32 + i, 40000);
+			{
+				tree t(PATH);
+				CHECK(test::same(t, ref));
+				mix(t, ref, 40 + i, 10000);
+			}
+			tree t(PATH);
+			CHECK(test::same(t, ref));
+		}
+		test::remove_tree(PATH);
+	});
+}
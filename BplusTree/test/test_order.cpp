@@ -0,0 +1,95 @@
+# include <iterator>
+# include <map>
+# include <random>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// the order statistics of an augmented tree: rank, select and count_range agree with a std::map
+// after inserts, erases and the splits and merges they cause, and after the tree is opened again.
+
+typedef sjtu::BTree <int, int> tree;
+
+static const char *PATH = "test_order.dat";
+
+/**
+ * function: n inserts, upserts and erases of keys below range, done to t and ref alike.
+ */
+static void mix(tree &t, std::map <int, int> &ref, std::mt19937 &gen, int n, int range) {
+	for (int i = 0; i < n; ++i) {
+		int key = static_cast <int> (gen() % range);
+		switch (gen() % 3) {
+			case 0:
+				if (t.insert(key, i).second == sjtu::Success) ref[key] = i;
+				break;
+			case 1:
+				t.upsert(key, i);
+				ref[key] = i;
+				break;
+			default:
+				t.erase(key);
+				ref.erase(key);
+		}
+	}
+}
+
+/**
+ * function: check rank, select and count_range at some places against ref.
+ */
+static void check_order(tree &t, const std::map <int, int> &ref, std::mt19937 &gen, int range) {
+	CHECK(t.size() == ref.size());
+	for (int i = 0; i < 200; ++i) {
+		int key = static_cast <int> (gen() % (range + 20)) - 10;
+		size_t below = std::distance(ref.begin(), ref.lower_bound(key));
+		CHECK(t.rank(key) == below);
+
+		size_t k = gen() % (ref.size() + 5);
+		if (k < ref.size()) {
+			std::map <int, int>::const_iterator p = ref.begin();
+			std::advance(p, k);
+			CHECK(t.select(k).getValue() == p -> second);
+		} else {
+			CHECK(t.select(k) == t.end());
+		}
+
+		int lo = static_cast <int> (gen() % (range + 20)) - 10, hi = lo + static_cast <int> (gen() % (range / 4));
+		size_t in = lo < hi ? std::distance(ref.lower_bound(lo), ref.lower_bound(hi)) : 0;
+		CHECK(t.count_range(lo, hi) == in);
+	}
+	CHECK(t.count_range(5, 5) == 0 && t.count_range(7, 3) == 0);
+}
+
+int main() {
+	return test::run("order", [] {
+		test::remove_tree(PATH);
+		std::map <int, int> ref;
+		std::mt19937 gen(27);
+		{
+			tree t(PATH);
+			bool thrown = 0;
+			try {
+				t.rank(0);
+			} catch (const char *) {
+				thrown = 1;
+			}
+			CHECK(thrown);
+			mix(t, ref, gen, 30000, 20000);
+			t.augment();
+			check_order(t, ref, gen, 20000);
+			mix(t, ref, gen, 60000, 40000);   // grows, so leaves and internal nodes split
+			check_order(t, ref, gen, 40000);
+			for (int key = 0; key < 40000; ++key)
+				if (key % 7 != 0) {
+					t.erase(key);
+					ref.erase(key);
+				}
+			check_order(t, ref, gen, 40000);
+		}
+		{
+			tree t(PATH);
+			check_order(t, ref, gen, 40000);
+			mix(t, ref, gen, 20000, 40000);
+			check_order(t, ref, gen, 40000);
+		}
+		test::remove_tree(PATH);
+	});
+}
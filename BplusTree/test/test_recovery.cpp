@@ -0,0 +1,82 @@
+# include <map>
+# include <sys/types.h>
+# include <sys/wait.h>
+# include <unistd.h>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// crash recovery with shadow paging: a child process writes and commits, then dies in the middle
+// of more writes without closing the tree; the file must open in the state of the last commit.
+
+typedef sjtu::BTree <int, int> tree;
+
+static const char *PATH = "test_recovery.dat";
+static const int COMMITS = 150;           // more than MAP_PIECES, so the page map is written whole again
+
+/**
+ * function: the writes of round r, done to the tree and to the model alike. most rounds touch a
+ * few leaves, so their commits write small pieces of the page map that a recovery has to chain.
+ */
+template <class Map>
+static void round_of(Map &t, int r) {
+	int writes = r % 10 == 0 ? 200 : 3;
+	for (int i = 0; i < writes; ++i) {
+		int key = (r * 7919 + i * 104729) % 20000;
+		if (i % 5 == 4) t.erase(key);
+		else t.upsert(key, r * 1000 + i);
+	}
+}
+
+struct model {
+	std::map <int, int> m;
+	void erase(int key) { m.erase(key); }
+	void upsert(int key, int value) { m[key] = value; }
+};
+
+/**
+ * function: commit COMMITS rounds, then die after half of one more, in a child process.
+ */
+static void crash_after(int from, int to) {
+	pid_t pid = fork();
+	CHECK(pid >= 0);
+	if (pid == 0) {
+		tree *t = new tree(PATH);
+		t -> set_shadow_paging(0);
+		for (int r = from; r < to; ++r) {
+			round_of(*t, r);
+			t -> commit();
+		}
+		for (int i = 0; i < 5000; ++i) t -> upsert(i, -i);       // never committed
+		_exit(0);                 // no destructor: nothing is flushed or committed on the way out
+	}
+	int status;
+	CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main() {
+	return test::run("recovery", [] {
+		test::remove_tree(PATH);
+		model ref;
+		crash_after(0, COMMITS);
+		for (int r = 0; r < COMMITS; ++r) round_of(ref, r);
+		{
+			tree t(PATH);
+			CHECK(test::same(t, ref.m));
+		}
+
+		// the space the recovered tree takes again must not overlap what it still uses
+		crash_after(COMMITS, 2 * COMMITS);
+		for (int r = COMMITS; r < 2 * COMMITS; ++r) round_of(ref, r);
+		{
+			tree t(PATH);
+			CHECK(test::same(t, ref.m));
+			round_of(t, 2 * COMMITS);
+			round_of(ref, 2 * COMMITS);
+		}
+		{
+			tree t(PATH);
+			CHECK(test::same(t, ref.m));
+		}
+		test::remove_tree(PATH);
+	});
+}
@@ -0,0 +1,65 @@
+# include <algorithm>
+# include <map>
+# include <mutex>
+# include <thread>
+# include <utility>
+# include <vector>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// the parallel scan: the pairs it visits from several threads are those of a sequential scan of
+// the range, each once; each thread visits its own in key order.
+
+typedef sjtu::BTree <int, int> tree;
+typedef std::vector <std::pair <int, int> > pairs;
+
+static const char *PATH = "test_scan.dat";
+
+/**
+ * function: parallel_scan(lo, hi) with nthreads threads, checked against ref.
+ */
+static void check_scan(const tree &t, const std::map <int, int> &ref, int lo, int hi, int nthreads) {
+	std::mutex latch;
+	std::map <std::thread::id, pairs> seen;
+	t.parallel_scan(lo, hi, nthreads, [&](const int &key, const int &value) {
+		std::lock_guard <std::mutex> lock(latch);
+		seen[std::this_thread::get_id()].push_back(std::make_pair(key, value));
+	});
+	pairs all;
+	for (std::map <std::thread::id, pairs>::iterator p = seen.begin(); p != seen.end(); ++p) {
+		for (size_t i = 1; i < p -> second.size(); ++i) CHECK(p -> second[i - 1].first < p -> second[i].first);
+		all.insert(all.end(), p -> second.begin(), p -> second.end());
+	}
+	std::sort(all.begin(), all.end());
+	pairs expect;
+	for (std::map <int, int>::const_iterator p = ref.lower_bound(lo); p != ref.end() && p -> first < hi; ++p)
+		expect.push_back(*p);
+	CHECK(all == expect);
+	if (nthreads == 1) CHECK(seen.size() <= 1);
+}
+
+int main() {
+	return test::run("scan", [] {
+		test::remove_tree(PATH);
+		std::map <int, int> ref;
+		tree t(PATH);
+		for (int i = 0; i < 200000; ++i) {
+			int key = static_cast <int> ((i * 2654435761u) % 1000000);
+			t.upsert(key, i);
+			ref[key] = i;
+		}
+		for (int key = 0; key < 1000000; key += 7) {
+			t.erase(key);
+			ref.erase(key);
+		}
+		CHECK(test::same(t, ref));
+		int threads[] = {1, 3, 8};
+		for (int i = 0; i < 3; ++i) {
+			check_scan(t, ref, -10, 2000000, threads[i]);
+			check_scan(t, ref, 123457, 654321, threads[i]);
+			check_scan(t, ref, 500000, 500050, threads[i]);
+			check_scan(t, ref, 42, 42, threads[i]);
+		}
+		test::remove_tree(PATH);
+	});
+}
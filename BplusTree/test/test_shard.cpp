@@ -0,0 +1,111 @@
+# include <cstdio>
+# include <map>
+# include <random>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// the sharded tree: every key is kept in the one shard it is routed to, by hash or by range; the
+// merged iterator gives all the pairs in key order; and the shards in path.0, path.1, ... open
+// again with their pairs.
+
+typedef sjtu::ShardedBTree <int, int> sharded;
+
+static const char *PATH = "test_shard.dat";
+static const int SHARDS = 4;
+
+static void remove_all() {
+	for (int i = 0; i < SHARDS; ++i) {
+		char name[64];
+		snprintf(name, sizeof(name), "%s.%d", PATH, i);
+		test::remove_tree(name);
+	}
+}
+
+static void mix(sharded &t, std::map <int, int> &ref, unsigned seed) {
+	std::mt19937 gen(seed);
+	for (int i = 0; i < 60000; ++i) {
+		int key = static_cast <int> (gen() % 40000) - 5000;
+		switch (gen() % 3) {
+			case 0:
+				if (t.insert(key, i) == sjtu::Success) ref[key] = i;
+				break;
+			case 1:
+				t.upsert(key, i);
+				ref[key] = i;
+				break;
+			default:
+				CHECK((t.erase(key) == sjtu::Success) == (ref.erase(key) == 1));
+		}
+	}
+}
+
+/**
+ * function: compare t with ref, every key in shard_of(key) and in no other shard; with range
+ * sharding, in the shard whose range holds it.
+ */
+static void check_sharded(sharded &t, const std::map <int, int> &ref, const int *split) {
+	CHECK(t.size() == ref.size());
+	size_t sum = 0;
+	for (int i = 0; i < SHARDS; ++i) sum += t.shard_at(i).size();
+	CHECK(sum == ref.size());
+	for (std::map <int, int>::const_iterator p = ref.begin(); p != ref.end(); ++p) {
+		CHECK(t.at(p -> first) == p -> second);
+		CHECK(t.shard_of(p -> first).count(p -> first) == 1);
+		int in = 0;
+		for (int i = 0; i < SHARDS; ++i) in += t.shard_at(i).count(p -> first) == 1 ? i + 1 : 0;
+		CHECK(in != 0 && &t.shard_at(in - 1) == &t.shard_of(p -> first));
+		if (split != nullptr)
+			CHECK((in == 1 || split[in - 2] <= p -> first) && (in == SHARDS || p -> first < split[in - 1]));
+	}
+	std::map <int, int>::const_iterator p = ref.begin();
+	for (sharded::iterator it = t.begin(); it.valid(); ++it, ++p) {
+		CHECK(p != ref.end() && it.getKey() == p -> first && it.getValue() == p -> second);
+	}
+	CHECK(p == ref.end());
+	p = ref.lower_bound(1234);
+	for (sharded::iterator it = t.range(1234, 23456); it.valid(); ++it, ++p)
+		CHECK(it.getKey() == p -> first && it.getValue() == p -> second);
+	CHECK(p == ref.lower_bound(23456));
+}
+
+int main() {
+	return test::run("shard", [] {
+		// hash sharding
+		remove_all();
+		std::map <int, int> ref;
+		{
+			sharded t(SHARDS, PATH);
+			mix(t, ref, 38);
+			check_sharded(t, ref, nullptr);
+		}
+		{
+			sharded t(SHARDS, PATH);
+			check_sharded(t, ref, nullptr);
+			mix(t, ref, 39);
+			check_sharded(t, ref, nullptr);
+		}
+
+		// range sharding
+		remove_all();
+		ref.clear();
+		int split[SHARDS - 1] = {0, 10000, 20000};
+		{
+			sharded t(split, SHARDS - 1, PATH);
+			mix(t, ref, 40);
+			check_sharded(t, ref, split);
+		}
+		{
+			sharded t(split, SHARDS - 1, PATH);
+			check_sharded(t, ref, split);
+		}
+		int unsorted[2] = {5, 5};
+		bool thrown = 0;
+		try {
+			sharded t(unsorted, 2, PATH);
+		} catch (const char *) {
+			thrown = 1;
+		}
+		CHECK(thrown);
+		remove_all();
+	});
+}
@@ -0,0 +1,70 @@
+# include <map>
+# include <vector>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// MVCC snapshots: a view keeps showing the pairs of the moment it was opened while the tree
+// changes under it, and the old nodes it kept are freed once it is gone.
+
+typedef sjtu::BTree <int, int> tree;
+
+static const char *PATH = "test_snapshot.dat";
+
+/**
+ * function: tell whether view v holds exactly the pairs of ref, by lookups and by a scan.
+ */
+static bool view_is(const tree::view &v, const std::map <int, int> &ref) {
+	if (v.size() != ref.size()) return false;
+	for (std::map <int, int>::const_iterator p = ref.begin(); p != ref.end(); ++p)
+		if (v.count(p -> first) != 1 || v.at(p -> first) != p -> second) return false;
+	std::vector <std::pair <int, int> > seen;
+	v.scan(-1, 1 << 30, [&](const int &key, const int &value) { seen.push_back(std::make_pair(key, value)); });
+	return seen == std::vector <std::pair <int, int> > (ref.begin(), ref.end());
+}
+
+int main() {
+	return test::run("snapshot", [] {
+		test::remove_tree(PATH);
+		tree t(PATH);
+		std::map <int, int> ref;
+		for (int i = 0; i < 20000; ++i) {
+			t.insert(i, i);
+			ref[i] = i;
+		}
+		std::map <int, int> first = ref;
+		{
+			tree::view a = t.snapshot();
+			for (int i = 0; i < 20000; i += 2) {
+				t.erase(i);
+				ref.erase(i);
+			}
+			for (int i = 1; i < 20000; i += 2) {
+				t.upsert(i, -i);
+				ref[i] = -i;
+			}
+			std::map <int, int> second = ref;
+			{
+				tree::view b = t.snapshot();
+				for (int i = 20000; i < 40000; ++i) {
+					t.insert(i, i);
+					ref[i] = i;
+				}
+				CHECK(t.retained() > 0);
+				CHECK(view_is(a, first));
+				CHECK(view_is(b, second));
+				CHECK(a.count(20000) == 0 && b.count(20000) == 0);
+				bool thrown = 0;
+				try {
+					t.clear();
+				} catch (const char *) {
+					thrown = 1;
+				}
+				CHECK(thrown);
+			}
+			CHECK(view_is(a, first));
+		}
+		CHECK(t.retained() == 0);
+		CHECK(test::same(t, ref));
+		test::remove_tree(PATH);
+	});
+}
@@ -0,0 +1,96 @@
+# include <atomic>
+# include <cstdio>
+# include <map>
+# include <thread>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// the spilling tree: it stays in memory within its budget, moves to its file past it with every
+// pair, answers reads all through the move, and goes back to memory when cleared.
+
+typedef sjtu::SpillBTree <int, int> spill_tree;
+
+static const char *PATH = "test_spill.dat";
+
+/**
+ * function: tell whether t holds exactly the pairs of ref, in key order through fetch().
+ */
+static bool same(spill_tree &t, const std::map <int, int> &ref) {
+	if (t.size() != ref.size()) return false;
+	std::map <int, int>::const_iterator p = ref.begin();
+	int key[100], value[100], n;
+	int last = 0;
+	bool first = 1;
+	while ((n = t.fetch(first ? nullptr : &last, !first, key, value, 100)) > 0) {
+		for (int i = 0; i < n; ++i, ++p)
+			if (p == ref.end() || key[i] != p -> first || value[i] != p -> second) return false;
+		last = key[n - 1], first = 0;
+	}
+	if (p != ref.end()) return false;
+	for (p = ref.begin(); p != ref.end(); ++p)
+		if (t.count(p -> first) != 1 || t.at(p -> first) != p -> second) return false;
+	return true;
+}
+
+int main() {
+	return test::run("spill", [] {
+		test::remove_tree(PATH);
+		std::map <int, int> ref;
+		{
+			spill_tree t(PATH, 1 << 20);
+			int key = 0;
+			for (; !t.spilled(); ++key) {
+				CHECK(t.bytes() <= t.limit());
+				t.insert(key * 3, key);
+				ref[key * 3] = key;
+			}
+			CHECK(t.bytes() > 0 && same(t, ref));
+			FILE *fp = fopen(PATH, "rb");
+			CHECK(fp != nullptr);
+			fclose(fp);
+			for (int i = 0; i < 20000; ++i) {
+				t.upsert(i * 5, -i);
+				ref[i * 5] = -i;
+				if (i % 2 == 0) {
+					t.erase(i * 7);
+					ref.erase(i * 7);
+				}
+			}
+			CHECK(same(t, ref));
+
+			// back to memory, then reads from another thread while spill() moves the pairs
+			t.clear();
+			ref.clear();
+			CHECK(!t.spilled() && t.size() == 0);
+			for (int i = 0; i < 20000; ++i) {
+				t.insert(i, 2 * i);
+				ref[i] = 2 * i;
+			}
+			CHECK(!t.spilled());
+			std::atomic <bool> done(0), failed(0);
+			std::atomic <int> reads(0);
+			std::thread reader([&] {
+				try {
+					for (int i = 0; !done || i < 1000; ++i) {
+						int key = (i * 7919) % 20000;
+						if (t.count(key) != 1 || t.at(key) != 2 * key) failed = 1;
+						++reads;
+					}
+				} catch (const char *) {
+					failed = 1;
+				}
+			});
+			while (reads < 100) std::this_thread::yield();
+			t.set_load_threads(2);
+			t.spill();
+			CHECK(t.spilled());
+			done = 1;
+			reader.join();
+			CHECK(!failed);
+			CHECK(same(t, ref));
+		}
+		FILE *fp = fopen(PATH, "rb");
+		CHECK(fp == nullptr);             // the file was scratch
+		test::remove_tree(PATH);
+	});
+}
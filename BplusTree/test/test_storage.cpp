@@ -0,0 +1,64 @@
+# include <map>
+# include <random>
+# include "BTree.hpp"
+# include "check.hpp"
+
+// the storage policies: the same mix of writes gives the same tree in a file, in a mapped file
+// and in memory; the file-backed ones open again as they were closed.
+
+static const char *PATH = "test_storage.dat";
+
+/**
+ * function: a mix of inserts, upserts and erases, enough to split and merge leaves and
+ * internal nodes, done to t and ref alike.
+ */
+template <class Tree>
+static void mix(Tree &t, std::map <int, int> &ref, unsigned seed) {
+	std::mt19937 gen(seed);
+	for (int i = 0; i < 80000; ++i) {
+		int key = static_cast <int> (gen() % 40000);
+		switch (gen() % 4) {
+			case 0:
+				if (t.insert(key, i).second == sjtu::Success) {
+					CHECK(ref.count(key) == 0);
+					ref[key] = i;
+				} else {
+					CHECK(ref.count(key) == 1);
+				}
+				break;
+			case 1:
+				t.upsert(key, i);
+				ref[key] = i;
+				break;
+			default:
+				CHECK((t.erase(key) == sjtu::Success) == (ref.erase(key) == 1));
+		}
+	}
+}
+
+template <class Storage>
+static void check_storage(bool reopen) {
+	typedef sjtu::BTree <int, int, std::less <int>, sjtu::noAggregate, Storage> tree;
+	test::remove_tree(PATH);
+	std::map <int, int> ref;
+	{
+		tree t(PATH);
+		mix(t, ref, 49);
+		CHECK(test::same(t, ref));
+	}
+	if (reopen) {
+		tree t(PATH);
+		CHECK(test::same(t, ref));
+		mix(t, ref, 50);
+		CHECK(test::same(t, ref));
+	}
+	test::remove_tree(PATH);
+}
+
+int main() {
+	return test::run("storage", [] {
+		check_storage <sjtu::FileStorage> (1);
+		check_storage <sjtu::MmapStorage> (1);
+		check_storage <sjtu::MemoryStorage> (0);
+	});
+}
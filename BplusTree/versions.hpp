@@ -0,0 +1,245 @@
+#ifndef BPLUSTREE_VERSIONS_H
+#define BPLUSTREE_VERSIONS_H
+
+# include <atomic>
+# include <cstddef>
+# include <cstdint>
+# include <cstdio>
+# include <mutex>
+# include <sys/types.h>
+# include <unistd.h>
+# include "io.hpp"
+# include "skiplist.hpp"
+
+namespace sjtu {
+
+	/**
+	 * Old versions of the pages of a file, kept for snapshots (multi-version concurrency control).
+	 * every snapshot gets an epoch; the writes made after it belong to a later epoch.
+	 * before a page is written for the first time in an epoch while a snapshot still reads its
+	 * current content, preserve() copies the page to a slot of a side file, tagged with that epoch.
+	 * a snapshot of epoch e reads the oldest copy tagged after e, or the page itself if there is none.
+	 * a copy tagged w is only read by snapshots older than w, so it is reclaimed when the oldest
+	 * open snapshot is not older than w, and the side file is emptied when the last one closes.
+	 * nobody waits for I/O of anybody else: the latch only covers the bookkeeping.
+	 */
+	class versionStore {
+		private:
+			struct version {
+				uint64_t epoch;       // written in this epoch, the copy is the content before
+				size_t slot;          // place in the side file, in pages
+				version *nxt;         // older version
+			};
+
+			const char *name;
+			FILE *fp;
+			size_t page;              // bytes of a slot, the biggest page written
+			skipList <ssize_t, version *> table;    // offset -> versions, newest first
+			size_t slots;             // slots in the side file
+			size_t *free_slot;
+			int free_cnt, free_cap;
+			uint64_t *live;           // epochs of the open snapshots
+			int live_cnt, live_cap;
+			uint64_t epoch;           // epoch of the writes now
+			uint64_t newest;          // epoch of the newest open snapshot
+			ssize_t horizon;          // pages from here on are newer than every open snapshot
+			uint64_t generation;      // bumped whenever everything is dropped
+			std::atomic <int> open_cnt;
+			mutable std::mutex latch;
+
+			size_t take_slot() {
+				if (free_cnt > 0) return free_slot[--free_cnt];
+				return slots++;
+			}
+
+			void give_slot(size_t slot) {
+				if (free_cnt == free_cap) {
+					free_cap = free_cap == 0 ? 16 : free_cap * 2;
+					size_t *tmp = new size_t[free_cap];
+					for (int i = 0; i < free_cnt; ++i) tmp[i] = free_slot[i];
+					delete [] free_slot;
+					free_slot = tmp;
+				}
+				free_slot[free_cnt++] = slot;
+			}
+
+			/**
+			 * function: free the versions of a list tagged oldest or before (all of them if all), return the rest.
+			 */
+			version *cut(version *head, uint64_t oldest, bool all) {
+				version **p = &head;
+				while (*p != nullptr && !all && (*p) -> epoch > oldest) p = &(*p) -> nxt;
+				version *q = *p;
+				*p = nullptr;
+				while (q != nullptr) {
+					version *r = q -> nxt;
+					if (!all) give_slot(q -> slot);
+					delete q;
+					q = r;
+				}
+				return head;
+			}
+
+			/**
+			 * function: free every version and give the side file back to the file system.
+			 * it runs in the destructors (of a view, through release(), and of the store), so it does
+			 * not throw: if the truncate fails the file only stays longer than it needs, its slots are
+			 * used again from 0 all the same.
+			 */
+			void drop_all() {
+				table.traverse([this](const ssize_t &, version *&head) { head = cut(head, 0, 1); });
+				table.clear();
+				slots = 0;
+				free_cnt = 0;
+				++generation;
+				if (fp != nullptr) {
+					int ret = ftruncate(fileno(fp), 0);
+					(void) ret;
+				}
+			}
+
+		public:
+			versionStore() : name(nullptr), fp(nullptr), page(0), slots(0), free_slot(nullptr), free_cnt(0), free_cap(0),
+			                 live(nullptr), live_cnt(0), live_cap(0), epoch(0), newest(0), horizon(0),
+			                 generation(0), open_cnt(0) {}
+
+			versionStore(const versionStore &) = delete;
+			versionStore &operator=(const versionStore &) = delete;
+
+			~versionStore() {
+				drop_all();
+				delete [] free_slot;
+				delete [] live;
+				if (fp != nullptr) {
+					fclose(fp);
+					remove(name);
+				}
+			}
+
+			/**
+			 * function: set the side file and the biggest page; it is created by the first snapshot.
+			 */
+			void bind(const char *_name, size_t _page) {
+				name = _name;
+				page = _page;
+			}
+
+			bool active() const { return open_cnt.load(std::memory_order_acquire) != 0; }
+
+			/**
+			 * function: open a snapshot of the pages below eof, return its epoch.
+			 * the caller makes sure no page is being written meanwhile.
+			 */
+			uint64_t acquire(ssize_t eof) {
+				std::lock_guard <std::mutex> lock(latch);
+				if (fp == nullptr) {
+					fp = fopen(name, "w+b");
+					if (fp == nullptr) throw "open version file failed";
+				}
+				if (live_cnt == live_cap) {
+					live_cap = live_cap == 0 ? 4 : live_cap * 2;
+					uint64_t *tmp = new uint64_t[live_cap];
+					for (int i = 0; i < live_cnt; ++i) tmp[i] = live[i];
+					delete [] live;
+					live = tmp;
+				}
+				uint64_t ret = epoch++;
+				live[live_cnt++] = ret;
+				newest = ret;
+				if (eof > horizon) horizon = eof;
+				open_cnt.store(live_cnt, std::memory_order_release);
+				return ret;
+			}
+
+			/**
+			 * function: close the snapshot of epoch e, reclaim the versions nobody can read any more.
+			 * it does not throw, a view calls it when it is destroyed.
+			 */
+			void release(uint64_t e) {
+				std::lock_guard <std::mutex> lock(latch);
+				for (int i = 0; i < live_cnt; ++i)
+					if (live[i] == e) {
+						live[i] = live[--live_cnt];
+						break;
+					}
+				open_cnt.store(live_cnt, std::memory_order_release);
+				if (live_cnt == 0) {
+					drop_all();
+					horizon = 0;
+					return;
+				}
+				uint64_t oldest = live[0];
+				newest = live[0];
+				for (int i = 1; i < live_cnt; ++i) {
+					if (live[i] < oldest) oldest = live[i];
+					if (live[i] > newest) newest = live[i];
+				}
+				table.traverse([this, oldest](const ssize_t &, version *&head) { head = cut(head, oldest, 0); });
+			}
+
+			/**
+			 * function: keep the content of the page [offset, offset + size), it is written next.
+			 * fetch(buf) reads the page as it is now; the caller holds the page, so nobody else
+			 * writes it meanwhile.
+			 */
+			template <class Fetch>
+			void preserve(ssize_t offset, size_t size, Fetch fetch) {
+				if (!active()) return;
+				uint64_t w, gen;
+				size_t slot;
+				{
+					std::lock_guard <std::mutex> lock(latch);
+					if (live_cnt == 0 || offset >= horizon) return;
+					version **head = table.find(offset);
+					uint64_t last = head != nullptr && *head != nullptr ? (*head) -> epoch : 0;
+					// saved in this epoch already, or nobody reads the current content.
+					if (last == epoch || newest < last) return;
+					w = epoch, gen = generation;
+					slot = take_slot();
+				}
+				char *buf = new char[page];
+				fetch(buf);
+				try {
+					write_at(fileno(fp), buf, size, static_cast <off_t> (slot * page));
+				} catch (...) {
+					delete [] buf;
+					throw;
+				}
+				delete [] buf;
+				std::lock_guard <std::mutex> lock(latch);
+				if (gen != generation) return;
+				version **head = table.find(offset);
+				version *v = new version;
+				v -> epoch = w, v -> slot = slot;
+				v -> nxt = head != nullptr ? *head : nullptr;
+				table.insert(offset, v);
+			}
+
+			/**
+			 * function: if the snapshot of epoch e saw the page at offset differently from now,
+			 * put that content in *place and return true.
+			 * the caller reads the page itself first and asks after, so that a write racing with
+			 * that read has already been preserved if it could have changed what was read.
+			 */
+			bool read(void *place, ssize_t offset, size_t size, uint64_t e) const {
+				size_t slot = 0;
+				bool found = 0;
+				{
+					std::lock_guard <std::mutex> lock(latch);
+					version **head = table.find(offset);
+					for (version *v = head != nullptr ? *head : nullptr; v != nullptr && v -> epoch > e; v = v -> nxt)
+						slot = v -> slot, found = 1;
+				}
+				if (found) read_at(fileno(fp), place, size, static_cast <off_t> (slot * page));
+				return found;
+			}
+
+			size_t retained() const {
+				std::lock_guard <std::mutex> lock(latch);
+				return slots - free_cnt;
+			}
+	};
+
+}  // namespace sjtu
+
+#endif //BPLUSTREE_VERSIONS_H